@@ -0,0 +1,132 @@
+// Measures the time to encode a QR Code of each version, with the data filling the version at error
+// correction level LOW and the mask chosen automatically, which exercises the codeword placement,
+// masking and penalty scoring for that size. The second column encodes 64 different texts of the
+// same length at once with a BatchEncoder, and reports the time per QR Code. The third column re-encodes
+// one text with an IncrementalEncoder after changing its last character, like typing in the GUI. The fourth
+// column is the first with qrcodegen_Mask_AUTO_PARALLEL, which this program starts threads for at every
+// version, so comparing it with the first shows from which version the threads pay off.
+//
+// Usage: qrcodegen_bench [min_version [max_version]]
+
+#include "qrcodegen.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+static const int kBatchSize = 64;
+
+static int max_bytes_for_version(int version) {
+  int low = 0, high = 2953;
+  while (low < high) {  // Largest byte count that still fits in this version
+    int mid               = (low + high + 1) / 2;
+    qrcodegen_Segment seg = {qrcodegen_Mode_BYTE, mid, nullptr, mid * 8};
+    if (qrcodegen_getMinVersion(&seg, 1, qrcodegen_Ecc_LOW, version, version) != 0) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return low;
+}
+
+// Returns the best time per QR Code of many short rounds, which filters out interruptions by other
+// processes. Each call of encode_some makes the given number of QR Codes, or returns false on failure.
+template <typename Fn>
+static double time_per_code(int codes_per_call, Fn encode_some) {
+  double best = 0;
+  for (int round = 0; round < 40; ++round) {
+    long codes = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed;
+    do {
+      if (!encode_some()) return -1;
+      codes += codes_per_call;
+      elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 5000);
+    double per = elapsed / (double)codes;
+    if (round == 0 || per < best) best = per;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  int min_ver = argc > 1 ? std::atoi(argv[1]) : qrcodegen_VERSION_MIN;
+  int max_ver = argc > 2 ? std::atoi(argv[2]) : qrcodegen_VERSION_MAX;
+  if (min_ver < qrcodegen_VERSION_MIN || max_ver > qrcodegen_VERSION_MAX || min_ver > max_ver) {
+    std::fprintf(stderr, "Usage: %s [min_version [max_version]]\n", argv[0]);
+    return 1;
+  }
+
+  qrcodegen::Encoder encoder;
+  qrcodegen::BatchEncoder batch_encoder;
+  qrcodegen::IncrementalEncoder incremental_encoder;
+  qrcodegen::EncodeOptions options;
+  options.mask     = qrcodegen_Mask_AUTO;
+  options.boostEcl = false;
+
+  // Lowercase letters are encoded in byte mode, like the binary data
+  std::vector<uint8_t> data(2953);
+  std::vector<std::string> texts(kBatchSize, std::string(2953, 'a'));
+  uint32_t state = 12345;
+  for (uint8_t& b : data) {
+    state = state * 1103515245u + 12345u;
+    b     = (uint8_t)(state >> 24);
+  }
+  for (std::string& text : texts) {
+    for (char& c : text) {
+      state = state * 1103515245u + 12345u;
+      c     = (char)('a' + (state >> 24) % 26);
+    }
+  }
+  std::vector<std::vector<uint8_t>> qrcodes(kBatchSize, std::vector<uint8_t>(qrcodegen_BUFFER_LEN_MAX));
+  std::vector<uint8_t*> qrcode_ptrs;
+  for (std::vector<uint8_t>& qrcode : qrcodes) qrcode_ptrs.push_back(qrcode.data());
+
+  std::printf("version  size   us/encode  us/batched     us/edit  us/parallel\n");
+  for (int version = min_ver; version <= max_ver; ++version) {
+    int len            = max_bytes_for_version(version);
+    options.minVersion = version;
+    options.maxVersion = version;
+
+    double single = time_per_code(16, [&] {
+      for (int i = 0; i < 16; ++i) {
+        if (!encoder.encodeBinary(data.data(), (size_t)len, options)) return false;
+      }
+      return true;
+    });
+
+    std::vector<std::string> batch_texts;
+    std::vector<const char*> text_ptrs;
+    for (const std::string& text : texts) batch_texts.push_back(text.substr(0, (size_t)len));
+    for (const std::string& text : batch_texts) text_ptrs.push_back(text.c_str());
+    double batched = time_per_code(kBatchSize, [&] {
+      return batch_encoder.encode(text_ptrs.data(), text_ptrs.size(), qrcode_ptrs.data(), options) == text_ptrs.size();
+    });
+
+    qrcodegen::EncodeOptions parallel_options = options;
+    parallel_options.mask                     = qrcodegen_Mask_AUTO_PARALLEL;
+    double parallel                           = time_per_code(16, [&] {
+      for (int i = 0; i < 16; ++i) {
+        if (!encoder.encodeBinary(data.data(), (size_t)len, parallel_options)) return false;
+      }
+      return true;
+    });
+
+    std::string edited = batch_texts[0];
+    int edits          = 0;
+    double edit        = time_per_code(1, [&] {
+      edited.back() = (char)('a' + edits++ % 26);
+      return (bool)incremental_encoder.encode(edited.c_str(), options);
+    });
+
+    if (single < 0 || batched < 0 || edit < 0 || parallel < 0) {
+      std::fprintf(stderr, "Encoding version %d failed\n", version);
+      return 1;
+    }
+    std::printf("%7d  %4d  %10.2f  %10.2f  %10.2f  %11.2f\n", version, version * 4 + 17, single, batched, edit, parallel);
+  }
+  return 0;
+}
@@ -0,0 +1,85 @@
+// Measures how the throughput of qrcodegen::encodeBatch() scales with the number of threads, on jobs whose
+// text lengths spread them over versions 1 to 25 like a print run of labels, tickets and links. Every row
+// encodes the same jobs and checks that the QR Codes are the same as with one thread.
+//
+// Usage: qrcodegen_scaling_bench [max_threads [num_jobs]]
+
+#include "qrcodegen.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Returns the best time of a few rounds of encoding all the jobs, in seconds.
+static double time_batch(const std::vector<qrcodegen::EncodeJob>& jobs, std::vector<qrcodegen::EncodeResult>& results,
+                         int threads) {
+  double best = 0;
+  for (int round = 0; round < 5; ++round) {
+    auto start = std::chrono::steady_clock::now();
+    qrcodegen::encodeBatch(jobs.data(), results.data(), jobs.size(), threads);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (round == 0 || elapsed < best) best = elapsed;
+  }
+  return best;
+}
+
+int main(int argc, char** argv) {
+  int max_threads = argc > 1 ? std::atoi(argv[1]) : (int)std::thread::hardware_concurrency();
+  int num_jobs    = argc > 2 ? std::atoi(argv[2]) : 20000;
+  if (max_threads < 1 || num_jobs < 1) {
+    std::fprintf(stderr, "Usage: %s [max_threads [num_jobs]]\n", argv[0]);
+    return 1;
+  }
+
+  // Mostly short texts, some of them numeric, with a tail of longer ones
+  std::vector<std::string> texts((size_t)num_jobs);
+  uint32_t state = 12345;
+  auto next_random = [&state](uint32_t bound) {
+    state = state * 1103515245u + 12345u;
+    return (state >> 8) % bound;
+  };
+  for (std::string& text : texts) {
+    uint32_t kind = next_random(10);
+    size_t len    = kind < 6 ? 8 + next_random(40) : kind < 9 ? 40 + next_random(160) : 200 + next_random(600);
+    bool numeric  = next_random(3) == 0;
+    for (size_t i = 0; i < len; ++i) text += (char)(numeric ? '0' + next_random(10) : 'a' + next_random(26));
+  }
+  std::vector<qrcodegen::EncodeJob> jobs((size_t)num_jobs);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    jobs[i].text             = texts[i].c_str();
+    jobs[i].options.mask     = qrcodegen_Mask_AUTO;
+    jobs[i].options.boostEcl = false;
+  }
+
+  std::vector<std::vector<uint8_t>> reference((size_t)num_jobs, std::vector<uint8_t>(qrcodegen_BUFFER_LEN_MAX));
+  std::vector<std::vector<uint8_t>> qrcodes((size_t)num_jobs, std::vector<uint8_t>(qrcodegen_BUFFER_LEN_MAX));
+  std::vector<qrcodegen::EncodeResult> reference_results((size_t)num_jobs);
+  std::vector<qrcodegen::EncodeResult> results((size_t)num_jobs);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    reference_results[i].qrcode = reference[i].data();
+    results[i].qrcode           = qrcodes[i].data();
+  }
+
+  double single = time_batch(jobs, reference_results, 1);
+  std::printf("threads   codes/s  speedup  efficiency\n");
+  std::printf("%7d  %8.0f  %7.2f  %10.2f\n", 1, num_jobs / single, 1.0, 1.0);
+  std::vector<int> thread_counts;  // Powers of 2, then max_threads
+  for (int threads = 2; threads < max_threads; threads *= 2) thread_counts.push_back(threads);
+  if (max_threads > 1) thread_counts.push_back(max_threads);
+  for (int threads : thread_counts) {
+    double elapsed = time_batch(jobs, results, threads);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+      if (results[i].ok != reference_results[i].ok ||
+          std::memcmp(qrcodes[i].data(), reference[i].data(), qrcodegen_BUFFER_LEN_MAX) != 0) {
+        std::fprintf(stderr, "QR Code %zu differs with %d threads\n", i, threads);
+        return 1;
+      }
+    }
+    std::printf("%7d  %8.0f  %7.2f  %10.2f\n", threads, num_jobs / elapsed, single / elapsed, single / elapsed / threads);
+  }
+  return 0;
+}
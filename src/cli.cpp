@@ -0,0 +1,269 @@
+#include "cli.h"
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#ifdef _WIN32
+  #include <fcntl.h>
+  #include <io.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#define CLI_SCALE_MAX  64
+#define CLI_BORDER_MAX 64
+
+struct cli_command_t {
+  const char* name;
+  int (*run)(int argc, char** argv);
+  const char* usage;
+};
+
+const char* const cli_image_usage =
+    "  --ecc LEVEL         low (default), medium, quartile or high\n"
+    "  --mask MASK         auto (default) or 0 to 7\n"
+    "  --min-version N     the smallest version to use, 1 (default) to 40\n"
+    "  --max-version N     the largest version to use, 1 to 40 (default)\n"
+    "  --boost-ecc         raise the error correction level while the version stays the same\n"
+    "  --optimal           split the text into segments of the most compact modes\n"
+    "  --scale N           pixels per module, 1 to 64 (default 8)\n"
+    "  --border N          light modules around the QR code, 0 to 64 (default 4)\n";
+
+static const cli_command_t cli_commands[] = {
+    {"encode", cli_encode,
+     "Usage: qrview encode --text TEXT [options] -o FILE.png\n"
+     "Encodes TEXT into a QR code and writes it as a grayscale PNG (to stdout if FILE is -).\n"
+     "\n"
+     "  --text TEXT         the UTF-8 text to encode\n"
+     "  -o, --output FILE   the PNG file to write\n"},
+    {"batch", cli_batch,
+     "Usage: qrview batch FILE --out DIR [options]\n"
+     "Encodes every payload of FILE into DIR/<row>.png, where row is the line or CSV row of the payload\n"
+     "counting from 1 (blank lines are skipped), or into DIR/<name>.png if the rows have names. FILE has\n"
+     "one payload per line, or is read as CSV if it ends in .csv, or as JSON objects one per line if it\n"
+     "ends in .ndjson or .jsonl. The payloads are encoded and compressed on several threads at once, and\n"
+     "the files are written in the order of FILE.\n"
+     "\n"
+     "  --out DIR           the directory to write the PNG files into, created if missing, or a .tar or\n"
+     "                      .zip file to stream them into, or - for a tar stream on stdout\n"
+     "  --tar, --zip        write a tar or zip file (STORED, Zip64 if needed) to --out, whatever its name\n"
+     "  --lines, --csv, --ndjson\n"
+     "                      read FILE as one payload per line, CSV or NDJSON, whatever its name\n"
+     "  --column N          the CSV column of the payloads, counting from 1 (default 1)\n"
+     "  --name-column N     the CSV column of the file names, where a row with the name of an earlier row\n"
+     "                      is skipped as an error\n"
+     "  --field KEY         the NDJSON field of the payloads (default text)\n"
+     "  --name-field KEY    the NDJSON field of the file names, likewise\n"
+     "  --header            skip the first row of FILE\n"
+     "  --threads N         the number of encoding and compressing threads (default one per core)\n"},
+};
+
+static const cli_command_t* cli_find_command(const char* name) {
+  for (const cli_command_t& command : cli_commands) {
+    if (strcmp(command.name, name) == 0) return &command;
+  }
+  return nullptr;
+}
+
+bool cli_is_command(int argc, char** argv) {
+  return argc > 1 && cli_find_command(argv[1]) != nullptr;
+}
+
+int cli_main(int argc, char** argv) {
+  const cli_command_t* command = argc > 1 ? cli_find_command(argv[1]) : nullptr;
+  if (command == nullptr) {
+    std::cerr << "Usage: qrview [encode | batch] [options]\n";
+    return 1;
+  }
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      std::cout << command->usage << cli_image_usage;
+      return 0;
+    }
+  }
+  return command->run(argc - 1, argv + 1);
+}
+
+bool cli_parse_int(const char* option, const char* value, int min, int max, int* result) {
+  char* end;
+  long n = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || n < min || n > max) {
+    std::cerr << "Invalid value for " << option << ": " << value << " (expected " << min << " to " << max << ")\n";
+    return false;
+  }
+  *result = (int)n;
+  return true;
+}
+
+int cli_parse_image_option(int argc, char** argv, int* i, cli_image_options_t* options) {
+  const char* arg                    = argv[*i];
+  qrcodegen::EncodeOptions& encoding = options->encode;
+  if (strcmp(arg, "--boost-ecc") == 0) {
+    encoding.boostEcl = true;
+    return 1;
+  }
+  if (strcmp(arg, "--optimal") == 0) {
+    encoding.optimalSegments = true;
+    return 1;
+  }
+  static const char* const with_value[] = {"--ecc", "--mask", "--min-version", "--max-version", "--scale", "--border"};
+  bool known                            = false;
+  for (const char* option : with_value) known = known || strcmp(arg, option) == 0;
+  if (!known) return 0;
+  if (*i + 1 >= argc) {
+    std::cerr << "Missing value for " << arg << '\n';
+    return -1;
+  }
+  const char* value = argv[++*i];
+
+  if (strcmp(arg, "--ecc") == 0) {
+    static const char* const levels[] = {"low", "medium", "quartile", "high"};
+    int level                         = 0;
+    while (level < 4 && strcmp(value, levels[level]) != 0) ++level;
+    if (level == 4) {
+      std::cerr << "Invalid value for --ecc: " << value << " (expected low, medium, quartile or high)\n";
+      return -1;
+    }
+    encoding.ecl = (qrcodegen_Ecc)level;
+  } else if (strcmp(arg, "--mask") == 0) {
+    int mask = -1;
+    if (strcmp(value, "auto") != 0 && !cli_parse_int(arg, value, 0, 7, &mask)) return -1;
+    encoding.mask = (qrcodegen_Mask)mask;
+  } else if (strcmp(arg, "--min-version") == 0) {
+    if (!cli_parse_int(arg, value, qrcodegen_VERSION_MIN, qrcodegen_VERSION_MAX, &encoding.minVersion)) return -1;
+  } else if (strcmp(arg, "--max-version") == 0) {
+    if (!cli_parse_int(arg, value, qrcodegen_VERSION_MIN, qrcodegen_VERSION_MAX, &encoding.maxVersion)) return -1;
+  } else if (strcmp(arg, "--scale") == 0) {
+    if (!cli_parse_int(arg, value, 1, CLI_SCALE_MAX, &options->scale)) return -1;
+  } else {
+    if (!cli_parse_int(arg, value, 0, CLI_BORDER_MAX, &options->border)) return -1;
+  }
+  return 1;
+}
+
+int cli_rasterize(const uint8_t qrcode[], const cli_image_options_t& options, std::vector<uint8_t>* pixels) {
+  int qr_size    = qrcodegen_getSize(qrcode);
+  int scale      = options.scale;
+  int border     = options.border;
+  int image_size = (qr_size + border * 2) * scale;
+  pixels->assign((size_t)image_size * image_size, 0xFF);
+  for (int y = 0; y < qr_size; ++y) {
+    uint8_t* row = &(*pixels)[(size_t)(y + border) * scale * image_size + (size_t)border * scale];
+    for (int x = 0; x < qr_size; ++x) {
+      if (qrcodegen_getModule(qrcode, x, y)) memset(&row[x * scale], 0x00, (size_t)scale);
+    }
+    for (int i = 1; i < scale; ++i) memcpy(row + (size_t)i * image_size, row, (size_t)qr_size * scale);
+  }
+  return image_size;
+}
+
+FILE* cli_open_output(const char* path) {
+  if (strcmp(path, "-") != 0) return fopen(path, "wb");
+#ifdef _WIN32
+  _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  return stdout;
+}
+
+static void cli_append_bytes(void* context, void* data, int size) {
+  std::vector<uint8_t>* bytes = (std::vector<uint8_t>*)context;
+  bytes->insert(bytes->end(), (uint8_t*)data, (uint8_t*)data + size);
+}
+
+// The CRC-32 of each byte value, for the reflected polynomial 0xEDB88320
+struct cli_crc32_table_t {
+  uint32_t values[256];
+};
+
+static constexpr cli_crc32_table_t cli_make_crc32_table() {
+  cli_crc32_table_t table = {};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) crc = crc >> 1 ^ (crc & 1 ? 0xEDB88320u : 0);
+    table.values[i] = crc;
+  }
+  return table;
+}
+
+static constexpr cli_crc32_table_t cli_crc32_table = cli_make_crc32_table();
+
+uint32_t cli_crc32(const uint8_t data[], size_t size) {
+  uint32_t crc = 0xFFFFFFFFu;
+  for (size_t i = 0; i < size; ++i) crc = crc >> 8 ^ cli_crc32_table.values[(crc ^ data[i]) & 0xFF];
+  return ~crc;
+}
+
+bool cli_compress_png(const std::vector<uint8_t>& pixels, int size, std::vector<uint8_t>* png) {
+  // Most rows of a QR code image repeat the row above, which the Up filter turns into zeros. Trying every
+  // filter on every row, as stb_image_write does by default, takes twice as long for a few percent smaller files.
+  // The setting is global, so it is made once, before any thread compresses.
+  static const int filter = stbi_write_force_png_filter = 2;
+  (void)filter;
+  png->clear();
+  return stbi_write_png_to_func(cli_append_bytes, png, size, size, 1, pixels.data(), size) != 0;
+}
+
+int cli_encode(int argc, char** argv) {
+  const char* text   = nullptr;
+  const char* output = nullptr;
+  cli_image_options_t options;
+  options.encode.boostEcl = false;
+
+  for (int i = 1; i < argc; ++i) {
+    int parsed = cli_parse_image_option(argc, argv, &i, &options);
+    if (parsed < 0) return 1;
+    if (parsed > 0) continue;
+    const char* arg = argv[i];
+    bool is_text    = strcmp(arg, "--text") == 0;
+    bool is_output  = strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0;
+    if (!is_text && !is_output) {
+      std::cerr << "Unknown argument: " << arg << '\n';
+      return 1;
+    }
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << '\n';
+      return 1;
+    }
+    if (is_text) {
+      text = argv[++i];
+    } else {
+      output = argv[++i];
+    }
+  }
+  if (text == nullptr || output == nullptr) {
+    std::cerr << "qrview encode needs --text and -o (see qrview encode --help)\n";
+    return 1;
+  }
+  if (options.encode.minVersion > options.encode.maxVersion) {
+    std::cerr << "--min-version is greater than --max-version\n";
+    return 1;
+  }
+
+  qrcodegen::Encoder encoder;
+  qrcodegen::QrCodeView qr = encoder.encode(text, options.encode);
+  if (!qr) {
+    std::cerr << "Failed to encode QR code: the text does not fit in version " << options.encode.maxVersion << '\n';
+    return 1;
+  }
+  std::vector<uint8_t> qrcode(qrcodegen_BUFFER_LEN_MAX);
+  qr.copyTo(qrcode.data());
+
+  std::vector<uint8_t> pixels, png;
+  int image_size = cli_rasterize(qrcode.data(), options, &pixels);
+  if (!cli_compress_png(pixels, image_size, &png)) {
+    std::cerr << "Failed to compress the PNG\n";
+    return 1;
+  }
+  FILE* file   = cli_open_output(output);
+  bool written = file != nullptr && fwrite(png.data(), 1, png.size(), file) == png.size();
+  if (file != nullptr) written = (file == stdout ? fflush(file) : fclose(file)) == 0 && written;
+  if (!written) {
+    std::cerr << "Failed to write " << output << '\n';
+    return 1;
+  }
+  return 0;
+}
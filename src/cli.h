@@ -0,0 +1,148 @@
+#pragma once
+
+#include "qrcodegen.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Returns whether the command line names a headless command, such as "qrview encode ...",
+// which cli_main() runs without initializing SDL or ImGui.
+bool cli_is_command(int argc, char** argv);
+
+// Runs the headless command named by argv[1], and returns the exit status of the process.
+int cli_main(int argc, char** argv);
+
+// The commands, which get the arguments after the name of the program
+int cli_encode(int argc, char** argv);
+int cli_batch(int argc, char** argv);
+
+// How the commands encode and draw QR codes
+struct cli_image_options_t {
+  qrcodegen::EncodeOptions encode;
+  int scale  = 8;  // Pixels per module
+  int border = 4;  // Light modules around the QR code
+};
+
+// The usage lines of the options of cli_image_options_t
+extern const char* const cli_image_usage;
+
+// Parses a whole decimal integer in [min, max] into result, or prints an error naming the option.
+bool cli_parse_int(const char* option, const char* value, int min, int max, int* result);
+
+// If argv[*i] is one of the options of cli_image_options_t, parses it into options, advances *i past its
+// value, and returns 1. Returns 0 if it is another argument, or -1 after printing an error.
+int cli_parse_image_option(int argc, char** argv, int* i, cli_image_options_t* options);
+
+// Draws the given QR code in the format of the C functions as a grayscale image, one byte per pixel with
+// dark modules black, into pixels, and returns the width and height of the image.
+int cli_rasterize(const uint8_t qrcode[], const cli_image_options_t& options, std::vector<uint8_t>* pixels);
+
+// Opens the file at path for writing bytes, or standard output in binary mode if path is "-". Returns
+// nullptr if the file can't be opened.
+FILE* cli_open_output(const char* path);
+
+// Returns the CRC-32 of the bytes, as in PNG and zip files.
+uint32_t cli_crc32(const uint8_t data[], size_t size);
+
+// Compresses a grayscale image of the given width and height into the bytes of a PNG file, replacing the
+// contents of png. Returns false if stb_image_write failed.
+bool cli_compress_png(const std::vector<uint8_t>& pixels, int size, std::vector<uint8_t>* png);
+
+// How qrview batch reads its payload file
+enum cli_input_format_t { CLI_INPUT_LINES, CLI_INPUT_CSV, CLI_INPUT_NDJSON };
+
+// Which fields of the rows of the payload file hold the payloads, and the names of their PNG files
+struct cli_input_options_t {
+  cli_input_format_t format = CLI_INPUT_LINES;
+  int column                = 1;       // The CSV column of the payloads, counting from 1
+  int name_column           = 0;       // The CSV column of the names, or 0 to name the files by row
+  std::string field         = "text";  // The NDJSON field of the payloads
+  std::string name_field;              // The NDJSON field of the names, or empty to name the files by row
+  bool header = false;                 // Skip the first row
+};
+
+// Some text within the payload file, which is not NUL-terminated. A quoted CSV field with doubled double
+// quotes, or a JSON string with backslash escapes, is escaped, and cli_unescape() gives its text.
+struct cli_field_t {
+  const char* data = nullptr;
+  size_t size      = 0;
+  char escaped     = 0;  // 0 if data is the text itself, '"' for CSV escapes or '\\' for JSON escapes
+};
+
+// A row of the payload file
+struct cli_payload_t {
+  cli_field_t text;
+  cli_field_t name;             // Empty if the files are named by row
+  size_t row;                   // The line or CSV row, counting from 1
+  const char* error = nullptr;  // Why the row has no payload, such as "is not a JSON object", or why it failed
+};
+
+// A payload file mapped into memory, or read whole if it can't be mapped, such as a pipe. The payloads
+// point into it, so they are valid as long as the cli_input_t. Delimiters are found 16 bytes at a time.
+class cli_input_t {
+ public:
+  cli_input_t() = default;
+  cli_input_t(const cli_input_t&) = delete;
+  cli_input_t& operator=(const cli_input_t&) = delete;
+  ~cli_input_t();
+
+  // Opens the file, or returns false after printing an error.
+  bool open(const char* path);
+
+  // Replaces payloads with up to max of the next rows, skipping the header and blank rows. Returns false
+  // once the whole file has been read.
+  bool read(const cli_input_options_t& options, size_t max, std::vector<cli_payload_t>* payloads);
+
+ private:
+  const char* data = nullptr;
+  size_t size      = 0;
+  size_t pos       = 0;  // Where the next row starts
+  size_t row       = 0;  // The rows before pos
+  std::vector<char> contents;  // The file if it isn't mapped
+#ifdef _WIN32
+  void* mapping = nullptr;
+#else
+  bool mapped = false;
+#endif
+};
+
+// Appends the text of field, with its escapes replaced by the characters they stand for, to text.
+void cli_unescape(const cli_field_t& field, std::string* text);
+
+// The formats that qrview batch can write its PNG files in
+enum cli_archive_format_t { CLI_ARCHIVE_TAR, CLI_ARCHIVE_ZIP };
+
+// A tar or zip file, or standard output, that files are streamed into one after another, without seeking.
+// A zip file is STORED, so the PNG files are not compressed twice, and is written as Zip64 when it gets
+// too big for a plain zip file. Its central directory is kept in memory until close().
+class cli_archive_t {
+ public:
+  cli_archive_t() = default;
+  cli_archive_t(const cli_archive_t&) = delete;
+  cli_archive_t& operator=(const cli_archive_t&) = delete;
+  ~cli_archive_t();
+
+  // Opens the archive, which is standard output if path is "-", or returns false after printing an error.
+  bool open(const char* path, cli_archive_format_t format);
+
+  // The longest file name that the format holds, in bytes
+  size_t name_max() const { return format == CLI_ARCHIVE_TAR ? 100 : 0xFFFF; }
+
+  // Appends a file, whose name is at most name_max() bytes. Returns false if writing failed.
+  bool add(const std::string& name, const uint8_t data[], size_t size);
+
+  // Ends the archive and closes it. Returns false if writing failed.
+  bool close();
+
+ private:
+  bool write(const void* data, size_t size);
+
+  FILE* file = nullptr;
+  cli_archive_format_t format = CLI_ARCHIVE_TAR;
+  uint64_t offset  = 0;  // Bytes written so far
+  uint64_t entries = 0;
+  uint32_t time    = 0;  // When the archive was opened, as a Unix time for tar or a DOS time and date for zip
+  std::vector<uint8_t> central;  // The central directory of a zip file
+};
@@ -0,0 +1,155 @@
+#include "cli.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#define ARCHIVE_BUFFER    (1 << 20)  // Bytes buffered before they are written
+#define TAR_BLOCK         512
+#define ZIP_LOCAL_HEADER  0x04034b50
+#define ZIP_CENTRAL       0x02014b50
+#define ZIP_END           0x06054b50
+#define ZIP64_END         0x06064b50
+#define ZIP64_LOCATOR     0x07064b50
+#define ZIP_UTF8_NAMES    0x0800
+#define ZIP_STORED        0
+#define ZIP_VERSION       10  // Version 1.0 of the format is enough for STORED files
+#define ZIP64_VERSION     45
+
+// Appends a little-endian integer of the given number of bytes.
+static void archive_put(std::vector<uint8_t>* bytes, uint64_t value, int size) {
+  for (int i = 0; i < size; ++i) bytes->push_back((uint8_t)(value >> (i * 8)));
+}
+
+// Writes value as an octal number that fills the field but its last byte, which is NUL.
+static void archive_put_octal(char* field, size_t size, uint64_t value) {
+  field[size - 1] = '\0';
+  for (size_t i = size - 1; i-- > 0; value >>= 3) field[i] = (char)('0' + (value & 7));
+}
+
+cli_archive_t::~cli_archive_t() {
+  if (file != nullptr && file != stdout) fclose(file);
+}
+
+bool cli_archive_t::open(const char* path, cli_archive_format_t archive_format) {
+  format = archive_format;
+  file   = cli_open_output(path);
+  if (file == nullptr) {
+    std::cerr << "Failed to open " << path << '\n';
+    return false;
+  }
+  setvbuf(file, nullptr, _IOFBF, ARCHIVE_BUFFER);
+
+  std::time_t now = std::time(nullptr);
+  if (format == CLI_ARCHIVE_TAR) {
+    time = (uint32_t)now;
+  } else {
+    const std::tm* local = std::localtime(&now);
+    int year             = local->tm_year + 1900 < 1980 ? 1980 : local->tm_year + 1900;
+    time = (uint32_t)((year - 1980) << 9 | (local->tm_mon + 1) << 5 | local->tm_mday) << 16 |
+           (uint32_t)(local->tm_hour << 11 | local->tm_min << 5 | local->tm_sec / 2);
+  }
+  return true;
+}
+
+bool cli_archive_t::write(const void* data, size_t size) {
+  offset += size;
+  return fwrite(data, 1, size, file) == size;
+}
+
+bool cli_archive_t::add(const std::string& name, const uint8_t data[], size_t size) {
+  if (name.size() > name_max()) return false;
+  ++entries;
+  if (format == CLI_ARCHIVE_TAR) {
+    char header[TAR_BLOCK] = {};
+    memcpy(header, name.data(), name.size());
+    archive_put_octal(header + 100, 8, 0644);  // Mode
+    archive_put_octal(header + 108, 8, 0);     // User
+    archive_put_octal(header + 116, 8, 0);     // Group
+    archive_put_octal(header + 124, 12, size);
+    archive_put_octal(header + 136, 12, time);
+    header[156] = '0';  // A regular file
+    memcpy(header + 257, "ustar\0" "00", 8);
+    memset(header + 148, ' ', 8);  // The checksum counts its own field as spaces
+    unsigned checksum = 0;
+    for (char c : header) checksum += (unsigned char)c;
+    archive_put_octal(header + 148, 7, checksum);
+    static const char padding[TAR_BLOCK] = {};
+    return write(header, sizeof(header)) && write(data, size) && write(padding, (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK);
+  }
+
+  // The local header, which the central directory repeats with where it starts. An entry past 4 GiB needs
+  // Zip64 for its offset, and both headers say so in the version needed to extract it.
+  bool zip64   = offset >= 0xFFFFFFFF;
+  uint32_t crc = cli_crc32(data, size);
+  std::vector<uint8_t> header;
+  archive_put(&header, ZIP_LOCAL_HEADER, 4);
+  archive_put(&header, zip64 ? ZIP64_VERSION : ZIP_VERSION, 2);
+  archive_put(&header, ZIP_UTF8_NAMES, 2);
+  archive_put(&header, ZIP_STORED, 2);
+  archive_put(&header, time, 4);
+  archive_put(&header, crc, 4);
+  archive_put(&header, size, 4);  // Compressed
+  archive_put(&header, size, 4);
+  archive_put(&header, name.size(), 2);
+  archive_put(&header, 0, 2);  // Extra field
+
+  archive_put(&central, ZIP_CENTRAL, 4);
+  archive_put(&central, ZIP64_VERSION, 2);  // Made by
+  central.insert(central.end(), header.begin() + 4, header.begin() + 28);
+  archive_put(&central, zip64 ? 12 : 0, 2);  // Extra field
+  archive_put(&central, 0, 2);               // Comment
+  archive_put(&central, 0, 2);               // Disk
+  archive_put(&central, 0, 2);               // Internal attributes
+  archive_put(&central, 0100644u << 16, 4);  // A regular file, as Unix file modes
+  archive_put(&central, zip64 ? 0xFFFFFFFF : offset, 4);
+  central.insert(central.end(), name.begin(), name.end());
+  if (zip64) {  // The Zip64 extended information, which has only the offset
+    archive_put(&central, 0x0001, 2);
+    archive_put(&central, 8, 2);
+    archive_put(&central, offset, 8);
+  }
+  return write(header.data(), header.size()) && write(name.data(), name.size()) && write(data, size);
+}
+
+bool cli_archive_t::close() {
+  bool ok = true;
+  if (format == CLI_ARCHIVE_TAR) {
+    static const char end[TAR_BLOCK * 2] = {};
+    ok = write(end, sizeof(end));
+  } else {
+    uint64_t central_offset = offset;
+    ok                      = write(central.data(), central.size());
+    std::vector<uint8_t> end;
+    if (entries >= 0xFFFF || central_offset >= 0xFFFFFFFF || central.size() >= 0xFFFFFFFF) {
+      uint64_t end64_offset = offset;
+      archive_put(&end, ZIP64_END, 4);
+      archive_put(&end, 44, 8);  // Size of the rest of the record
+      archive_put(&end, ZIP64_VERSION, 2);
+      archive_put(&end, ZIP64_VERSION, 2);
+      archive_put(&end, 0, 4);  // Disk
+      archive_put(&end, 0, 4);  // Disk of the central directory
+      archive_put(&end, entries, 8);
+      archive_put(&end, entries, 8);
+      archive_put(&end, central.size(), 8);
+      archive_put(&end, central_offset, 8);
+      archive_put(&end, ZIP64_LOCATOR, 4);
+      archive_put(&end, 0, 4);  // Disk of the Zip64 end record
+      archive_put(&end, end64_offset, 8);
+      archive_put(&end, 1, 4);  // Disks
+    }
+    archive_put(&end, ZIP_END, 4);
+    archive_put(&end, 0, 2);  // Disk
+    archive_put(&end, 0, 2);  // Disk of the central directory
+    archive_put(&end, entries < 0xFFFF ? entries : 0xFFFF, 2);
+    archive_put(&end, entries < 0xFFFF ? entries : 0xFFFF, 2);
+    archive_put(&end, central.size() < 0xFFFFFFFF ? central.size() : 0xFFFFFFFF, 4);
+    archive_put(&end, central_offset < 0xFFFFFFFF ? central_offset : 0xFFFFFFFF, 4);
+    archive_put(&end, 0, 2);  // Comment
+    ok = ok && write(end.data(), end.size());
+  }
+  ok = (file == stdout ? fflush(file) : fclose(file)) == 0 && ok;
+  file = nullptr;
+  return ok;
+}
@@ -0,0 +1,389 @@
+#include "cli.h"
+
+#include <sys/stat.h>
+#ifdef _WIN32
+  #include <direct.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#define BATCH_ITEMS       256    // Payloads in each unit of work that goes through the pipeline
+#define BATCH_QUEUE_UNITS 4      // Units that each queue holds for every thread that takes from it
+#define BATCH_FAILURES    10     // Failed payloads that are reported one by one
+
+// A queue between two stages of the pipeline. Pushing blocks while it is full, which holds back the stages
+// before it, and popping blocks while it is empty. After close(), pushes fail and pops fail once it is empty.
+template <typename T>
+class batch_queue_t {
+ public:
+  explicit batch_queue_t(size_t capacity) : max_size(capacity) {}
+
+  size_t capacity() const {
+    return max_size;
+  }
+
+  bool push(T&& item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_full.wait(lock, [this] { return closed || items.size() < max_size; });
+    if (closed) return false;
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+    return true;
+  }
+
+  bool pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    not_empty.wait(lock, [this] { return closed || !items.empty(); });
+    if (items.empty()) return false;
+    *item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    not_full.notify_all();
+    not_empty.notify_all();
+  }
+
+ private:
+  std::mutex mutex;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> items;
+  size_t max_size;
+  bool closed = false;
+};
+
+// Some payloads of the file, which then get their QR codes, each in a buffer of
+// qrcodegen_BUFFER_LEN_FOR_VERSION(max version) bytes, and then their PNG files, one after another
+struct batch_unit_t {
+  size_t index = 0;  // Which unit of the file it is, counting from 0
+  std::vector<cli_payload_t> payloads;
+  std::vector<uint8_t> bytes;
+  std::vector<size_t> ends;  // Where the PNG file of each payload ends in bytes
+};
+
+struct batch_args_t {
+  const char* input = nullptr;
+  std::string out;
+  bool archive = false;  // Whether out is an archive, rather than a directory
+  cli_archive_format_t archive_format = CLI_ARCHIVE_TAR;
+  int threads = 0;
+  cli_input_options_t input_options;
+  cli_image_options_t image;
+  std::string too_long;  // The error of the payloads that don't fit
+};
+
+static void batch_encode(batch_queue_t<batch_unit_t>* in, batch_queue_t<batch_unit_t>* out, const batch_args_t& args);
+static void batch_compress(batch_queue_t<batch_unit_t>* in, batch_queue_t<batch_unit_t>* out, const batch_args_t& args);
+static bool batch_has_names(const cli_input_options_t& options);
+static bool batch_file_name(const cli_payload_t& payload, const batch_args_t& args, std::string* name);
+static bool batch_make_dir(const std::string& dir);
+
+// Returns whether the string ends with the suffix.
+static bool batch_ends_with(const char* string, const char* suffix) {
+  size_t len = strlen(string), suffix_len = strlen(suffix);
+  return len >= suffix_len && strcmp(string + len - suffix_len, suffix) == 0;
+}
+
+int cli_batch(int argc, char** argv) {
+  batch_args_t args;
+  cli_input_options_t& input_options = args.input_options;
+  args.image.encode.boostEcl         = false;
+  bool format_chosen                 = false;
+  for (int i = 1; i < argc; ++i) {
+    int parsed = cli_parse_image_option(argc, argv, &i, &args.image);
+    if (parsed < 0) return 1;
+    if (parsed > 0) continue;
+    const char* arg = argv[i];
+    if (strcmp(arg, "--lines") == 0 || strcmp(arg, "--csv") == 0 || strcmp(arg, "--ndjson") == 0) {
+      input_options.format = arg[2] == 'l' ? CLI_INPUT_LINES : arg[2] == 'c' ? CLI_INPUT_CSV : CLI_INPUT_NDJSON;
+      format_chosen        = true;
+    } else if (strcmp(arg, "--tar") == 0 || strcmp(arg, "--zip") == 0) {
+      args.archive        = true;
+      args.archive_format = arg[2] == 't' ? CLI_ARCHIVE_TAR : CLI_ARCHIVE_ZIP;
+    } else if (strcmp(arg, "--header") == 0) {
+      input_options.header = true;
+    } else if (strcmp(arg, "--out") == 0 || strcmp(arg, "--column") == 0 || strcmp(arg, "--name-column") == 0 ||
+               strcmp(arg, "--field") == 0 || strcmp(arg, "--name-field") == 0 || strcmp(arg, "--threads") == 0) {
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << arg << '\n';
+        return 1;
+      }
+      const char* value = argv[++i];
+      if (strcmp(arg, "--out") == 0) {
+        args.out = value;
+      } else if (strcmp(arg, "--field") == 0) {
+        input_options.field = value;
+      } else if (strcmp(arg, "--name-field") == 0) {
+        input_options.name_field = value;
+      } else {
+        int* result = strcmp(arg, "--column") == 0        ? &input_options.column
+                      : strcmp(arg, "--name-column") == 0 ? &input_options.name_column
+                                                          : &args.threads;
+        if (!cli_parse_int(arg, value, 1, 1024, result)) return 1;
+      }
+    } else if (arg[0] != '-' && args.input == nullptr) {
+      args.input = arg;
+    } else {
+      std::cerr << "Unknown argument: " << arg << '\n';
+      return 1;
+    }
+  }
+  if (args.input == nullptr || args.out.empty()) {
+    std::cerr << "qrview batch needs a FILE and --out (see qrview batch --help)\n";
+    return 1;
+  }
+  if (args.image.encode.minVersion > args.image.encode.maxVersion) {
+    std::cerr << "--min-version is greater than --max-version\n";
+    return 1;
+  }
+  if (!format_chosen) {
+    input_options.format = batch_ends_with(args.input, ".csv")                                          ? CLI_INPUT_CSV
+                           : batch_ends_with(args.input, ".ndjson") || batch_ends_with(args.input, ".jsonl") ? CLI_INPUT_NDJSON
+                                                                                                        : CLI_INPUT_LINES;
+  }
+  if (!args.archive && (args.out == "-" || batch_ends_with(args.out.c_str(), ".tar"))) {
+    args.archive = true;
+  } else if (!args.archive && batch_ends_with(args.out.c_str(), ".zip")) {
+    args.archive        = true;
+    args.archive_format = CLI_ARCHIVE_ZIP;
+  }
+  if (args.threads == 0) args.threads = (int)std::thread::hardware_concurrency();
+  if (args.threads < 1) args.threads = 1;
+  args.too_long = "does not fit in version " + std::to_string(args.image.encode.maxVersion);
+
+  cli_input_t input;
+  if (!input.open(args.input)) return 1;
+  cli_archive_t archive;
+  if (args.archive && !archive.open(args.out.c_str(), args.archive_format)) return 1;
+  if (!args.archive && !batch_make_dir(args.out)) {
+    std::cerr << "Failed to create the directory " << args.out << '\n';
+    return 1;
+  }
+
+  // Compressing a PNG takes several times as long as encoding its QR code, so most threads compress
+  int num_encoders    = std::max(1, args.threads / 4);
+  int num_compressors = std::max(1, args.threads - num_encoders);
+  batch_queue_t<batch_unit_t> payloads((size_t)BATCH_QUEUE_UNITS * num_encoders);
+  batch_queue_t<batch_unit_t> codes((size_t)BATCH_QUEUE_UNITS * num_compressors);
+  batch_queue_t<batch_unit_t> pngs((size_t)BATCH_QUEUE_UNITS * num_compressors);
+  std::atomic<int> encoders_left(num_encoders);
+  std::atomic<int> compressors_left(num_compressors);
+
+  // The files are written in the order of the file, so the writer holds the units that overtake another
+  // one. The reader takes a place in the window for each unit and the writer gives it back, which bounds
+  // how many units are held, however slow one of them is.
+  batch_queue_t<char> window(payloads.capacity() + codes.capacity() + pngs.capacity() + (size_t)args.threads);
+  std::map<size_t, batch_unit_t> held;
+  size_t next_index = 0;
+
+  // The payloads point into the input, which the reader only splits into units
+  std::vector<std::thread> threads;
+  threads.emplace_back([&] {
+    batch_unit_t unit;
+    for (size_t index = 0; window.push(0) && input.read(input_options, BATCH_ITEMS, &unit.payloads); ++index) {
+      unit.index = index;
+      if (!payloads.push(std::move(unit))) break;
+      unit = batch_unit_t();
+    }
+    payloads.close();
+  });
+  for (int i = 0; i < num_encoders; ++i) {
+    threads.emplace_back([&] {
+      batch_encode(&payloads, &codes, args);
+      if (--encoders_left == 0) codes.close();
+    });
+  }
+  for (int i = 0; i < num_compressors; ++i) {
+    threads.emplace_back([&] {
+      batch_compress(&codes, &pngs, args);
+      if (--compressors_left == 0) pngs.close();
+    });
+  }
+
+  // Write the files on this thread, and report the progress every second
+  auto start       = std::chrono::steady_clock::now();
+  auto last_report = start;
+  size_t written = 0, failed = 0;
+  bool write_failed = false;
+  std::string name;
+  std::unordered_set<std::string> names;  // The names taken so far, if the rows have names rather than numbers
+  bool has_names = batch_has_names(args.input_options);
+  batch_unit_t unit;
+  char place;
+  while (!write_failed && pngs.pop(&unit)) {
+    size_t index = unit.index;
+    held[index]  = std::move(unit);
+    for (auto next = held.find(next_index); next != held.end() && !write_failed; next = held.find(++next_index)) {
+      batch_unit_t& ready = next->second;
+      for (size_t i = 0; i < ready.payloads.size(); ++i) {
+        cli_payload_t& payload = ready.payloads[i];
+        if (payload.error == nullptr && !batch_file_name(payload, args, &name)) payload.error = "has an invalid file name";
+        if (payload.error == nullptr && args.archive && name.size() > archive.name_max()) {
+          payload.error = "has a file name too long for the archive";
+        }
+        if (payload.error == nullptr && has_names && !names.insert(name).second) {
+          payload.error = "has the file name of an earlier row";  // Which it would overwrite or repeat
+        }
+        if (payload.error != nullptr) {
+          if (failed++ < BATCH_FAILURES) std::cerr << "Row " << payload.row << ' ' << payload.error << '\n';
+          continue;
+        }
+        size_t begin       = i == 0 ? 0 : ready.ends[i - 1];
+        size_t size        = ready.ends[i] - begin;
+        const uint8_t* png = ready.bytes.data() + begin;
+        bool ok;
+        if (args.archive) {
+          ok = archive.add(name, png, size);
+        } else {
+          FILE* file = fopen((args.out + "/" + name).c_str(), "wb");
+          ok         = file != nullptr && fwrite(png, 1, size, file) == size;
+          if (file != nullptr) ok = fclose(file) == 0 && ok;
+        }
+        if (!ok) {
+          std::cerr << "Failed to write " << (args.archive ? args.out : args.out + "/" + name) << '\n';
+          write_failed = true;
+          break;
+        }
+        ++written;
+      }
+      held.erase(next);
+      window.pop(&place);
+    }
+    if (write_failed) break;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_report >= std::chrono::seconds(1)) {
+      double seconds = std::chrono::duration<double>(now - start).count();
+      std::cerr << written << " written, " << (long)(written / seconds) << " codes/s\n";
+      last_report = now;
+    }
+  }
+  if (write_failed) {  // Stop the other stages, which then find their queues closed
+    window.close();
+    payloads.close();
+    codes.close();
+    pngs.close();
+  }
+  for (std::thread& thread : threads) thread.join();
+  if (args.archive && !write_failed && !archive.close()) {
+    std::cerr << "Failed to write " << args.out << '\n';
+    write_failed = true;
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cerr << "Wrote " << written << " QR codes to " << (args.out == "-" ? "standard output" : args.out) << " in " << seconds << " s ("
+            << (long)(written / (seconds > 0 ? seconds : 1)) << " codes/s)\n";
+  if (failed > 0) std::cerr << failed << " payloads failed\n";
+  return write_failed || failed > 0 ? 1 : 0;
+}
+
+// Encodes units of payloads with a BatchEncoder, which encodes the payloads of the same version together.
+// The payloads are copied out of the input only here, with their escapes replaced, to end them with NULs.
+static void batch_encode(batch_queue_t<batch_unit_t>* in, batch_queue_t<batch_unit_t>* out, const batch_args_t& args) {
+  qrcodegen::BatchEncoder encoder;
+  size_t buffer_len = qrcodegen_BUFFER_LEN_FOR_VERSION(args.image.encode.maxVersion);
+  std::string arena;
+  std::vector<size_t> offsets;
+  std::vector<const char*> texts;
+  std::vector<uint8_t*> qrcodes;
+  batch_unit_t unit;
+  while (in->pop(&unit)) {
+    std::vector<cli_payload_t>& payloads = unit.payloads;
+    unit.bytes.assign(payloads.size() * buffer_len, 0);
+    arena.clear();
+    offsets.clear();
+    qrcodes.clear();
+    for (size_t i = 0; i < payloads.size(); ++i) {
+      if (payloads[i].error != nullptr) continue;
+      offsets.push_back(arena.size());
+      cli_unescape(payloads[i].text, &arena);
+      arena.push_back('\0');
+      qrcodes.push_back(&unit.bytes[i * buffer_len]);
+    }
+    texts.clear();
+    for (size_t offset : offsets) texts.push_back(arena.data() + offset);
+    encoder.encode(texts.data(), texts.size(), qrcodes.data(), args.image.encode);
+    for (size_t i = 0; i < payloads.size(); ++i) {
+      if (payloads[i].error == nullptr && unit.bytes[i * buffer_len] == 0) payloads[i].error = args.too_long.c_str();
+    }
+    if (!out->push(std::move(unit))) return;
+  }
+}
+
+// Draws and compresses the QR codes of units into PNG files.
+static void batch_compress(batch_queue_t<batch_unit_t>* in, batch_queue_t<batch_unit_t>* out, const batch_args_t& args) {
+  size_t buffer_len = qrcodegen_BUFFER_LEN_FOR_VERSION(args.image.encode.maxVersion);
+  std::vector<uint8_t> pixels, png, bytes;
+  batch_unit_t unit;
+  while (in->pop(&unit)) {
+    bytes.clear();
+    unit.ends.clear();
+    for (size_t i = 0; i < unit.payloads.size(); ++i) {
+      cli_payload_t& payload = unit.payloads[i];
+      if (payload.error == nullptr) {
+        int image_size = cli_rasterize(&unit.bytes[i * buffer_len], args.image, &pixels);
+        if (cli_compress_png(pixels, image_size, &png)) {
+          bytes.insert(bytes.end(), png.begin(), png.end());
+        } else {
+          payload.error = "failed to compress";
+        }
+      }
+      unit.ends.push_back(bytes.size());
+    }
+    unit.bytes.swap(bytes);
+    if (!out->push(std::move(unit))) return;
+  }
+}
+
+// Returns whether the PNG files are named by a field of the rows, rather than by their row numbers.
+static bool batch_has_names(const cli_input_options_t& options) {
+  return options.format == CLI_INPUT_CSV ? options.name_column > 0
+         : options.format == CLI_INPUT_NDJSON ? !options.name_field.empty()
+                                              : false;
+}
+
+// Sets name to the name of the PNG file of the payload, which is its row unless the input has names.
+// Returns false if the name is empty or isn't a plain file name, such as "../x" or "a/b".
+static bool batch_file_name(const cli_payload_t& payload, const batch_args_t& args, std::string* name) {
+  if (!batch_has_names(args.input_options)) {
+    *name = std::to_string(payload.row) + ".png";
+    return true;
+  }
+  name->clear();
+  cli_unescape(payload.name, name);
+  if (name->empty() || *name == "." || *name == "..") return false;
+  for (char c : *name) {
+    if (c == '/' || c == '\\' || (unsigned char)c < 0x20) return false;
+  }
+  if (!batch_ends_with(name->c_str(), ".png")) *name += ".png";
+  return true;
+}
+
+// Creates the directory unless it already exists, and returns whether it exists now.
+static bool batch_make_dir(const std::string& dir) {
+  struct stat info;
+  if (stat(dir.c_str(), &info) == 0) return (info.st_mode & S_IFMT) == S_IFDIR;
+#ifdef _WIN32
+  return _mkdir(dir.c_str()) == 0;
+#else
+  return mkdir(dir.c_str(), 0777) == 0;
+#endif
+}
@@ -0,0 +1,378 @@
+#include "cli.h"
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+// The delimiter search uses SSE2 and __builtin_ctz, where the compiler has both
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__SSE2__)
+  #define INGEST_SSE2
+  #include <emmintrin.h>
+#endif
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+cli_input_t::~cli_input_t() {
+#ifdef _WIN32
+  if (mapping != nullptr) {
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mapping);
+  }
+#else
+  if (mapped) munmap((void*)data, size);
+#endif
+}
+
+bool cli_input_t::open(const char* path) {
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file != INVALID_HANDLE_VALUE) {
+    LARGE_INTEGER file_size;
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+      mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (mapping != nullptr) {
+        data = (const char*)MapViewOfFile((HANDLE)mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr) {
+          CloseHandle((HANDLE)mapping);
+          mapping = nullptr;
+        }
+      }
+    }
+    CloseHandle(file);
+    if (mapping != nullptr) {
+      size = (size_t)file_size.QuadPart;
+      return true;
+    }
+  }
+#else
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) {
+    std::cerr << "Failed to open " << path << '\n';
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view != MAP_FAILED) {
+      madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+      data   = (const char*)view;
+      size   = (size_t)info.st_size;
+      mapped = true;
+    }
+  }
+  if (mapped) {
+    ::close(fd);
+    return true;
+  }
+
+  // Read what can't be mapped, such as a pipe or an empty file
+  char buffer[65536];
+  ssize_t len;
+  while ((len = ::read(fd, buffer, sizeof(buffer))) > 0) contents.insert(contents.end(), buffer, buffer + len);
+  bool ok = len == 0;
+  ::close(fd);
+#endif
+#ifdef _WIN32
+  // Read what can't be mapped, such as a pipe or an empty file
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    std::cerr << "Failed to open " << path << '\n';
+    return false;
+  }
+  char buffer[65536];
+  size_t len;
+  while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) contents.insert(contents.end(), buffer, buffer + len);
+  bool ok = ferror(file) == 0;
+  fclose(file);
+#endif
+  if (!ok) {
+    std::cerr << "Failed to read " << path << '\n';
+    return false;
+  }
+  data = contents.data();
+  size = contents.size();
+  return true;
+}
+
+// Returns the first of the bytes a and b in [p, end), or end.
+static const char* ingest_find(const char* p, const char* end, char a, char b) {
+#ifdef INGEST_SSE2
+  __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    int mask  = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+    if (mask != 0) return p + __builtin_ctz((unsigned)mask);
+  }
+#endif
+  while (p < end && *p != a && *p != b) ++p;
+  return p;
+}
+
+// Returns the first newline in [p, end), or end.
+static const char* ingest_find_newline(const char* p, const char* end) {
+  const char* newline = (const char*)memchr(p, '\n', (size_t)(end - p));
+  return newline != nullptr ? newline : end;
+}
+
+static bool ingest_is_space(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Reads the CSV row at p into payload, and returns where the next row starts. A field in double quotes
+// can hold commas, newlines and doubled double quotes, and anything between its closing quote and the
+// next comma is ignored.
+static const char* ingest_csv_row(const char* p, const char* end, const cli_input_options_t& options,
+                                  cli_payload_t* payload) {
+  bool has_text = false;
+  for (int column = 1;; ++column) {
+    cli_field_t field;
+    if (p < end && *p == '"') {
+      field.data = ++p;
+      for (;;) {
+        const char* quote = (const char*)memchr(p, '"', (size_t)(end - p));
+        if (quote == nullptr) {  // Unterminated, so it runs to the end of the file
+          field.size = (size_t)(end - field.data);
+          p          = end;
+          break;
+        }
+        if (quote + 1 < end && quote[1] == '"') {
+          field.escaped = '"';
+          p             = quote + 2;
+          continue;
+        }
+        field.size = (size_t)(quote - field.data);
+        p          = quote + 1;
+        break;
+      }
+      p = ingest_find(p, end, ',', '\n');
+    } else {
+      field.data = p;
+      p          = ingest_find(p, end, ',', '\n');
+      field.size = (size_t)(p - field.data);
+      if (field.size > 0 && field.data[field.size - 1] == '\r' && (p == end || *p == '\n')) --field.size;
+    }
+    if (column == options.column) {
+      payload->text = field;
+      has_text      = true;
+    }
+    if (column == options.name_column) payload->name = field;
+    if (p == end || *p == '\n') break;
+    ++p;  // The comma
+  }
+  if (!has_text) payload->error = "has too few columns";
+  return p == end ? end : p + 1;
+}
+
+// Returns the end of the JSON string whose opening quote is before p, at its closing quote or end, and
+// sets *escaped if it has backslash escapes.
+static const char* ingest_json_string(const char* p, const char* end, bool* escaped) {
+  for (;;) {
+    p = ingest_find(p, end, '"', '\\');
+    if (p == end || *p == '"') return p;
+    *escaped = true;
+    p        = p + 2 < end ? p + 2 : end;
+  }
+}
+
+// Returns the end of the JSON value at p, which isn't a string: a number, true, false, null, or an object
+// or array, whose strings may hold brackets.
+static const char* ingest_json_value(const char* p, const char* end) {
+  int depth = 0;
+  for (; p < end; ++p) {
+    char c = *p;
+    if (c == '"') {
+      bool escaped;
+      p = ingest_json_string(p + 1, end, &escaped);
+      if (p == end) return end;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) return p;
+      if (--depth == 0) return p + 1;
+    } else if (depth == 0 && (c == ',' || ingest_is_space(c))) {
+      return p;
+    }
+  }
+  return end;
+}
+
+// Reads the fields of the JSON object in [p, end) into payload. Strings, and the text of other values
+// such as numbers, can be payloads and names.
+static void ingest_json_row(const char* p, const char* end, const cli_input_options_t& options, cli_payload_t* payload) {
+  const char* not_object = "is not a JSON object";
+  while (p < end && ingest_is_space(*p)) ++p;
+  if (p == end || *p != '{') {
+    payload->error = not_object;
+    return;
+  }
+  ++p;
+  bool has_text = false;
+  for (;;) {
+    while (p < end && ingest_is_space(*p)) ++p;
+    if (p < end && *p == '}') break;
+    if (p == end || *p != '"') {
+      payload->error = not_object;
+      return;
+    }
+    bool escaped    = false;
+    const char* key = ++p;
+    p               = ingest_json_string(p, end, &escaped);
+    size_t key_size = (size_t)(p - key);
+    if (p < end) ++p;
+    while (p < end && ingest_is_space(*p)) ++p;
+    if (p == end || *p != ':') {
+      payload->error = not_object;
+      return;
+    }
+    ++p;
+    while (p < end && ingest_is_space(*p)) ++p;
+
+    cli_field_t value;
+    if (p < end && *p == '"') {
+      escaped    = false;
+      value.data = ++p;
+      p          = ingest_json_string(p, end, &escaped);
+      value.size = (size_t)(p - value.data);
+      if (escaped) value.escaped = '\\';
+      if (p < end) ++p;
+    } else {
+      value.data = p;
+      p          = ingest_json_value(p, end);
+      value.size = (size_t)(p - value.data);
+    }
+    if (key_size == options.field.size() && memcmp(key, options.field.data(), key_size) == 0) {
+      payload->text = value;
+      has_text      = true;
+    } else if (key_size == options.name_field.size() && memcmp(key, options.name_field.data(), key_size) == 0) {
+      payload->name = value;
+    }
+
+    while (p < end && ingest_is_space(*p)) ++p;
+    if (p < end && *p == ',') {
+      ++p;
+    } else if (p == end || *p != '}') {
+      payload->error = not_object;
+      return;
+    }
+  }
+  if (!has_text) payload->error = "has no payload field";
+}
+
+bool cli_input_t::read(const cli_input_options_t& options, size_t max, std::vector<cli_payload_t>* payloads) {
+  payloads->clear();
+  const char* end = data + size;
+  while (pos < size && payloads->size() < max) {
+    const char* p = data + pos;
+    ++row;
+    bool blank = *p == '\n' || (*p == '\r' && p + 1 < end && p[1] == '\n');
+    cli_payload_t payload;
+    payload.row = row;
+    const char* next;
+    if (options.format == CLI_INPUT_CSV) {
+      next = ingest_csv_row(p, end, options, &payload);
+    } else {
+      const char* newline = ingest_find_newline(p, end);
+      next                = newline == end ? end : newline + 1;
+      if (newline > p && newline[-1] == '\r') --newline;
+      if (options.format == CLI_INPUT_NDJSON) {
+        const char* q = p;
+        while (q < newline && ingest_is_space(*q)) ++q;
+        blank = q == newline;
+        if (!blank) ingest_json_row(p, newline, options, &payload);
+      } else {
+        payload.text.data = p;
+        payload.text.size = (size_t)(newline - p);
+      }
+    }
+    pos = (size_t)(next - data);
+    if (!blank && !(row == 1 && options.header)) payloads->push_back(payload);
+  }
+  return !payloads->empty();
+}
+
+// Appends the UTF-8 encoding of the code point to text.
+static void ingest_append_utf8(uint32_t code_point, std::string* text) {
+  if (code_point < 0x80) {
+    text->push_back((char)code_point);
+  } else if (code_point < 0x800) {
+    text->push_back((char)(0xC0 | code_point >> 6));
+    text->push_back((char)(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    text->push_back((char)(0xE0 | code_point >> 12));
+    text->push_back((char)(0x80 | (code_point >> 6 & 0x3F)));
+    text->push_back((char)(0x80 | (code_point & 0x3F)));
+  } else {
+    text->push_back((char)(0xF0 | code_point >> 18));
+    text->push_back((char)(0x80 | (code_point >> 12 & 0x3F)));
+    text->push_back((char)(0x80 | (code_point >> 6 & 0x3F)));
+    text->push_back((char)(0x80 | (code_point & 0x3F)));
+  }
+}
+
+// Parses the 4 hex digits at p, or returns -1.
+static long ingest_hex4(const char* p, const char* end) {
+  if (end - p < 4) return -1;
+  long value = 0;
+  for (int i = 0; i < 4; ++i) {
+    char c = p[i];
+    int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    if (digit < 0) return -1;
+    value = value * 16 + digit;
+  }
+  return value;
+}
+
+void cli_unescape(const cli_field_t& field, std::string* text) {
+  const char* p   = field.data;
+  const char* end = field.data + field.size;
+  if (field.escaped == 0) {
+    text->append(p, end);
+    return;
+  }
+  while (p < end) {
+    const char* escape = (const char*)memchr(p, field.escaped, (size_t)(end - p));
+    if (escape == nullptr || escape + 1 == end) {
+      text->append(p, end);
+      return;
+    }
+    text->append(p, escape);
+    p = escape + 2;
+    if (field.escaped == '"') {  // A doubled double quote
+      text->push_back('"');
+      continue;
+    }
+    switch (escape[1]) {
+      case 'b': text->push_back('\b'); break;
+      case 'f': text->push_back('\f'); break;
+      case 'n': text->push_back('\n'); break;
+      case 'r': text->push_back('\r'); break;
+      case 't': text->push_back('\t'); break;
+      case 'u': {
+        long code_point = ingest_hex4(p, end);
+        if (code_point < 0) {  // Keep what isn't an escape as it is
+          text->append(escape, p);
+          break;
+        }
+        p += 4;
+        long low = code_point >= 0xD800 && code_point < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u'
+                       ? ingest_hex4(p + 2, end)
+                       : -1;
+        if (low >= 0xDC00 && low < 0xE000) {  // A surrogate pair
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+          p += 6;
+        }
+        ingest_append_utf8((uint32_t)code_point, text);
+        break;
+      }
+      default: text->push_back(escape[1]); break;  // \" \\ \/
+    }
+  }
+}
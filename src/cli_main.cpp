@@ -0,0 +1,6 @@
+#include "cli.h"
+
+// The entry point of qrview_cli, which only has the headless commands of qrview and links without SDL or ImGui.
+int main(int argc, char** argv) {
+  return cli_main(argc, argv);
+}
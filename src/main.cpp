@@ -1,9 +1,8 @@
 #include "SDL3/SDL.h"
 #include "imgui_impl_sdl3.h"
 #include "imgui_impl_sdlrenderer3.h"
+#include "cli.h"
 #include "qrcodegen.h"
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
 #ifdef __EMSCRIPTEN__
@@ -43,6 +42,13 @@ struct app_t {
   int qr_mask        = -1;
   int qr_ecc         = 0;
   bool qr_boost_ecc  = false;
+  bool qr_optimal    = true;
+  int qr_used_mask   = -1;
+  int qr_needed_ver  = 0;  // The version of the QR code, or the smallest that would fit the text, or 0 if none does
+  long qr_penalties[8];
+  qrcodegen_Segment qr_segs[QR_TEXT_LIMIT];
+  uint8_t qr_seg_buffer[qrcodegen_BUFFER_LEN_MAX];
+  qrcodegen::IncrementalEncoder qr_encoder;
 
   // layout params
   SDL_FRect imgui_rect;
@@ -102,6 +108,9 @@ void app_imgui_render() {
     if (ImGui::Checkbox("Boost ECC", &app.qr_boost_ecc)) {
       recompute = true;
     }
+    if (ImGui::Checkbox("Optimal Segments", &app.qr_optimal)) {
+      recompute = true;
+    }
 
     if (ImGui::InputInt("Version Min", &app.qr_min_ver, 1, 1)) {
       recompute = true;
@@ -120,12 +129,31 @@ void app_imgui_render() {
     if (app.qr_max_ver < 1) app.qr_max_ver = 1;
     if (app.qr_max_ver > 40) app.qr_max_ver = 40;
 
+    int needed_ver = app.qr_needed_ver;
+    if (needed_ver == 0) {
+      ImGui::TextColored({1.0f, 0.4f, 0.4f, 1.0f}, "Input is too long for any version");
+    } else if (needed_ver > app.qr_max_ver) {
+      ImGui::TextColored({1.0f, 0.4f, 0.4f, 1.0f}, "Input needs version %d", needed_ver);
+    } else {
+      ImGui::Text("Version: %d", needed_ver);
+    }
+
     if (ImGui::InputInt("Mask", &app.qr_mask, 1, 1)) {
       recompute = true;
       if (app.qr_mask < -1) app.qr_mask = -1;
       if (app.qr_mask > 7) app.qr_mask = 7;
     }
 
+    if (app.qr_used_mask >= 0 && ImGui::TreeNode("Mask Penalties")) {
+      for (int i = 0; i < 8; ++i) {
+        if (i == app.qr_used_mask)
+          ImGui::TextColored({0.4f, 1.0f, 0.4f, 1.0f}, "Mask %d: %ld", i, app.qr_penalties[i]);
+        else
+          ImGui::Text("Mask %d: %ld", i, app.qr_penalties[i]);
+      }
+      ImGui::TreePop();
+    }
+
     ImGui::NewLine();
 
     if (ImGui::ColorPicker4("Color 1", app.qr_color1, ImGuiColorEditFlags_AlphaBar)) {
@@ -267,6 +295,10 @@ void app_loop(void* data) {
 }
 
 int main(int argc, char** argv) {
+  if (cli_is_command(argc, argv)) {
+    return cli_main(argc, argv);
+  }
+
   if (!app_init()) {
     std::cerr << "App failed to initialized\n";
     return 1;
@@ -320,16 +352,34 @@ void recompute_layout() {
 }
 
 bool recompute_qr() {
-  uint8_t qr0[qrcodegen_BUFFER_LEN_MAX];
-  uint8_t tempBuffer[qrcodegen_BUFFER_LEN_MAX];
-  bool ok = qrcodegen_encodeText(app.qr_text, tempBuffer, qr0, (qrcodegen_Ecc)app.qr_ecc, app.qr_min_ver, app.qr_max_ver, (qrcodegen_Mask)app.qr_mask, app.qr_boost_ecc);
-
-  if (!ok) {
+  qrcodegen::EncodeOptions options;
+  options.ecl             = (qrcodegen_Ecc)app.qr_ecc;
+  options.minVersion      = app.qr_min_ver;
+  options.maxVersion      = app.qr_max_ver;
+  options.mask            = app.qr_mask == -1 ? qrcodegen_Mask_AUTO : (qrcodegen_Mask)app.qr_mask;
+  options.boostEcl        = app.qr_boost_ecc;
+  options.optimalSegments = app.qr_optimal;
+
+  // The version of the QR code is the one to show, and only when the text does not fit is it segmented
+  // again, to find the version that it would need
+  qrcodegen::QrCodeView qr = app.qr_encoder.encode(app.qr_text, options);
+  if (!qr) {
+    qrcodegen_Ecc ecl = (qrcodegen_Ecc)app.qr_ecc;
+    if (app.qr_optimal) {
+      int num_segs      = qrcodegen_makeSegmentsOptimally(app.qr_text, ecl, app.qr_min_ver, 40, app.qr_segs, QR_TEXT_LIMIT, app.qr_seg_buffer);
+      app.qr_needed_ver = num_segs < 0 ? 0 : qrcodegen_getMinVersion(app.qr_segs, num_segs, ecl, app.qr_min_ver, 40);
+    } else {
+      app.qr_needed_ver = qrcodegen_getMinVersionForText(app.qr_text, ecl, app.qr_min_ver, 40);
+    }
     std::cerr << "Failed to encode QR code" << '\n';
     return false;
   }
+  app.qr_needed_ver = qr.version();
+
+  app.qr_used_mask = qr.getMaskPenalties(app.qr_penalties);
 
-  app.qr_surface = std::shared_ptr<SDL_Surface>(SDL_CreateSurface(qrcodegen_getSize(qr0), qrcodegen_getSize(qr0), SDL_PIXELFORMAT_ABGR8888), SDL_DestroySurface);
+  int qr_size    = qr.size();
+  app.qr_surface = std::shared_ptr<SDL_Surface>(SDL_CreateSurface(qr_size, qr_size, SDL_PIXELFORMAT_ABGR8888), SDL_DestroySurface);
   if (app.qr_surface == nullptr) {
     std::cerr << "QR surface could not be created! SDL_Error: " << SDL_GetError() << '\n';
     return false;
@@ -345,11 +395,10 @@ bool recompute_qr() {
   Uint32 rgba1 = convert_rgb(app.qr_color1);
   Uint32 rgba2 = convert_rgb(app.qr_color2);
 
-  for (int y = 0; y < qrcodegen_getSize(qr0); ++y) {
-    for (int x = 0; x < qrcodegen_getSize(qr0); ++x) {
-      Uint32 color                             = qrcodegen_getModule(qr0, x, y) ? rgba1 : rgba2;
-      Uint32* pixels                           = (Uint32*)app.qr_surface.get()->pixels;
-      pixels[(y * qrcodegen_getSize(qr0)) + x] = color;
+  Uint32* pixels = (Uint32*)app.qr_surface.get()->pixels;
+  for (int y = 0; y < qr_size; ++y) {
+    for (int x = 0; x < qr_size; ++x) {
+      pixels[(y * qr_size) + x] = qr.getModule(x, y) ? rgba1 : rgba2;
     }
   }
 
@@ -26,6 +26,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include "qrcodegen.h"
+#include "qrcodegen_constexpr.h"
+
+// Threads are only used for qrcodegen_Mask_AUTO_PARALLEL, and are unavailable in
+// single-threaded Emscripten builds, where that mode scores the masks serially.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__) && !defined(QRCODEGEN_NO_THREADS)
+	#define QRCODEGEN_NO_THREADS
+#endif
+#ifndef QRCODEGEN_NO_THREADS
+	#include <thread>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <vector>
 
 #ifndef QRCODEGEN_TEST
 	#define testable static  // Keep functions private
@@ -33,16 +48,102 @@
 	#define testable  // Expose private functions
 #endif
 
+// Vector kernels are compiled with per-function target attributes and selected at run time,
+// so the rest of the library keeps the baseline instruction set of the build. Defining
+// QRCODEGEN_NO_X86_DISPATCH leaves only the portable code, which the tests use to check it.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(QRCODEGEN_NO_X86_DISPATCH)
+	#define QRCODEGEN_X86_DISPATCH
+	#include <immintrin.h>
+#endif
+
+
+/*---- Private types ----*/
+
+// The number of 64-bit words in each row of a BitGrid, enough for the largest size of 177 modules.
+#define GRID_ROW_WORDS 3
+
+// A QR Code grid in which every row is padded to whole 64-bit words, so that loops
+// can work on a word of modules at a time instead of one bit of a packed bitstream.
+// Bit (x % 64) of rows[y][x / 64] is the module at (x, y), set for dark. The bits past
+// the right edge of each row are always zero. The rows past the bottom edge are never
+// read, so they are not cleared, and a grid can be reused for a QR Code of another size.
+// Convert to and from the public qrcode[] format with gridFromQrcode() and gridToQrcode().
+struct BitGrid {
+	int size;
+	uint64_t rows[qrcodegen_VERSION_MAX * 4 + 17][GRID_ROW_WORDS];
+};
+
+// The grids of one encoding. The C functions keep one on the stack for each call, while
+// a qrcodegen::Encoder keeps its own between calls, so the function modules of the
+// previous version are still loaded if the next QR Code has the same version.
+struct EncoderState {
+	struct BitGrid grid;             // The QR Code, complete when encodeSegmentsCore() succeeds
+	struct BitGrid functionModules;  // The function module map of templateVersion
+	int templateVersion;             // 0 if functionModules holds no version yet
+	enum qrcodegen_Ecc ecl;          // The error correction level and mask that the QR Code uses
+	enum qrcodegen_Mask mask;
+};
+
+// The penalty scores of every line of an unmasked grid under each mask, kept between the encodings of an
+// incremental encoder so that getMaskPenaltyScores() only rescores the rows and columns marked dirty.
+// Every line that changed since the scores were stored must be marked, and all of them after a change
+// of size or error correction level. Scoring clears none of the marks; maskQrCode() clears them all.
+struct LinePenalties {
+	uint8_t dirtyRows[qrcodegen_VERSION_MAX * 4 + 17];
+	uint8_t dirtyColumns[qrcodegen_VERSION_MAX * 4 + 17];
+	long rows[8][qrcodegen_VERSION_MAX * 4 + 17];     // Runs and finder-like patterns
+	long blocks[8][qrcodegen_VERSION_MAX * 4 + 17];   // 2*2 blocks in each row and the one above it
+	long columns[8][qrcodegen_VERSION_MAX * 4 + 17];
+	int dark[8][qrcodegen_VERSION_MAX * 4 + 17];
+};
+
+// The grid functions that are instantiated for each number of words in a row. See GRID_KERNELS.
+struct GridKernels {
+	void (*drawCodewords)(const uint8_t data[], int dataLen, const struct BitGrid *functionModules, struct BitGrid *grid);
+	void (*applyMask)(const struct BitGrid *functionModules, struct BitGrid *grid, enum qrcodegen_Mask mask);
+	void (*getMaskPenaltyScores)(const struct BitGrid *grid, const struct BitGrid *functionModules,
+		enum qrcodegen_Ecc ecl, int firstMask, int endMask, bool estimate, struct LinePenalties *cache, long result[8]);
+};
+
+// Appends bits to a big-endian bit buffer like appendBitsToBuffer(), but a whole value or run of bytes
+// at a time. The bits of the partial last byte are also kept in a 64-bit accumulator, so that runs of
+// bytes are merged in words. Every byte is stored rather than ORed, so the buffer needs no clearing.
+struct BitWriter {
+	uint8_t *buffer;
+	int bitLen;      // Number of bits written so far; buffer[0 : ceil(bitLen / 8)] is always up to date
+	uint64_t accum;  // Its low (bitLen % 8) bits are the bits of the partial last byte
+};
+
+// The number of data bits (excluding ECC, but including padding) that each version can hold at
+// each error correction level, indexed [ecl][version]. It increases with the version.
+struct DataCapacities {
+	int bits[4][qrcodegen_VERSION_MAX + 1];
+};
+
+// The total number of rows of the function templates of all 40 versions.
+#define FUNCTION_TEMPLATE_ROWS 3960
+
+// Everything that every QR Code of a version has in common, namely its function modules, precomputed for
+// all versions so that the encoder copies it instead of drawing it. The rows of each version are stored
+// like those of a BitGrid, and version v starts at row getFunctionTemplateOffset(v).
+struct FunctionTemplates {
+	uint64_t modules[FUNCTION_TEMPLATE_ROWS][GRID_ROW_WORDS];   // Set at every function module
+	uint64_t patterns[FUNCTION_TEMPLATE_ROWS][GRID_ROW_WORDS];  // Set at the dark ones, but the format bits are light
+};
+
+
 
 /*---- Forward declarations for private functions ----*/
 
-// Regarding all public and private functions defined in this source file:
+// Regarding the C functions and the private functions defined in this source file, except for the
+// exceptions listed in the resource use section at the top of qrcodegen.h:
 // - They require all pointer/array arguments to be not null unless the array length is zero.
 // - They only read input scalar/array arguments, write to output pointer/array
 //   arguments, and return scalar values; they are "pure" functions.
 // - They don't read mutable global variables or write to any global variables.
 // - They don't perform I/O, read the clock, print to console, etc.
-// - They allocate a small and constant amount of stack memory.
+// - They allocate a constant amount of stack memory, which is up to a few KB for the
+//   functions that hold BitGrids, and about 24 KB in all for an encoding call.
 // - They don't allocate or free any memory on the heap.
 // - They don't recurse or mutually recurse. All the code
 //   could be inlined into the top-level public functions.
@@ -51,79 +152,212 @@
 //   There are no unbounded loops or non-obvious termination conditions.
 // - They are completely thread-safe if the caller does not give the
 //   same writable buffer to concurrent calls to these functions.
-
+// The C++ classes in the qrcodegen namespace allocate their scratch space on the heap, and
+// encodeBatch() starts threads; their documentation in qrcodegen.h says what else they do.
+
+static bool makeTextSegment(const char *text, uint8_t buf[], size_t bufLen, bool copyBytes,
+	struct qrcodegen_Segment *seg, size_t *numSegs);
+static bool encodeSegmentsCore(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, long budgetMicros,
+	uint8_t dataBuffer[], uint8_t codewords[], struct EncoderState *state);
+static int makeDataCodewords(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc *ecl,
+	int minVersion, int maxVersion, bool boostEcl, uint8_t dataBuffer[]);
+static void drawQrCode(uint8_t dataBuffer[], int version, enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask,
+	const std::chrono::steady_clock::time_point *deadline, uint8_t codewords[], struct EncoderState *state);
+static void maskQrCode(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask,
+	const std::chrono::steady_clock::time_point *deadline, struct LinePenalties *cache, struct EncoderState *state);
 testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[], int *bitLen);
+static void bitWriterAppend(struct BitWriter *writer, uint64_t val, int numBits);
+static void bitWriterAppendBits(struct BitWriter *writer, const uint8_t data[], int numBits);
 
 testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ecc ecl, uint8_t result[]);
-testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
-testable int getNumRawDataModules(int ver);
+testable constexpr int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl);
+testable constexpr int getNumRawDataModules(int ver);
+static int getDataCapacityBits(int version, enum qrcodegen_Ecc ecl);
 
 testable void reedSolomonComputeDivisor(int degree, uint8_t result[]);
 testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
 	const uint8_t generator[], int degree, uint8_t result[]);
-testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y);
-
-testable void initializeFunctionModules(int version, uint8_t qrcode[]);
-static void drawLightFunctionModules(uint8_t qrcode[], int version);
-static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]);
-testable int getAlignmentPatternPositions(int version, uint8_t result[7]);
-static void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]);
-
-static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]);
-static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask);
-static long getPenaltyScore(const uint8_t qrcode[]);
-static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize);
-static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize);
-static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7], int qrsize);
+testable bool reedSolomonComputeInterleavedRemainders(const uint8_t data[], int numBlocks, int numShortBlocks,
+	int shortBlockDataLen, const uint8_t generator[], int degree, uint8_t result[]);
+testable constexpr uint8_t reedSolomonMultiply(uint8_t x, uint8_t y);
+
+static void getFunctionTemplate(int version, struct BitGrid *functionModules, struct BitGrid *patterns);
+static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, struct BitGrid *grid);
+static int getFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask);
+static void getFormatBitPosition(int i, int copy, int qrsize, int *x, int *y);
+testable constexpr int getAlignmentPatternPositions(int version, uint8_t result[7]);
+
+static const struct GridKernels *getGridKernels(int qrsize);
+static void drawCodewords(const uint8_t data[], int dataLen, const struct BitGrid *functionModules, struct BitGrid *grid);
+template <int Words> static void drawCodewordsSized(const uint8_t data[], int dataLen,
+	const struct BitGrid *functionModules, struct BitGrid *grid);
+static uint64_t readDataBits(const uint8_t data[], int dataLen, int start, int count);
+static int listCodewordModules(const struct BitGrid *functionModules, int result[]);
+template <int Words> static void getRowEdgeMask(int qrsize, uint64_t edge[Words]);
+template <int Words> static void depositBits(uint64_t line[Words], int p, uint64_t bits);
+static uint64_t gatherEvenBits(uint64_t x);
+template <int Words> static int findNextSetBit(const uint64_t line[Words], int from, int qrsize);
+template <int Words> static void reverseLine(uint64_t line[Words], int qrsize);
+static void applyMask(const struct BitGrid *functionModules, struct BitGrid *grid, enum qrcodegen_Mask mask);
+template <int Words> static void applyMaskSized(const struct BitGrid *functionModules,
+	struct BitGrid *grid, enum qrcodegen_Mask mask);
+static void getMaskPenaltyScores(const struct BitGrid *grid, const struct BitGrid *functionModules,
+	enum qrcodegen_Ecc ecl, int firstMask, int endMask, bool estimate, struct LinePenalties *cache, long result[8]);
+template <int Words> static void getMaskPenaltyScoresSized(const struct BitGrid *grid, const struct BitGrid *functionModules,
+	enum qrcodegen_Ecc ecl, int firstMask, int endMask, bool estimate, struct LinePenalties *cache, long result[8]);
+static void getMaskPenaltyScoresParallel(const struct BitGrid *grid, const struct BitGrid *functionModules,
+	enum qrcodegen_Ecc ecl, struct LinePenalties *cache, long result[8]);
+static enum qrcodegen_Mask chooseMaskByDeadline(const struct BitGrid *grid, const struct BitGrid *functionModules,
+	enum qrcodegen_Ecc ecl, std::chrono::steady_clock::time_point deadline);
+template <int Words> static long getLinePenaltyScore(const uint64_t line[Words], int qrsize);
+template <int Words> static long getRunPenaltyScore(const uint64_t line[Words], int qrsize);
+static int countSmallFinderPatterns(uint64_t line);
+template <int Words> static long getBlockPenaltyScore(const uint64_t top[Words], const uint64_t bottom[Words], int qrsize);
+static long getBalancePenaltyScore(int dark, int qrsize);
 
 testable bool getModuleBounded(const uint8_t qrcode[], int x, int y);
-testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isDark);
-testable void setModuleUnbounded(uint8_t qrcode[], int x, int y, bool isDark);
 static bool getBit(int x, int i);
 
+testable void gridFromQrcode(const uint8_t qrcode[], struct BitGrid *grid);
+testable void gridToQrcode(const struct BitGrid *grid, uint8_t qrcode[]);
+static void gridSetModule(struct BitGrid *grid, int x, int y, bool isDark);
+testable void gridTranspose(const struct BitGrid *grid, struct BitGrid *result);
+static void transposeBlock64(uint64_t block[64]);
+static int popcount64(uint64_t x);
+static uint64_t reverseBits64(uint64_t x);
+static int countTrailingZeros64(uint64_t x);
+
 testable int calcSegmentBitLength(enum qrcodegen_Mode mode, size_t numChars);
 testable int getTotalBits(const struct qrcodegen_Segment segs[], size_t len, int version);
 static int numCharCountBits(enum qrcodegen_Mode mode, int version);
+static int packNumeric(const char *digits, size_t len, uint8_t buf[]);
+static int packAlphanumeric(const char *text, size_t len, uint8_t buf[]);
+static int packKanji(const char *text, size_t numChars, uint8_t buf[]);
+static int decodeTextChar(const char *text, int *kanjiValue);
+static int getKanjiValue(long codePoint);
+static int computeCharacterModes(const char *text, int version, int maxBits, uint8_t choices[], int *numChars);
 
 
 
 /*---- Private tables of constants ----*/
 
-// The set of all legal characters in alphanumeric mode, where each character
-// value maps to the index in the string. For checking text and encoding segments.
-static const char *ALPHANUMERIC_CHARSET = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+// The index of every byte value in the alphanumeric charset, or -1 if it is not in the set.
+// Shared with the compile-time encoder, see qrcodegen_constexpr.h.
+using qrcodegen::constexpr_detail::ALPHANUMERIC_VALUES;
+
+// The Unicode to kanji mode mapping, in KANJI_CODE_POINTS and KANJI_VALUES.
+#include "qrcodegen_kanji.inc"
+
+// The modes that qrcodegen_makeSegmentsOptimally() chooses from, indexed like the states of its search.
+static const enum qrcodegen_Mode SEGMENT_MODES[4] = {
+	qrcodegen_Mode_NUMERIC, qrcodegen_Mode_ALPHANUMERIC, qrcodegen_Mode_BYTE, qrcodegen_Mode_KANJI,
+};
+
+// The most characters that any QR Code can hold, namely digits in version 40-L.
+// Bounds the per-character state of qrcodegen_makeSegmentsOptimally().
+#define OPTIMAL_SEGMENTS_CHARS_MAX 7089
+
+// The most segments that any QR Code can hold. A segment takes at least 22 bits in versions 27 to 40
+// (the mode, a 12-bit count and a kanji character), and version 40-L has 23648 data bits.
+#define ENCODER_SEGMENTS_MAX 1074
 
 // Sentinel value for use in only some functions.
 #define LENGTH_OVERFLOW -1
 
-// For generating error correction codes.
-testable const int8_t ECC_CODEWORDS_PER_BLOCK[4][41] = {
-	// Version: (note that index 0 is for padding, and is set to an illegal value)
-	//0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40    Error correction level
-	{-1,  7, 10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26, 30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},  // Low
-	{-1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22, 24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},  // Medium
-	{-1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24, 20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},  // Quartile
-	{-1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22, 24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},  // High
-};
+// For generating error correction codes. Shared with the compile-time encoder, see qrcodegen_constexpr.h.
+using qrcodegen::constexpr_detail::ECC_CODEWORDS_PER_BLOCK;
+using qrcodegen::constexpr_detail::NUM_ERROR_CORRECTION_BLOCKS;
 
-#define qrcodegen_REED_SOLOMON_DEGREE_MAX 30  // Based on the table above
+#define qrcodegen_REED_SOLOMON_DEGREE_MAX 30  // Based on ECC_CODEWORDS_PER_BLOCK
+#define qrcodegen_REED_SOLOMON_BLOCKS_MAX 81  // Based on NUM_ERROR_CORRECTION_BLOCKS
 
-// For generating error correction codes.
-testable const int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41] = {
-	// Version: (note that index 0 is for padding, and is set to an illegal value)
-	//0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40    Error correction level
-	{-1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 4,  4,  4,  4,  4,  6,  6,  6,  6,  7,  8,  8,  9,  9, 10, 12, 12, 12, 13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},  // Low
-	{-1, 1, 1, 1, 2, 2, 4, 4, 4, 5, 5,  5,  8,  9,  9, 10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},  // Medium
-	{-1, 1, 1, 2, 2, 4, 4, 6, 6, 8, 8,  8, 10, 12, 16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34, 35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},  // Quartile
-	{-1, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8, 11, 11, 16, 16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},  // High
+// Powers of the generator element 0x02 and their discrete logarithms in the field GF(2^8/0x11D).
+// exp[] holds two periods so that exp[log[x] + log[y]] needs no modulo reduction.
+struct GaloisTables {
+	uint8_t exp[255 * 2];
+	uint8_t log[256];  // log[0] is unused
 };
 
+static constexpr struct GaloisTables makeGaloisTables() {
+	struct GaloisTables result = {};
+	int x = 1;
+	for (int i = 0; i < 255; i++) {
+		result.exp[i] = result.exp[i + 255] = (uint8_t)x;
+		result.log[x] = (uint8_t)i;
+		x = (x << 1) ^ ((x >> 7) * 0x11D);
+	}
+	return result;
+}
+
+static constexpr struct GaloisTables GF = makeGaloisTables();
+
 // For automatic mask pattern selection.
 static const int PENALTY_N1 =  3;
 static const int PENALTY_N2 =  3;
 static const int PENALTY_N3 = 40;
 static const int PENALTY_N4 = 10;
 
+// The smallest version at which qrcodegen_Mask_AUTO_PARALLEL actually starts threads. The default of 10 is
+// estimated from the serial scoring time per mask and the cost of starting a thread, and has not been measured
+// on several cores. The us/parallel column of qrcodegen_bench, which is built with QRCODEGEN_PARALLEL_MASK_MIN_VERSION
+// set to 1, shows where the threads start to pay off on a given machine.
+#ifdef QRCODEGEN_PARALLEL_MASK_MIN_VERSION
+	#define PARALLEL_MASK_MIN_VERSION QRCODEGEN_PARALLEL_MASK_MIN_VERSION
+#else
+	#define PARALLEL_MASK_MIN_VERSION 10
+#endif
+
+// Every mask pattern repeats with a period of 2, 3, 4 or 6 rows, so 12 rows cover them all.
+#define MASK_PATTERN_ROWS 12
+
+// For applying masks a word at a time. rows[m][y % MASK_PATTERN_ROWS] is row y of mask pattern m
+// in the BitGrid layout, with a bit set wherever the mask inverts the module (over all 192 columns).
+// columns[m][x % MASK_PATTERN_ROWS] is column x of the same pattern, laid out as a row of the transposed grid.
+struct MaskPatterns {
+	uint64_t rows[8][MASK_PATTERN_ROWS][GRID_ROW_WORDS];
+	uint64_t columns[8][MASK_PATTERN_ROWS][GRID_ROW_WORDS];
+};
+
+static constexpr struct MaskPatterns makeMaskPatterns() {
+	struct MaskPatterns result = {};
+	for (int m = 0; m < 8; m++) {
+		for (int y = 0; y < GRID_ROW_WORDS * 64; y++) {
+			for (int x = 0; x < GRID_ROW_WORDS * 64; x++) {
+				if (x >= MASK_PATTERN_ROWS && y >= MASK_PATTERN_ROWS)
+					continue;
+				bool invert = false;
+				switch (m) {
+					case 0:  invert = (x + y) % 2 == 0;                    break;
+					case 1:  invert = y % 2 == 0;                          break;
+					case 2:  invert = x % 3 == 0;                          break;
+					case 3:  invert = (x + y) % 3 == 0;                    break;
+					case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
+					case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
+					case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
+					case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
+				}
+				if (invert && y < MASK_PATTERN_ROWS)
+					result.rows[m][y][x >> 6] |= (uint64_t)1 << (x & 63);
+				if (invert && x < MASK_PATTERN_ROWS)
+					result.columns[m][x][y >> 6] |= (uint64_t)1 << (y & 63);
+			}
+		}
+	}
+	return result;
+}
+
+static constexpr struct MaskPatterns MASK_PATTERNS = makeMaskPatterns();
+
+// The grid functions for rows of 1, 2 and 3 words, which versions 1 to 11, 12 to 27 and 28 to 40 need, selected
+// by getGridKernels(). With the width fixed, the compiler unrolls the loops over the words of a line and drops the
+// carries between words that are not there, which matters most for the small versions that fit in one word.
+static constexpr struct GridKernels GRID_KERNELS[GRID_ROW_WORDS] = {
+	{drawCodewordsSized<1>, applyMaskSized<1>, getMaskPenaltyScoresSized<1>},
+	{drawCodewordsSized<2>, applyMaskSized<2>, getMaskPenaltyScoresSized<2>},
+	{drawCodewordsSized<3>, applyMaskSized<3>, getMaskPenaltyScoresSized<3>},
+};
+
 
 
 /*---- High-level QR Code encoding functions ----*/
@@ -132,37 +366,43 @@ static const int PENALTY_N4 = 10;
 bool qrcodegen_encodeText(const char *text, uint8_t tempBuffer[], uint8_t qrcode[],
 		enum qrcodegen_Ecc ecl, int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl) {
 	
-	size_t textLen = strlen(text);
-	if (textLen == 0)
-		return qrcodegen_encodeSegmentsAdvanced(NULL, 0, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
-	size_t bufLen = (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion);
-	
 	struct qrcodegen_Segment seg;
-	if (qrcodegen_isNumeric(text)) {
-		if (qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_NUMERIC, textLen) > bufLen)
-			goto fail;
-		seg = qrcodegen_makeNumeric(text, tempBuffer);
-	} else if (qrcodegen_isAlphanumeric(text)) {
-		if (qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_ALPHANUMERIC, textLen) > bufLen)
-			goto fail;
-		seg = qrcodegen_makeAlphanumeric(text, tempBuffer);
-	} else {
-		if (textLen > bufLen)
-			goto fail;
-		for (size_t i = 0; i < textLen; i++)
-			tempBuffer[i] = (uint8_t)text[i];
-		seg.mode = qrcodegen_Mode_BYTE;
-		seg.bitLength = calcSegmentBitLength(seg.mode, textLen);
-		if (seg.bitLength == LENGTH_OVERFLOW)
-			goto fail;
-		seg.numChars = (int)textLen;
-		seg.data = tempBuffer;
-	}
-	return qrcodegen_encodeSegmentsAdvanced(&seg, 1, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
-	
-fail:
-	qrcode[0] = 0;  // Set size to invalid value for safety
-	return false;
+	size_t numSegs;
+	if (!makeTextSegment(text, tempBuffer, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion), true, &seg, &numSegs)) {
+		qrcode[0] = 0;  // Set size to invalid value for safety
+		return false;
+	}
+	return qrcodegen_encodeSegmentsAdvanced(&seg, numSegs, ecl, minVersion, maxVersion, mask, boostEcl, tempBuffer, qrcode);
+}
+
+
+// Makes the segment that qrcodegen_encodeText() encodes the given text as. Numeric and alphanumeric text is packed
+// into buf, which has bufLen bytes, and byte mode text is copied into buf if copyBytes is true or else used in place.
+// Sets *numSegs to 0 for the empty string, or else to 1. Returns false if the segment would not fit in the buffer.
+static bool makeTextSegment(const char *text, uint8_t buf[], size_t bufLen, bool copyBytes,
+		struct qrcodegen_Segment *seg, size_t *numSegs) {
+	size_t textLen;
+	enum qrcodegen_Mode textMode = qrcodegen_getTextMode(text, &textLen);
+	*numSegs = textLen > 0 ? 1 : 0;
+	if (textLen == 0)
+		return true;
+	if (qrcodegen_calcSegmentBufferSize(textMode, textLen) > bufLen)
+		return false;
+	seg->mode = textMode;
+	seg->numChars = (int)textLen;
+	seg->data = buf;
+	if (textMode == qrcodegen_Mode_NUMERIC)
+		seg->bitLength = packNumeric(text, textLen, buf);
+	else if (textMode == qrcodegen_Mode_ALPHANUMERIC)
+		seg->bitLength = packAlphanumeric(text, textLen, buf);
+	else {
+		seg->bitLength = (int)textLen * 8;
+		if (copyBytes)
+			memcpy(buf, text, textLen * sizeof(buf[0]));
+		else  // Only read, and never after the caller's buffers are written
+			seg->data = (uint8_t *)const_cast<char *>(text);
+	}
+	return true;
 }
 
 
@@ -192,6 +432,57 @@ testable void appendBitsToBuffer(unsigned int val, int numBits, uint8_t buffer[]
 }
 
 
+// Appends the given number of low-order bits of the given value to the writer. Requires 0 <= numBits <= 56.
+static void bitWriterAppend(struct BitWriter *writer, uint64_t val, int numBits) {
+	assert(0 <= numBits && numBits <= 56 && val >> numBits == 0);
+	int pending = (writer->bitLen & 7) + numBits;  // At most 63, so the accumulator never overflows
+	uint64_t accum = writer->accum << numBits | val;
+	uint8_t *dest = &writer->buffer[writer->bitLen >> 3];
+	for (; pending >= 8; pending -= 8)
+		*dest++ = (uint8_t)(accum >> (pending - 8));
+	if (pending > 0)
+		*dest = (uint8_t)(accum << (8 - pending));
+	writer->accum = accum;
+	writer->bitLen += numBits;
+}
+
+
+// Appends the first numBits bits of the given big-endian bit string to the writer. Whole bytes are copied
+// directly if the writer is at a byte boundary, and otherwise shifted into place 8 bytes at a time.
+static void bitWriterAppendBits(struct BitWriter *writer, const uint8_t data[], int numBits) {
+	assert(numBits >= 0 && (data != NULL || numBits == 0));
+	int numBytes = numBits >> 3;
+	int shift = writer->bitLen & 7;
+	uint8_t *dest = &writer->buffer[writer->bitLen >> 3];
+	const uint8_t *src = data;
+	if (shift == 0)
+		memcpy(dest, src, (size_t)numBytes * sizeof(data[0]));
+	else {
+		uint64_t accum = writer->accum;
+		int i = 0;
+		for (; i + 8 <= numBytes; i += 8, src += 8, dest += 8) {
+			uint64_t word = 0;
+			for (int j = 0; j < 8; j++)
+				word = word << 8 | src[j];
+			uint64_t out = accum << (64 - shift) | word >> shift;
+			for (int j = 0; j < 8; j++)
+				dest[j] = (uint8_t)(out >> (56 - j * 8));
+			accum = word;
+		}
+		for (; i < numBytes; i++, src++, dest++) {
+			*dest = (uint8_t)(accum << (8 - shift) | *src >> shift);
+			accum = *src;
+		}
+		*dest = (uint8_t)(accum << (8 - shift));  // The partial last byte
+		writer->accum = accum;
+	}
+	writer->bitLen += numBytes * 8;
+	int remain = numBits & 7;
+	if (remain > 0)
+		bitWriterAppend(writer, (uint32_t)data[numBytes] >> (8 - remain), remain);
+}
+
+
 
 /*---- Low-level QR Code encoding functions ----*/
 
@@ -206,84 +497,192 @@ bool qrcodegen_encodeSegments(const struct qrcodegen_Segment segs[], size_t len,
 // Public function - see documentation comment in header file.
 bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
 		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[]) {
+	return qrcodegen_encodeSegmentsDeadline(segs, len, ecl, minVersion, maxVersion, mask, boostEcl, -1, tempBuffer, qrcode);
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_encodeSegmentsDeadline(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, long budgetMicros,
+		uint8_t tempBuffer[], uint8_t qrcode[]) {
+	struct EncoderState state;
+	state.templateVersion = 0;
+	if (!encodeSegmentsCore(segs, len, ecl, minVersion, maxVersion, mask, boostEcl, budgetMicros, qrcode, tempBuffer, &state)) {
+		qrcode[0] = 0;  // Set size to invalid value for safety
+		return false;
+	}
+	gridToQrcode(&state.grid, qrcode);
+	return true;
+}
+
+
+// Encodes the given segments into state->grid with the arguments of qrcodegen_encodeSegmentsDeadline(), and
+// returns false if the data does not fit. The data bit string is built in dataBuffer and the interleaved
+// codewords in codewords, each of which needs qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion) bytes.
+static bool encodeSegmentsCore(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+		int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, long budgetMicros,
+		uint8_t dataBuffer[], uint8_t codewords[], struct EncoderState *state) {
+	assert(-3 <= (int)mask && (int)mask <= 7);
+	std::chrono::steady_clock::time_point deadline;
+	if (budgetMicros >= 0)
+		deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(budgetMicros);
+	int version = makeDataCodewords(segs, len, &ecl, minVersion, maxVersion, boostEcl, dataBuffer);
+	if (version == 0)  // All versions in the range could not fit the given data
+		return false;
+	drawQrCode(dataBuffer, version, ecl, mask, budgetMicros >= 0 ? &deadline : NULL, codewords, state);
+	return true;
+}
+
+
+// Builds the data codewords of the given segments in dataBuffer (which needs qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion)
+// bytes) at the smallest version in the range that fits them, and returns that version, or 0 if none does. *ecl is
+// raised to the highest error correction level that still fits in the same version if boostEcl is true.
+static int makeDataCodewords(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc *ecl,
+		int minVersion, int maxVersion, bool boostEcl, uint8_t dataBuffer[]) {
 	assert(segs != NULL || len == 0);
 	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
-	assert(0 <= (int)ecl && (int)ecl <= 3 && -1 <= (int)mask && (int)mask <= 7);
+	assert(0 <= (int)*ecl && (int)*ecl <= 3);
 	
 	// Find the minimal version number to use
-	int version, dataUsedBits;
-	for (version = minVersion; ; version++) {
-		int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;  // Number of data bits available
-		dataUsedBits = getTotalBits(segs, len, version);
-		if (dataUsedBits != LENGTH_OVERFLOW && dataUsedBits <= dataCapacityBits)
-			break;  // This version number is found to be suitable
-		if (version >= maxVersion) {  // All versions in the range could not fit the given data
-			qrcode[0] = 0;  // Set size to invalid value for safety
-			return false;
-		}
-	}
+	int version = qrcodegen_getMinVersion(segs, len, *ecl, minVersion, maxVersion);
+	if (version == 0)
+		return 0;
+	int dataUsedBits = getTotalBits(segs, len, version);
 	assert(dataUsedBits != LENGTH_OVERFLOW);
 	
 	// Increase the error correction level while the data still fits in the current version number
 	for (int i = (int)qrcodegen_Ecc_MEDIUM; i <= (int)qrcodegen_Ecc_HIGH; i++) {  // From low to high
-		if (boostEcl && dataUsedBits <= getNumDataCodewords(version, (enum qrcodegen_Ecc)i) * 8)
-			ecl = (enum qrcodegen_Ecc)i;
+		if (boostEcl && dataUsedBits <= getDataCapacityBits(version, (enum qrcodegen_Ecc)i))
+			*ecl = (enum qrcodegen_Ecc)i;
 	}
 	
 	// Concatenate all segments to create the data bit string
-	memset(qrcode, 0, (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version) * sizeof(qrcode[0]));
-	int bitLen = 0;
+	struct BitWriter writer = {dataBuffer, 0, 0};
 	for (size_t i = 0; i < len; i++) {
 		const struct qrcodegen_Segment *seg = &segs[i];
-		appendBitsToBuffer((unsigned int)seg->mode, 4, qrcode, &bitLen);
-		appendBitsToBuffer((unsigned int)seg->numChars, numCharCountBits(seg->mode, version), qrcode, &bitLen);
-		for (int j = 0; j < seg->bitLength; j++) {
-			int bit = (seg->data[j >> 3] >> (7 - (j & 7))) & 1;
-			appendBitsToBuffer((unsigned int)bit, 1, qrcode, &bitLen);
-		}
+		bitWriterAppend(&writer, (uint32_t)seg->mode, 4);
+		bitWriterAppend(&writer, (uint32_t)seg->numChars, numCharCountBits(seg->mode, version));
+		bitWriterAppendBits(&writer, seg->data, seg->bitLength);
 	}
-	assert(bitLen == dataUsedBits);
+	assert(writer.bitLen == dataUsedBits);
 	
 	// Add terminator and pad up to a byte if applicable
-	int dataCapacityBits = getNumDataCodewords(version, ecl) * 8;
-	assert(bitLen <= dataCapacityBits);
-	int terminatorBits = dataCapacityBits - bitLen;
+	int dataCapacityBits = getDataCapacityBits(version, *ecl);
+	assert(writer.bitLen <= dataCapacityBits);
+	int terminatorBits = dataCapacityBits - writer.bitLen;
 	if (terminatorBits > 4)
 		terminatorBits = 4;
-	appendBitsToBuffer(0, terminatorBits, qrcode, &bitLen);
-	appendBitsToBuffer(0, (8 - bitLen % 8) % 8, qrcode, &bitLen);
-	assert(bitLen % 8 == 0);
+	bitWriterAppend(&writer, 0, terminatorBits);
+	bitWriterAppend(&writer, 0, (8 - writer.bitLen % 8) % 8);
+	assert(writer.bitLen % 8 == 0);
 	
 	// Pad with alternating bytes until data capacity is reached
-	for (uint8_t padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
-		appendBitsToBuffer(padByte, 8, qrcode, &bitLen);
-	
-	// Compute ECC, draw modules
-	addEccAndInterleave(qrcode, version, ecl, tempBuffer);
-	initializeFunctionModules(version, qrcode);
-	drawCodewords(tempBuffer, getNumRawDataModules(version) / 8, qrcode);
-	drawLightFunctionModules(qrcode, version);
-	initializeFunctionModules(version, tempBuffer);
-	
-	// Do masking
-	if (mask == qrcodegen_Mask_AUTO) {  // Automatically choose best mask
+	uint8_t padByte = 0xEC;
+	for (int i = writer.bitLen / 8; i < dataCapacityBits / 8; i++, padByte ^= 0xEC ^ 0x11)
+		dataBuffer[i] = padByte;
+	return version;
+}
+
+
+// Draws the QR Code of the given data codewords, as built by makeDataCodewords(), into state->grid with the mask
+// chosen like encodeSegmentsCore() does, by the given deadline unless it is NULL. dataBuffer is clobbered past the
+// data codewords, up to the total number of codewords of the version, and the interleaved codewords go into codewords.
+static void drawQrCode(uint8_t dataBuffer[], int version, enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask,
+		const std::chrono::steady_clock::time_point *deadline, uint8_t codewords[], struct EncoderState *state) {
+	// Compute ECC, then draw the codewords over a copy of the version's function patterns
+	addEccAndInterleave(dataBuffer, version, ecl, codewords);
+	struct BitGrid *grid = &state->grid;
+	struct BitGrid *functionModules = &state->functionModules;
+	getFunctionTemplate(version, state->templateVersion != version ? functionModules : NULL, grid);
+	state->templateVersion = version;
+	drawCodewords(codewords, getNumRawDataModules(version) / 8, functionModules, grid);
+	maskQrCode(ecl, mask, deadline, NULL, state);
+}
+
+
+// Chooses the mask like encodeSegmentsCore() does, by the given deadline unless it is NULL, and applies it and
+// draws the format bits on state->grid, which must hold an unmasked QR Code of state->templateVersion. The exact
+// penalty scores of the automatic masks come from the given cache of the grid's line scores unless it is NULL.
+static void maskQrCode(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask,
+		const std::chrono::steady_clock::time_point *deadline, struct LinePenalties *cache, struct EncoderState *state) {
+	// Do masking on the row-aligned form of the grid
+	struct BitGrid *grid = &state->grid;
+	const struct BitGrid *functionModules = &state->functionModules;
+	if ((int)mask < 0 && deadline != NULL && mask != qrcodegen_Mask_AUTO_FAST)
+		mask = chooseMaskByDeadline(grid, functionModules, ecl, *deadline);
+	else if ((int)mask < 0) {  // Automatically choose best mask
+		long penalties[8];
+		if (mask == qrcodegen_Mask_AUTO_PARALLEL)
+			getMaskPenaltyScoresParallel(grid, functionModules, ecl, cache, penalties);
+		else if (mask == qrcodegen_Mask_AUTO_FAST)
+			getMaskPenaltyScores(grid, functionModules, ecl, 0, 8, true, NULL, penalties);
+		else
+			getMaskPenaltyScores(grid, functionModules, ecl, 0, 8, false, cache, penalties);
+		if (mask != qrcodegen_Mask_AUTO_FAST && cache != NULL) {
+			memset(cache->dirtyRows, 0, sizeof(cache->dirtyRows));
+			memset(cache->dirtyColumns, 0, sizeof(cache->dirtyColumns));
+		}
 		long minPenalty = LONG_MAX;
 		for (int i = 0; i < 8; i++) {
-			enum qrcodegen_Mask msk = (enum qrcodegen_Mask)i;
-			applyMask(tempBuffer, qrcode, msk);
-			drawFormatBits(ecl, msk, qrcode);
-			long penalty = getPenaltyScore(qrcode);
-			if (penalty < minPenalty) {
-				mask = msk;
-				minPenalty = penalty;
+			if (penalties[i] < minPenalty) {
+				mask = (enum qrcodegen_Mask)i;
+				minPenalty = penalties[i];
 			}
-			applyMask(tempBuffer, qrcode, msk);  // Undoes the mask due to XOR
 		}
 	}
 	assert(0 <= (int)mask && (int)mask <= 7);
-	applyMask(tempBuffer, qrcode, mask);  // Apply the final choice of mask
-	drawFormatBits(ecl, mask, qrcode);  // Overwrite old format bits
-	return true;
+	applyMask(functionModules, grid, mask);  // Apply the final choice of mask
+	drawFormatBits(ecl, mask, grid);  // Overwrite old format bits
+	state->ecl = ecl;
+	state->mask = mask;
+}
+
+
+// Public function - see documentation comment in header file.
+int qrcodegen_getMinVersion(const struct qrcodegen_Segment segs[], size_t len,
+		enum qrcodegen_Ecc ecl, int minVersion, int maxVersion) {
+	assert(segs != NULL || len == 0);
+	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	assert(0 <= (int)ecl && (int)ecl <= 3);
+	// The widths of the character count fields only change after versions 9 and 26, so the total
+	// bit length is the same within each of these ranges, and the capacity increases with the version
+	static const int rangeEnds[] = {9, 26, qrcodegen_VERSION_MAX};
+	int low = minVersion;
+	for (int i = 0; i < 3 && low <= maxVersion; i++) {
+		int high = rangeEnds[i] < maxVersion ? rangeEnds[i] : maxVersion;
+		if (low > high)
+			continue;
+		int dataUsedBits = getTotalBits(segs, len, low);
+		if (dataUsedBits != LENGTH_OVERFLOW && dataUsedBits <= getDataCapacityBits(high, ecl)) {
+			while (low < high) {  // Binary search for the first version that fits
+				int mid = (low + high) / 2;
+				if (dataUsedBits <= getDataCapacityBits(mid, ecl))
+					high = mid;
+				else
+					low = mid + 1;
+			}
+			return low;
+		}
+		low = high + 1;
+	}
+	return 0;
+}
+
+
+// Public function - see documentation comment in header file.
+int qrcodegen_getMinVersionForText(const char *text, enum qrcodegen_Ecc ecl, int minVersion, int maxVersion) {
+	// Mirrors the choice of segment mode in qrcodegen_encodeText(), but only the lengths are needed
+	size_t textLen;
+	struct qrcodegen_Segment seg;
+	seg.mode = qrcodegen_getTextMode(text, &textLen);
+	if (textLen == 0)
+		return qrcodegen_getMinVersion(NULL, 0, ecl, minVersion, maxVersion);
+	seg.bitLength = calcSegmentBitLength(seg.mode, textLen);
+	if (seg.bitLength == LENGTH_OVERFLOW)
+		return 0;
+	seg.numChars = (int)textLen;
+	seg.data = NULL;
+	return qrcodegen_getMinVersion(&seg, 1, ecl, minVersion, maxVersion);
 }
 
 
@@ -304,20 +703,29 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
 	int shortBlockDataLen = rawCodewords / numBlocks - blockEccLen;
 	
-	// Split data into blocks, calculate ECC, and interleave
-	// (not concatenate) the bytes into a single sequence
-	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
-	reedSolomonComputeDivisor(blockEccLen, rsdiv);
+	// Split data into blocks and interleave (not concatenate) the bytes into a single sequence
 	const uint8_t *dat = data;
 	for (int i = 0; i < numBlocks; i++) {
 		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
-		uint8_t *ecc = &data[dataLen];  // Temporary storage
-		reedSolomonComputeRemainder(dat, datLen, rsdiv, blockEccLen, ecc);
-		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {  // Copy data
+		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {
 			if (j == shortBlockDataLen)
 				k -= numShortBlocks;
 			result[k] = dat[j];
 		}
+		dat += datLen;
+	}
+	
+	// Calculate the ECC of every block, preferably all blocks at once from the interleaved data
+	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	reedSolomonComputeDivisor(blockEccLen, rsdiv);
+	if (reedSolomonComputeInterleavedRemainders(result, numBlocks, numShortBlocks,
+			shortBlockDataLen, rsdiv, blockEccLen, &result[dataLen]))
+		return;
+	dat = data;
+	for (int i = 0; i < numBlocks; i++) {
+		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
+		uint8_t *ecc = &data[dataLen];  // Temporary storage
+		reedSolomonComputeRemainder(dat, datLen, rsdiv, blockEccLen, ecc);
 		for (int j = 0, k = dataLen + i; j < blockEccLen; j++, k += numBlocks)  // Copy ECC
 			result[k] = ecc[j];
 		dat += datLen;
@@ -327,7 +735,7 @@ testable void addEccAndInterleave(uint8_t data[], int version, enum qrcodegen_Ec
 
 // Returns the number of 8-bit codewords that can be used for storing data (not ECC),
 // for the given version number and error correction level. The result is in the range [9, 2956].
-testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl) {
+testable constexpr int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl) {
 	int v = version, e = (int)ecl;
 	assert(0 <= e && e < 4);
 	return getNumRawDataModules(v) / 8
@@ -339,7 +747,7 @@ testable int getNumDataCodewords(int version, enum qrcodegen_Ecc ecl) {
 // Returns the number of data bits that can be stored in a QR Code of the given version number, after
 // all function modules are excluded. This includes remainder bits, so it might not be a multiple of 8.
 // The result is in the range [208, 29648]. This could be implemented as a 40-entry lookup table.
-testable int getNumRawDataModules(int ver) {
+testable constexpr int getNumRawDataModules(int ver) {
 	assert(qrcodegen_VERSION_MIN <= ver && ver <= qrcodegen_VERSION_MAX);
 	int result = (16 * ver + 128) * ver + 64;
 	if (ver >= 2) {
@@ -353,31 +761,75 @@ testable int getNumRawDataModules(int ver) {
 }
 
 
+static constexpr struct DataCapacities makeDataCapacities() {
+	struct DataCapacities result = {};
+	for (int e = 0; e < 4; e++) {
+		for (int v = qrcodegen_VERSION_MIN; v <= qrcodegen_VERSION_MAX; v++)
+			result.bits[e][v] = getNumDataCodewords(v, (enum qrcodegen_Ecc)e) * 8;
+	}
+	return result;
+}
+
+static constexpr struct DataCapacities DATA_CAPACITY = makeDataCapacities();
+
+
+// Returns DATA_CAPACITY.bits[ecl][version], the same as getNumDataCodewords(version, ecl) * 8.
+static int getDataCapacityBits(int version, enum qrcodegen_Ecc ecl) {
+	return DATA_CAPACITY.bits[(int)ecl][version];
+}
+
+
 
 /*---- Reed-Solomon ECC generator functions ----*/
 
+// Returns the product of the two given field elements modulo GF(2^8/0x11D).
+// All inputs are valid. Uses the logarithm tables instead of shift-and-add multiplication.
+testable constexpr uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
+	if (x == 0 || y == 0)
+		return 0;
+	return GF.exp[GF.log[x] + GF.log[y]];
+}
+
+
+// The generator polynomial for every degree up to qrcodegen_REED_SOLOMON_DEGREE_MAX, indexed
+// by degree (index 0 is unused). QR Codes only use degrees 7 to 30, see ECC_CODEWORDS_PER_BLOCK.
+struct ReedSolomonDivisors {
+	uint8_t coefs[qrcodegen_REED_SOLOMON_DEGREE_MAX + 1][qrcodegen_REED_SOLOMON_DEGREE_MAX];
+};
+
+static constexpr struct ReedSolomonDivisors makeReedSolomonDivisors() {
+	struct ReedSolomonDivisors result = {};
+	for (int degree = 1; degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX; degree++) {
+		// Polynomial coefficients are stored from highest to lowest power, excluding the leading term which is always 1.
+		// For example the polynomial x^3 + 255x^2 + 8x + 93 is stored as the uint8 array {255, 8, 93}.
+		uint8_t *coefs = result.coefs[degree];
+		coefs[degree - 1] = 1;  // Start off with the monomial x^0
+		
+		// Compute the product polynomial (x - r^0) * (x - r^1) * (x - r^2) * ... * (x - r^{degree-1}),
+		// drop the highest monomial term which is always 1x^degree.
+		// Note that r = 0x02, which is a generator element of this field GF(2^8/0x11D).
+		uint8_t root = 1;
+		for (int i = 0; i < degree; i++) {
+			// Multiply the current product by (x - r^i)
+			for (int j = 0; j < degree; j++) {
+				coefs[j] = reedSolomonMultiply(coefs[j], root);
+				if (j + 1 < degree)
+					coefs[j] ^= coefs[j + 1];
+			}
+			root = reedSolomonMultiply(root, 0x02);
+		}
+	}
+	return result;
+}
+
+static constexpr struct ReedSolomonDivisors RS_DIVISORS = makeReedSolomonDivisors();
+
+
 // Computes a Reed-Solomon ECC generator polynomial for the given degree, storing in result[0 : degree].
-// This could be implemented as a lookup table over all possible parameter values, instead of as an algorithm.
+// The polynomials are computed at compile time, so this only copies a row of RS_DIVISORS.
 testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
-	// Polynomial coefficients are stored from highest to lowest power, excluding the leading term which is always 1.
-	// For example the polynomial x^3 + 255x^2 + 8x + 93 is stored as the uint8 array {255, 8, 93}.
-	memset(result, 0, (size_t)degree * sizeof(result[0]));
-	result[degree - 1] = 1;  // Start off with the monomial x^0
-	
-	// Compute the product polynomial (x - r^0) * (x - r^1) * (x - r^2) * ... * (x - r^{degree-1}),
-	// drop the highest monomial term which is always 1x^degree.
-	// Note that r = 0x02, which is a generator element of this field GF(2^8/0x11D).
-	uint8_t root = 1;
-	for (int i = 0; i < degree; i++) {
-		// Multiply the current product by (x - r^i)
-		for (int j = 0; j < degree; j++) {
-			result[j] = reedSolomonMultiply(result[j], root);
-			if (j + 1 < degree)
-				result[j] ^= result[j + 1];
-		}
-		root = reedSolomonMultiply(root, 0x02);
-	}
+	memcpy(result, RS_DIVISORS.coefs[degree], (size_t)degree * sizeof(result[0]));
 }
 
 
@@ -387,106 +839,252 @@ testable void reedSolomonComputeDivisor(int degree, uint8_t result[]) {
 testable void reedSolomonComputeRemainder(const uint8_t data[], int dataLen,
 		const uint8_t generator[], int degree, uint8_t result[]) {
 	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
+	// Every generator coefficient is nonzero, so each can be kept as a logarithm
+	uint8_t genLog[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	for (int j = 0; j < degree; j++) {
+		assert(generator[j] != 0);
+		genLog[j] = GF.log[generator[j]];
+	}
 	memset(result, 0, (size_t)degree * sizeof(result[0]));
 	for (int i = 0; i < dataLen; i++) {  // Polynomial division
 		uint8_t factor = data[i] ^ result[0];
-		memmove(&result[0], &result[1], (size_t)(degree - 1) * sizeof(result[0]));
-		result[degree - 1] = 0;
+		if (factor == 0) {
+			memmove(&result[0], &result[1], (size_t)(degree - 1) * sizeof(result[0]));
+			result[degree - 1] = 0;
+			continue;
+		}
+		const uint8_t *exp = &GF.exp[GF.log[factor]];
+		for (int j = 0; j < degree - 1; j++)
+			result[j] = result[j + 1] ^ exp[genLog[j]];
+		result[degree - 1] = exp[genLog[degree - 1]];
+	}
+}
+
+
+#ifdef QRCODEGEN_X86_DISPATCH
+
+// The number of lanes in the remainder state, rounded up to a whole number of 32-byte vectors.
+#define REED_SOLOMON_LANES ((qrcodegen_REED_SOLOMON_BLOCKS_MAX + 31) / 32 * 32)
+
+// Remainder state for reedSolomonComputeInterleavedRemainders(), stored with one lane (column) per block.
+// Row j holds coefficient j of every block's remainder, and the extra row 'degree' is always zero.
+// Lanes beyond the number of blocks are padding so that vector loads never need a tail.
+struct ReedSolomonLanes {
+	alignas(32) uint8_t rem[qrcodegen_REED_SOLOMON_DEGREE_MAX + 1][REED_SOLOMON_LANES];
+	alignas(32) uint8_t factor[REED_SOLOMON_LANES];
+	// mulLo[j][n] = generator[j] * n and mulHi[j][n] = generator[j] * (n << 4), for the nibble-table multiply
+	alignas(16) uint8_t mulLo[qrcodegen_REED_SOLOMON_DEGREE_MAX][16];
+	alignas(16) uint8_t mulHi[qrcodegen_REED_SOLOMON_DEGREE_MAX][16];
+};
+
+
+// Prepares the multiplication tables and clears the remainders. A helper function for the lane kernels.
+static void reedSolomonLanesInit(struct ReedSolomonLanes *lanes, const uint8_t generator[], int degree) {
+	memset(lanes->rem, 0, sizeof(lanes->rem));
+	memset(lanes->factor, 0, sizeof(lanes->factor));
+	for (int j = 0; j < degree; j++) {
+		for (int n = 0; n < 16; n++) {
+			lanes->mulLo[j][n] = reedSolomonMultiply(generator[j], (uint8_t)n);
+			lanes->mulHi[j][n] = reedSolomonMultiply(generator[j], (uint8_t)(n << 4));
+		}
+	}
+}
+
+
+// Feeds the final data byte of every long block (the last lanes), then writes the remainders out
+// in the interleaved ECC layout result[j * numBlocks + i]. A helper function for the lane kernels.
+static void reedSolomonLanesFinish(struct ReedSolomonLanes *lanes, const uint8_t data[], int numBlocks,
+		int numShortBlocks, int shortBlockDataLen, int degree, uint8_t result[]) {
+	const uint8_t *last = &data[shortBlockDataLen * numBlocks];
+	for (int i = numShortBlocks; i < numBlocks; i++) {
+		uint8_t factor = last[i - numShortBlocks] ^ lanes->rem[0][i];
 		for (int j = 0; j < degree; j++)
-			result[j] ^= reedSolomonMultiply(generator[j], factor);
+			lanes->rem[j][i] = lanes->rem[j + 1][i] ^ lanes->mulLo[j][factor & 0xF] ^ lanes->mulHi[j][factor >> 4];
 	}
+	for (int j = 0; j < degree; j++)
+		memcpy(&result[j * numBlocks], lanes->rem[j], (size_t)numBlocks * sizeof(result[0]));
 }
 
-#undef qrcodegen_REED_SOLOMON_DEGREE_MAX
+
+// Steps every block's polynomial division through the data bytes shared by all blocks, 32 blocks per vector.
+__attribute__((target("avx2")))
+static void reedSolomonLanesAvx2(struct ReedSolomonLanes *lanes, const uint8_t data[],
+		int numBlocks, int shortBlockDataLen, int degree) {
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+	for (int i = 0; i < shortBlockDataLen; i++) {
+		memcpy(lanes->factor, &data[i * numBlocks], (size_t)numBlocks);
+		for (int c = 0; c < numBlocks; c += 32) {
+			__m256i factor = _mm256_xor_si256(
+				_mm256_load_si256((const __m256i *)&lanes->factor[c]),
+				_mm256_load_si256((const __m256i *)&lanes->rem[0][c]));
+			__m256i lo = _mm256_and_si256(factor, nibble);
+			__m256i hi = _mm256_and_si256(_mm256_srli_epi16(factor, 4), nibble);
+			for (int j = 0; j < degree; j++) {
+				__m256i mulLo = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lanes->mulLo[j]));
+				__m256i mulHi = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lanes->mulHi[j]));
+				__m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(mulLo, lo), _mm256_shuffle_epi8(mulHi, hi));
+				__m256i next = _mm256_load_si256((const __m256i *)&lanes->rem[j + 1][c]);
+				_mm256_store_si256((__m256i *)&lanes->rem[j][c], _mm256_xor_si256(next, product));
+			}
+		}
+	}
+}
 
 
-// Returns the product of the two given field elements modulo GF(2^8/0x11D).
-// All inputs are valid. This could be implemented as a 256*256 lookup table.
-testable uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
-	// Russian peasant multiplication
-	uint8_t z = 0;
-	for (int i = 7; i >= 0; i--) {
-		z = (uint8_t)((z << 1) ^ ((z >> 7) * 0x11D));
-		z ^= ((y >> i) & 1) * x;
+// Same as reedSolomonLanesAvx2(), but 16 blocks per vector.
+__attribute__((target("ssse3")))
+static void reedSolomonLanesSsse3(struct ReedSolomonLanes *lanes, const uint8_t data[],
+		int numBlocks, int shortBlockDataLen, int degree) {
+	const __m128i nibble = _mm_set1_epi8(0x0F);
+	for (int i = 0; i < shortBlockDataLen; i++) {
+		memcpy(lanes->factor, &data[i * numBlocks], (size_t)numBlocks);
+		for (int c = 0; c < numBlocks; c += 16) {
+			__m128i factor = _mm_xor_si128(
+				_mm_load_si128((const __m128i *)&lanes->factor[c]),
+				_mm_load_si128((const __m128i *)&lanes->rem[0][c]));
+			__m128i lo = _mm_and_si128(factor, nibble);
+			__m128i hi = _mm_and_si128(_mm_srli_epi16(factor, 4), nibble);
+			for (int j = 0; j < degree; j++) {
+				__m128i mulLo = _mm_load_si128((const __m128i *)lanes->mulLo[j]);
+				__m128i mulHi = _mm_load_si128((const __m128i *)lanes->mulHi[j]);
+				__m128i product = _mm_xor_si128(_mm_shuffle_epi8(mulLo, lo), _mm_shuffle_epi8(mulHi, hi));
+				__m128i next = _mm_load_si128((const __m128i *)&lanes->rem[j + 1][c]);
+				_mm_store_si128((__m128i *)&lanes->rem[j][c], _mm_xor_si128(next, product));
+			}
+		}
 	}
-	return z;
 }
 
+#undef REED_SOLOMON_LANES
+
+#endif
+
+
+// Computes the Reed-Solomon remainders of all blocks at once, one vector lane per block, reading the
+// data already interleaved as addEccAndInterleave() lays it out: byte j of block i is at data[j * numBlocks + i],
+// except that the final byte of each long block is at data[shortBlockDataLen * numBlocks + i - numShortBlocks].
+// Coefficient j of block i's remainder is stored at result[j * numBlocks + i]. Returns false without
+// writing anything if the CPU has no suitable vector instructions; the output is identical either way.
+testable bool reedSolomonComputeInterleavedRemainders(const uint8_t data[], int numBlocks, int numShortBlocks,
+		int shortBlockDataLen, const uint8_t generator[], int degree, uint8_t result[]) {
+	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
+	assert(1 <= numBlocks && numBlocks <= qrcodegen_REED_SOLOMON_BLOCKS_MAX && numShortBlocks <= numBlocks);
+#ifdef QRCODEGEN_X86_DISPATCH
+	void (*kernel)(struct ReedSolomonLanes *, const uint8_t[], int, int, int);
+	if (__builtin_cpu_supports("avx2"))
+		kernel = reedSolomonLanesAvx2;
+	else if (__builtin_cpu_supports("ssse3"))
+		kernel = reedSolomonLanesSsse3;
+	else
+		return false;
+	struct ReedSolomonLanes lanes;
+	reedSolomonLanesInit(&lanes, generator, degree);
+	kernel(&lanes, data, numBlocks, shortBlockDataLen, degree);
+	reedSolomonLanesFinish(&lanes, data, numBlocks, numShortBlocks, shortBlockDataLen, degree, result);
+	return true;
+#else
+	(void)data, (void)numBlocks, (void)numShortBlocks, (void)shortBlockDataLen, (void)generator, (void)degree, (void)result;
+	return false;
+#endif
+}
+
+#undef qrcodegen_REED_SOLOMON_BLOCKS_MAX
+
 
 
 /*---- Drawing function modules ----*/
 
-// Clears the given QR Code grid with light modules for the given
-// version's size, then marks every function module as dark.
-testable void initializeFunctionModules(int version, uint8_t qrcode[]) {
-	// Initialize QR Code
+// Returns the first row of the given version's function template in the FunctionTemplates tables.
+static constexpr int getFunctionTemplateOffset(int version) {
+	return (version - 1) * (version * 2 + 17);  // Sum of the sizes 4v + 17 of all smaller versions v
+}
+
+
+// Calculates and stores an ascending list of positions of alignment patterns
+// for this version number, returning the length of the list (in the range [0,7]).
+// Each position is in the range [0,177), and are used on both the x and y axes.
+testable constexpr int getAlignmentPatternPositions(int version, uint8_t result[7]) {
+	if (version == 1)
+		return 0;
+	int numAlign = version / 7 + 2;
+	int step = (version == 32) ? 26 :
+		(version * 4 + numAlign * 2 + 1) / (numAlign * 2 - 2) * 2;
+	for (int i = numAlign - 1, pos = version * 4 + 10; i >= 1; i--, pos -= step)
+		result[i] = (uint8_t)pos;
+	result[0] = 6;
+	return numAlign;
+}
+
+
+// Returns max(|dx|, |dy|), the distance from the center of a square ring pattern to the ring containing (dx, dy).
+static constexpr int getChebyshevDistance(int dx, int dy) {
+	if (dx < 0)
+		dx = -dx;
+	if (dy < 0)
+		dy = -dy;
+	return dx > dy ? dx : dy;
+}
+
+
+// Sets the given module of a version's function template (which starts at row 'top' of the
+// tables) to be a function module with the given color.
+static constexpr void setFunctionModule(struct FunctionTemplates *templates, int top, int x, int y, bool isDark) {
+	uint64_t bit = (uint64_t)1 << (x & 63);
+	templates->modules[top + y][x >> 6] |= bit;
+	if (isDark)
+		templates->patterns[top + y][x >> 6] |= bit;
+	else
+		templates->patterns[top + y][x >> 6] &= ~bit;
+}
+
+
+// Draws every function module of the given version into its function template, all in the order (and
+// with the same overlaps) that the QR Code specification describes them. The format bits are left light.
+static constexpr void drawFunctionTemplate(int version, struct FunctionTemplates *templates) {
 	int qrsize = version * 4 + 17;
-	memset(qrcode, 0, (size_t)((qrsize * qrsize + 7) / 8 + 1) * sizeof(qrcode[0]));
-	qrcode[0] = (uint8_t)qrsize;
+	int top = getFunctionTemplateOffset(version);
 	
-	// Fill horizontal and vertical timing patterns
-	fillRectangle(6, 0, 1, qrsize, qrcode);
-	fillRectangle(0, 6, qrsize, 1, qrcode);
-	
-	// Fill 3 finder patterns (all corners except bottom right) and format bits
-	fillRectangle(0, 0, 9, 9, qrcode);
-	fillRectangle(qrsize - 8, 0, 8, 9, qrcode);
-	fillRectangle(0, qrsize - 8, 9, 8, qrcode);
-	
-	// Fill numerous alignment patterns
-	uint8_t alignPatPos[7];
-	int numAlign = getAlignmentPatternPositions(version, alignPatPos);
-	for (int i = 0; i < numAlign; i++) {
-		for (int j = 0; j < numAlign; j++) {
-			// Don't draw on the three finder corners
-			if (!((i == 0 && j == 0) || (i == 0 && j == numAlign - 1) || (i == numAlign - 1 && j == 0)))
-				fillRectangle(alignPatPos[i] - 2, alignPatPos[j] - 2, 5, 5, qrcode);
+	// Reserve the 9*9, 8*9 and 9*8 corner rectangles around the finders, including the format bits
+	for (int y = 0; y < 9; y++) {
+		for (int x = 0; x < 9; x++) {
+			setFunctionModule(templates, top, x, y, false);
+			if (x < 8) {
+				setFunctionModule(templates, top, qrsize - 8 + x, y, false);
+				setFunctionModule(templates, top, y, qrsize - 8 + x, false);
+			}
 		}
 	}
 	
-	// Fill version blocks
-	if (version >= 7) {
-		fillRectangle(qrsize - 11, 0, 3, 6, qrcode);
-		fillRectangle(0, qrsize - 11, 6, 3, qrcode);
-	}
-}
-
-
-// Draws light function modules and possibly some dark modules onto the given QR Code, without changing
-// non-function modules. This does not draw the format bits. This requires all function modules to be previously
-// marked dark (namely by initializeFunctionModules()), because this may skip redrawing dark function modules.
-static void drawLightFunctionModules(uint8_t qrcode[], int version) {
 	// Draw horizontal and vertical timing patterns
-	int qrsize = qrcodegen_getSize(qrcode);
-	for (int i = 7; i < qrsize - 7; i += 2) {
-		setModuleBounded(qrcode, 6, i, false);
-		setModuleBounded(qrcode, i, 6, false);
+	for (int i = 0; i < qrsize; i++) {
+		setFunctionModule(templates, top, 6, i, i % 2 == 0);
+		setFunctionModule(templates, top, i, 6, i % 2 == 0);
 	}
 	
 	// Draw 3 finder patterns (all corners except bottom right; overwrites some timing modules)
+	const int finderCenters[3][2] = {{3, 3}, {qrsize - 4, 3}, {3, qrsize - 4}};
 	for (int dy = -4; dy <= 4; dy++) {
 		for (int dx = -4; dx <= 4; dx++) {
-			int dist = abs(dx);
-			if (abs(dy) > dist)
-				dist = abs(dy);
-			if (dist == 2 || dist == 4) {
-				setModuleUnbounded(qrcode, 3 + dx, 3 + dy, false);
-				setModuleUnbounded(qrcode, qrsize - 4 + dx, 3 + dy, false);
-				setModuleUnbounded(qrcode, 3 + dx, qrsize - 4 + dy, false);
+			int dist = getChebyshevDistance(dx, dy);
+			bool isDark = dist != 2 && dist != 4;
+			for (int i = 0; i < 3; i++) {
+				int x = finderCenters[i][0] + dx, y = finderCenters[i][1] + dy;
+				if (0 <= x && x < qrsize && 0 <= y && y < qrsize)
+					setFunctionModule(templates, top, x, y, isDark);
 			}
 		}
 	}
 	
 	// Draw numerous alignment patterns
-	uint8_t alignPatPos[7];
+	uint8_t alignPatPos[7] = {};
 	int numAlign = getAlignmentPatternPositions(version, alignPatPos);
 	for (int i = 0; i < numAlign; i++) {
 		for (int j = 0; j < numAlign; j++) {
 			if ((i == 0 && j == 0) || (i == 0 && j == numAlign - 1) || (i == numAlign - 1 && j == 0))
 				continue;  // Don't draw on the three finder corners
-			for (int dy = -1; dy <= 1; dy++) {
-				for (int dx = -1; dx <= 1; dx++)
-					setModuleBounded(qrcode, alignPatPos[i] + dx, alignPatPos[j] + dy, dx == 0 && dy == 0);
+			for (int dy = -2; dy <= 2; dy++) {
+				for (int dx = -2; dx <= 2; dx++)
+					setFunctionModule(templates, top, alignPatPos[i] + dx, alignPatPos[j] + dy, getChebyshevDistance(dx, dy) != 1);
 			}
 		}
 	}
@@ -498,14 +1096,13 @@ static void drawLightFunctionModules(uint8_t qrcode[], int version) {
 		for (int i = 0; i < 12; i++)
 			rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
 		long bits = (long)version << 12 | rem;  // uint18
-		assert(bits >> 18 == 0);
 		
 		// Draw two copies
 		for (int i = 0; i < 6; i++) {
 			for (int j = 0; j < 3; j++) {
 				int k = qrsize - 11 + j;
-				setModuleBounded(qrcode, k, i, (bits & 1) != 0);
-				setModuleBounded(qrcode, i, k, (bits & 1) != 0);
+				setFunctionModule(templates, top, k, i, (bits & 1) != 0);
+				setFunctionModule(templates, top, i, k, (bits & 1) != 0);
 				bits >>= 1;
 			}
 		}
@@ -513,61 +1110,99 @@ static void drawLightFunctionModules(uint8_t qrcode[], int version) {
 }
 
 
-// Draws two copies of the format bits (with its own error correction code) based
-// on the given mask and error correction level. This always draws all modules of
-// the format bits, unlike drawLightFunctionModules() which might skip dark modules.
-static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, uint8_t qrcode[]) {
-	// Calculate error correction code and pack bits
-	assert(0 <= (int)mask && (int)mask <= 7);
-	static const int table[] = {1, 0, 3, 2};
-	int data = table[(int)ecl] << 3 | (int)mask;  // errCorrLvl is uint2, mask is uint3
-	int rem = data;
-	for (int i = 0; i < 10; i++)
-		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
-	int bits = (data << 10 | rem) ^ 0x5412;  // uint15
-	assert(bits >> 15 == 0);
-	
-	// Draw first copy
-	for (int i = 0; i <= 5; i++)
-		setModuleBounded(qrcode, 8, i, getBit(bits, i));
-	setModuleBounded(qrcode, 8, 7, getBit(bits, 6));
-	setModuleBounded(qrcode, 8, 8, getBit(bits, 7));
-	setModuleBounded(qrcode, 7, 8, getBit(bits, 8));
-	for (int i = 9; i < 15; i++)
-		setModuleBounded(qrcode, 14 - i, 8, getBit(bits, i));
-	
-	// Draw second copy
-	int qrsize = qrcodegen_getSize(qrcode);
-	for (int i = 0; i < 8; i++)
-		setModuleBounded(qrcode, qrsize - 1 - i, 8, getBit(bits, i));
-	for (int i = 8; i < 15; i++)
-		setModuleBounded(qrcode, 8, qrsize - 15 + i, getBit(bits, i));
-	setModuleBounded(qrcode, 8, qrsize - 8, true);  // Always dark
+static constexpr struct FunctionTemplates makeFunctionTemplates() {
+	struct FunctionTemplates result = {};
+	for (int version = qrcodegen_VERSION_MIN; version <= qrcodegen_VERSION_MAX; version++)
+		drawFunctionTemplate(version, &result);
+	return result;
 }
 
+static constexpr struct FunctionTemplates FUNCTION_TEMPLATES = makeFunctionTemplates();
 
-// Calculates and stores an ascending list of positions of alignment patterns
-// for this version number, returning the length of the list (in the range [0,7]).
-// Each position is in the range [0,177), and are used on both the x and y axes.
-// This could be implemented as lookup table of 40 variable-length lists of unsigned bytes.
-testable int getAlignmentPatternPositions(int version, uint8_t result[7]) {
-	if (version == 1)
-		return 0;
-	int numAlign = version / 7 + 2;
-	int step = (version == 32) ? 26 :
-		(version * 4 + numAlign * 2 + 1) / (numAlign * 2 - 2) * 2;
-	for (int i = numAlign - 1, pos = version * 4 + 10; i >= 1; i--, pos -= step)
-		result[i] = (uint8_t)pos;
-	result[0] = 6;
-	return numAlign;
+
+// Copies the function module map of the given version into functionModules, and the colors of the function modules
+// (with light format bits) into patterns, skipping either of them that is NULL. Only the rows of the version are written.
+static void getFunctionTemplate(int version, struct BitGrid *functionModules, struct BitGrid *patterns) {
+	assert(qrcodegen_VERSION_MIN <= version && version <= qrcodegen_VERSION_MAX);
+	int qrsize = version * 4 + 17;
+	int top = getFunctionTemplateOffset(version);
+	size_t len = (size_t)qrsize * sizeof(FUNCTION_TEMPLATES.modules[0]);
+	if (functionModules != NULL) {
+		functionModules->size = qrsize;
+		memcpy(functionModules->rows, FUNCTION_TEMPLATES.modules[top], len);
+	}
+	if (patterns != NULL) {
+		patterns->size = qrsize;
+		memcpy(patterns->rows, FUNCTION_TEMPLATES.patterns[top], len);
+	}
+}
+
+
+// Draws two copies of the format bits (with its own error correction code) based
+// on the given mask and error correction level, plus the dark module next to them.
+static void drawFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, struct BitGrid *grid) {
+	int bits = getFormatBits(ecl, mask);
+	int qrsize = grid->size;
+	for (int copy = 0; copy < 2; copy++) {
+		for (int i = 0; i < 15; i++) {
+			int x, y;
+			getFormatBitPosition(i, copy, qrsize, &x, &y);
+			gridSetModule(grid, x, y, getBit(bits, i));
+		}
+	}
+	gridSetModule(grid, 8, qrsize - 8, true);  // Always dark
+}
+
+
+// The 15 format bits (with their own error correction code) for every error correction level and mask.
+struct FormatBitsTable {
+	int bits[4][8];
+};
+
+static constexpr struct FormatBitsTable makeFormatBitsTable() {
+	struct FormatBitsTable result = {};
+	const int table[] = {1, 0, 3, 2};
+	for (int ecl = 0; ecl < 4; ecl++) {
+		for (int mask = 0; mask < 8; mask++) {
+			// Calculate error correction code and pack bits
+			int data = table[ecl] << 3 | mask;  // errCorrLvl is uint2, mask is uint3
+			int rem = data;
+			for (int i = 0; i < 10; i++)
+				rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+			result.bits[ecl][mask] = (data << 10 | rem) ^ 0x5412;  // uint15
+		}
+	}
+	return result;
+}
+
+static constexpr struct FormatBitsTable FORMAT_BITS = makeFormatBitsTable();
+
+
+// Returns the 15 format bits (with their own error correction code) for the given error correction level and mask.
+static int getFormatBits(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask) {
+	assert(0 <= (int)ecl && (int)ecl <= 3 && 0 <= (int)mask && (int)mask <= 7);
+	return FORMAT_BITS.bits[(int)ecl][(int)mask];
 }
 
 
-// Sets every module in the range [left : left + width] * [top : top + height] to dark.
-static void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]) {
-	for (int dy = 0; dy < height; dy++) {
-		for (int dx = 0; dx < width; dx++)
-			setModuleBounded(qrcode, left + dx, top + dy, true);
+// Stores the coordinates of format bit i (in the range [0, 15)) of the given copy (0 or 1).
+// The first copy wraps around the top left finder, and the second is split between the other two.
+static void getFormatBitPosition(int i, int copy, int qrsize, int *x, int *y) {
+	assert(0 <= i && i < 15);
+	if (copy == 0) {
+		if (i <= 5)
+			*x = 8, *y = i;
+		else if (i <= 7)
+			*x = 8, *y = i + 1;  // Skips the timing pattern
+		else if (i == 8)
+			*x = 7, *y = 8;
+		else
+			*x = 14 - i, *y = 8;
+	} else {
+		if (i < 8)
+			*x = qrsize - 1 - i, *y = 8;
+		else
+			*x = 8, *y = qrsize - 15 + i;
 	}
 }
 
@@ -575,31 +1210,199 @@ static void fillRectangle(int left, int top, int width, int height, uint8_t qrco
 
 /*---- Drawing data modules and masking ----*/
 
-// Draws the raw codewords (including data and ECC) onto the given QR Code. This requires the initial state of
-// the QR Code to be dark at function modules and light at codeword modules (including unused remainder bits).
-static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
-	int qrsize = qrcodegen_getSize(qrcode);
+// Calls drawCodewordsSized() for the width of the grid.
+static void drawCodewords(const uint8_t data[], int dataLen, const struct BitGrid *functionModules, struct BitGrid *grid) {
+	getGridKernels(grid->size)->drawCodewords(data, dataLen, functionModules, grid);
+}
+
+
+// Draws the raw codewords (including data and ECC) onto the given grid, at the modules that are not function
+// modules. This requires the initial state of the grid to be light at codeword modules (including unused remainder bits).
+// The zigzag scan fills the column pairs from right to left, alternately upward and downward, taking the right
+// module of each row before the left one. Rather than walking it a module at a time, every column pair is split
+// into runs of rows that have the same free modules, found from the columns of the function modules. Each run then
+// takes the data bits a word at a time, with alternate bits going to each column where both are free.
+// The columns are built as the rows of a transposed grid, which is finally transposed onto the given grid.
+template <int Words>
+static void drawCodewordsSized(const uint8_t data[], int dataLen, const struct BitGrid *functionModules, struct BitGrid *grid) {
+	int qrsize = grid->size;
+	assert((qrsize + 63) / 64 == Words);
+	uint64_t edge[Words];  // Keeps the padding past the bottom edge clear
+	getRowEdgeMask<Words>(qrsize, edge);
+	
+	struct BitGrid columns;  // Row x holds column x of the codeword modules
+	columns.size = qrsize;
+	memset(columns.rows, 0, (size_t)qrsize * sizeof(columns.rows[0]));
 	int i = 0;  // Bit index into the data
-	// Do the funny zigzag scan
 	for (int right = qrsize - 1; right >= 1; right -= 2) {  // Index of right column in each column pair
 		if (right == 6)
 			right = 5;
+		bool upward = ((right + 1) & 2) == 0;
+		
+		// The function modules are symmetric about the main diagonal, so their row x is also their column x.
+		// Bit p of these lines is the module at position p along the scan of this column pair.
+		uint64_t freeRight[Words], freeLeft[Words], changes[Words];
+		for (int w = 0; w < Words; w++) {
+			freeRight[w] = ~functionModules->rows[right    ][w] & edge[w];
+			freeLeft [w] = ~functionModules->rows[right - 1][w] & edge[w];
+		}
+		if (upward) {
+			reverseLine<Words>(freeRight, qrsize);
+			reverseLine<Words>(freeLeft, qrsize);
+		}
+		for (int w = 0; w < Words; w++) {  // Bit p is set iff the free modules differ at p and p + 1
+			uint64_t nextRight = w + 1 < Words ? freeRight[w + 1] : 0;
+			uint64_t nextLeft  = w + 1 < Words ? freeLeft [w + 1] : 0;
+			changes[w] = (freeRight[w] ^ (freeRight[w] >> 1 | nextRight << 63))
+			           | (freeLeft [w] ^ (freeLeft [w] >> 1 | nextLeft  << 63));
+		}
+		
+		uint64_t placedRight[Words] = {0}, placedLeft[Words] = {0};
+		for (int start = 0, end; start < qrsize; start = end) {
+			end = findNextSetBit<Words>(changes, start, qrsize) + 1;
+			bool isRightFree = ((freeRight[start >> 6] >> (start & 63)) & 1) != 0;
+			bool isLeftFree  = ((freeLeft [start >> 6] >> (start & 63)) & 1) != 0;
+			if (isRightFree && isLeftFree) {
+				for (int p = start; p < end; p += 28) {
+					int n = end - p < 28 ? end - p : 28;
+					uint64_t bits = readDataBits(data, dataLen, i, n * 2);
+					depositBits<Words>(placedRight, p, gatherEvenBits(bits));
+					depositBits<Words>(placedLeft , p, gatherEvenBits(bits >> 1));
+					i += n * 2;
+				}
+			} else if (isRightFree || isLeftFree) {
+				for (int p = start; p < end; p += 56) {
+					int n = end - p < 56 ? end - p : 56;
+					depositBits<Words>(isRightFree ? placedRight : placedLeft, p, readDataBits(data, dataLen, i, n));
+					i += n;
+				}
+			}
+		}
+		
+		if (upward) {
+			reverseLine<Words>(placedRight, qrsize);
+			reverseLine<Words>(placedLeft, qrsize);
+		}
+		memcpy(columns.rows[right    ], placedRight, sizeof(placedRight));
+		memcpy(columns.rows[right - 1], placedLeft , sizeof(placedLeft ));
+	}
+	// If this QR Code has any remainder bits (0 to 7), they were read as 0/false/light past the end of the data
+	assert(dataLen * 8 <= i && i < dataLen * 8 + 8);
+	
+	struct BitGrid codewords;
+	gridTranspose(&columns, &codewords);
+	for (int y = 0; y < qrsize; y++) {
+		for (int w = 0; w < Words; w++)
+			grid->rows[y][w] |= codewords.rows[y][w];
+	}
+}
+
+
+// Stores the index y * qrsize + x of every codeword module (x, y) in result, in the order of the zigzag scan of
+// drawCodewords() but one module at a time, and returns their number, which is getNumRawDataModules() of the version.
+static int listCodewordModules(const struct BitGrid *functionModules, int result[]) {
+	int qrsize = functionModules->size;
+	int count = 0;
+	for (int right = qrsize - 1; right >= 1; right -= 2) {  // Index of right column in each column pair
+		if (right == 6)
+			right = 5;
+		bool upward = ((right + 1) & 2) == 0;
 		for (int vert = 0; vert < qrsize; vert++) {  // Vertical counter
 			for (int j = 0; j < 2; j++) {
 				int x = right - j;  // Actual x coordinate
-				bool upward = ((right + 1) & 2) == 0;
 				int y = upward ? qrsize - 1 - vert : vert;  // Actual y coordinate
-				if (!getModuleBounded(qrcode, x, y) && i < dataLen * 8) {
-					bool dark = getBit(data[i >> 3], 7 - (i & 7));
-					setModuleBounded(qrcode, x, y, dark);
-					i++;
+				if (((functionModules->rows[y][x >> 6] >> (x & 63)) & 1) == 0) {
+					result[count] = y * qrsize + x;
+					count++;
 				}
-				// If this QR Code has any remainder bits (0 to 7), they were assigned as
-				// 0/false/light by the constructor and are left unchanged by this method
 			}
 		}
 	}
-	assert(i == dataLen * 8);
+	assert(count == getNumRawDataModules((qrsize - 17) / 4));
+	return count;
+}
+
+
+// Returns data bits [start : start + count] (which may run past the end of the data, where they
+// read as 0) as an integer whose bit k is data bit start + k. Requires 0 <= count <= 56.
+static uint64_t readDataBits(const uint8_t data[], int dataLen, int start, int count) {
+	assert(0 <= count && count <= 56);
+	uint64_t word = 0;  // Big-endian, so the bits are in data order from the top bit down
+	for (int j = 0, index = start >> 3; j < 8; j++, index++)
+		word = word << 8 | (index < dataLen ? data[index] : 0);
+	word <<= start & 7;
+	return reverseBits64(word) & (((uint64_t)1 << count) - 1);
+}
+
+
+// Sets the bits of the modules [0 : qrsize] in a line of the given number of words, and clears the padding after them.
+template <int Words>
+static void getRowEdgeMask(int qrsize, uint64_t edge[Words]) {
+	for (int w = 0; w < Words; w++) {
+		int width = qrsize - w * 64;
+		edge[w] = width >= 64 ? ~(uint64_t)0 : width > 0 ? ((uint64_t)1 << width) - 1 : 0;
+	}
+}
+
+
+// ORs the given bits (at most 64 of them) into the given line, starting at module p.
+template <int Words>
+static void depositBits(uint64_t line[Words], int p, uint64_t bits) {
+	int shift = p & 63;
+	line[p >> 6] |= bits << shift;
+	if (shift != 0 && (p >> 6) + 1 < Words)
+		line[(p >> 6) + 1] |= bits >> (64 - shift);
+}
+
+
+// Returns the even-indexed bits of x (bits 0, 2, 4, ..., 62) packed into the low 32 bits.
+static uint64_t gatherEvenBits(uint64_t x) {
+	x &= UINT64_C(0x5555555555555555);
+	x = (x | x >> 1) & UINT64_C(0x3333333333333333);
+	x = (x | x >> 2) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	x = (x | x >> 4) & UINT64_C(0x00FF00FF00FF00FF);
+	x = (x | x >> 8) & UINT64_C(0x0000FFFF0000FFFF);
+	return (x | x >> 16) & UINT64_C(0x00000000FFFFFFFF);
+}
+
+
+// Returns the index of the lowest set bit at or after position 'from' in the given line, or qrsize - 1 if there
+// is none before that. Thus a run that reaches the end of a line ends at qrsize - 1 like any other run.
+template <int Words>
+static int findNextSetBit(const uint64_t line[Words], int from, int qrsize) {
+	for (int w = from >> 6; w < Words; w++) {
+		uint64_t word = line[w];
+		if (w == from >> 6)
+			word &= ~(uint64_t)0 << (from & 63);
+		if (word != 0) {
+			int result = w * 64 + countTrailingZeros64(word);
+			return result < qrsize - 1 ? result : qrsize - 1;
+		}
+	}
+	return qrsize - 1;
+}
+
+
+// Reverses the order of the modules [0 : qrsize] of the given line in place, keeping the padding clear.
+template <int Words>
+static void reverseLine(uint64_t line[Words], int qrsize) {
+	uint64_t reversed[Words];
+	for (int w = 0; w < Words; w++)
+		reversed[w] = reverseBits64(line[Words - 1 - w]);
+	// Bit b of reversed is module Words * 64 - 1 - b, so shift down by the width of the padding
+	int shift = Words * 64 - qrsize;
+	for (int w = 0; w < Words; w++) {
+		int src = w + (shift >> 6);
+		uint64_t lo = src < Words ? reversed[src] : 0;
+		uint64_t hi = src + 1 < Words ? reversed[src + 1] : 0;
+		line[w] = (shift & 63) == 0 ? lo : lo >> (shift & 63) | hi << (64 - (shift & 63));
+	}
+}
+
+
+// Calls applyMaskSized() for the width of the grid.
+static void applyMask(const struct BitGrid *functionModules, struct BitGrid *grid, enum qrcodegen_Mask mask) {
+	getGridKernels(grid->size)->applyMask(functionModules, grid, mask);
 }
 
 
@@ -608,143 +1411,372 @@ static void drawCodewords(const uint8_t data[], int dataLen, uint8_t qrcode[]) {
 // before masking. Due to the arithmetic of XOR, calling applyMask() with
 // the same mask value a second time will undo the mask. A final well-formed
 // QR Code needs exactly one (not zero, two, etc.) mask applied.
-static void applyMask(const uint8_t functionModules[], uint8_t qrcode[], enum qrcodegen_Mask mask) {
+template <int Words>
+static void applyMaskSized(const struct BitGrid *functionModules, struct BitGrid *grid, enum qrcodegen_Mask mask) {
 	assert(0 <= (int)mask && (int)mask <= 7);  // Disallows qrcodegen_Mask_AUTO
-	int qrsize = qrcodegen_getSize(qrcode);
+	int qrsize = grid->size;
+	assert((qrsize + 63) / 64 == Words);
+	uint64_t edge[Words];  // Keeps the padding past the right edge clear
+	getRowEdgeMask<Words>(qrsize, edge);
 	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModuleBounded(functionModules, x, y))
-				continue;
-			bool invert;
-			switch ((int)mask) {
-				case 0:  invert = (x + y) % 2 == 0;                    break;
-				case 1:  invert = y % 2 == 0;                          break;
-				case 2:  invert = x % 3 == 0;                          break;
-				case 3:  invert = (x + y) % 3 == 0;                    break;
-				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
-				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
-				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
-				case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
-				default:  assert(false);  return;
-			}
-			bool val = getModuleBounded(qrcode, x, y);
-			setModuleBounded(qrcode, x, y, val ^ invert);
-		}
+		const uint64_t *pattern = MASK_PATTERNS.rows[(int)mask][y % MASK_PATTERN_ROWS];
+		for (int w = 0; w < Words; w++)
+			grid->rows[y][w] ^= pattern[w] & ~functionModules->rows[y][w] & edge[w];
 	}
 }
 
 
-// Calculates and returns the penalty score based on state of the given QR Code's current modules.
-// This is used by the automatic mask choice algorithm to find the mask pattern that yields the lowest score.
-static long getPenaltyScore(const uint8_t qrcode[]) {
-	int qrsize = qrcodegen_getSize(qrcode);
-	long result = 0;
+// The format bits lie in rows (and columns) 0 to 8 and qrsize - 8 to qrsize - 1. A FormatOverlay
+// indexes these 17 lines with formatLineIndex(), which returns -1 for every other line.
+#define FORMAT_LINES 17
+
+// The format modules of a grid, and their values for each of the 8 masks (at a fixed error correction level),
+// both as rows and as rows of the transposed grid. A helper type for getMaskPenaltyScores().
+template <int Words>
+struct FormatOverlay {
+	uint64_t positions[FORMAT_LINES][Words];  // Symmetric, so the same for rows and columns
+	uint64_t rows[8][FORMAT_LINES][Words];
+	uint64_t columns[8][FORMAT_LINES][Words];
+};
+
+static int formatLineIndex(int i, int qrsize) {
+	return i <= 8 ? i : i >= qrsize - 8 ? i - (qrsize - 8) + 9 : -1;
+}
+
+
+// Calls getMaskPenaltyScoresSized() for the width of the grid.
+static void getMaskPenaltyScores(const struct BitGrid *grid, const struct BitGrid *functionModules,
+		enum qrcodegen_Ecc ecl, int firstMask, int endMask, bool estimate, struct LinePenalties *cache, long result[8]) {
+	getGridKernels(grid->size)->getMaskPenaltyScores(grid, functionModules, ecl, firstMask, endMask, estimate, cache, result);
+}
+
+
+// Calculates the penalty score that each mask in the range [firstMask, endMask) would give, storing it
+// in result[mask] and leaving the other elements untouched. The masks are not applied to the grid;
+// instead every row is masked on the fly for all these masks in a single sweep (and likewise every
+// column, from one transposed copy), with the format bits of each mask overlaid. This equals the
+// penalty of the grid after applyMask() and drawFormatBits() with that mask. If estimate is true,
+// the finder-like pattern rule is skipped and runs are scored with getRunPenaltyScore() instead,
+// which is much cheaper but only approximates the ranking of the masks. If cache is not NULL, only its
+// dirty lines are scored and stored in it, and the scores are summed from it; estimate must be false.
+// The grid must be unmasked, and the function modules must be symmetric about the main diagonal,
+// which they are in every QR Code, so that their rows also serve as their columns.
+template <int Words>
+static void getMaskPenaltyScoresSized(const struct BitGrid *grid, const struct BitGrid *functionModules,
+		enum qrcodegen_Ecc ecl, int firstMask, int endMask, bool estimate, struct LinePenalties *cache, long result[8]) {
+	assert(0 <= firstMask && firstMask <= endMask && endMask <= 8);
+	assert(cache == NULL || !estimate);
+	int qrsize = grid->size;
+	assert((qrsize + 63) / 64 == Words);
+	uint64_t edge[Words];  // Keeps the padding past the right edge clear
+	getRowEdgeMask<Words>(qrsize, edge);
+	
+	struct FormatOverlay<Words> format;
+	memset(&format, 0, sizeof(format));
+	for (int m = firstMask; m < endMask; m++) {
+		int bits = getFormatBits(ecl, (enum qrcodegen_Mask)m) | 1 << 15;  // Bit 15 is the always dark module
+		for (int copy = 0; copy < 2; copy++) {
+			for (int i = 0; i < 16; i++) {
+				int x = 8, y = qrsize - 8;
+				if (i < 15)
+					getFormatBitPosition(i, copy, qrsize, &x, &y);
+				int row = formatLineIndex(y, qrsize);
+				int column = formatLineIndex(x, qrsize);
+				format.positions[row][x >> 6] |= (uint64_t)1 << (x & 63);
+				if (getBit(bits, i)) {
+					format.rows[m][row][x >> 6] |= (uint64_t)1 << (x & 63);
+					format.columns[m][column][y >> 6] |= (uint64_t)1 << (y & 63);
+				}
+			}
+		}
+	}
 	
-	// Adjacent modules in row having same color, and finder-like patterns
+	// Rows: runs and finder-like patterns, 2*2 blocks, and dark modules. With a cache, a row is only
+	// masked if it or a neighbor is dirty, since the blocks of a dirty row extend into the row below.
+	int dark[8] = {0};
+	uint64_t previous[8][Words];
+	for (int m = firstMask; m < endMask; m++)
+		result[m] = 0;
+	const uint8_t *dirty = cache != NULL ? cache->dirtyRows : NULL;
 	for (int y = 0; y < qrsize; y++) {
-		bool runColor = false;
-		int runX = 0;
-		int runHistory[7] = {0};
-		for (int x = 0; x < qrsize; x++) {
-			if (getModuleBounded(qrcode, x, y) == runColor) {
-				runX++;
-				if (runX == 5)
-					result += PENALTY_N1;
-				else if (runX > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runX, runHistory, qrsize);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModuleBounded(qrcode, x, y);
-				runX = 1;
+		bool lineDirty = dirty == NULL || dirty[y];
+		bool blockDirty = y > 0 && (lineDirty || dirty[y - 1]);
+		if (!lineDirty && !blockDirty && !(y + 1 < qrsize && dirty[y + 1]))
+			continue;
+		int fmt = formatLineIndex(y, qrsize);
+		for (int m = firstMask; m < endMask; m++) {
+			const uint64_t *pattern = MASK_PATTERNS.rows[m][y % MASK_PATTERN_ROWS];
+			uint64_t line[Words];
+			for (int w = 0; w < Words; w++) {
+				line[w] = grid->rows[y][w] ^ (pattern[w] & ~functionModules->rows[y][w] & edge[w]);
+				if (fmt != -1)
+					line[w] = (line[w] & ~format.positions[fmt][w]) | format.rows[m][fmt][w];
+			}
+			if (lineDirty) {
+				long score = estimate ? getRunPenaltyScore<Words>(line, qrsize) : getLinePenaltyScore<Words>(line, qrsize);
+				int count = 0;
+				for (int w = 0; w < Words; w++)
+					count += popcount64(line[w]);
+				if (cache != NULL) {
+					cache->rows[m][y] = score;
+					cache->dark[m][y] = count;
+				} else {
+					result[m] += score;
+					dark[m] += count;
+				}
+			}
+			if (blockDirty) {
+				long score = getBlockPenaltyScore<Words>(previous[m], line, qrsize);
+				if (cache != NULL)
+					cache->blocks[m][y] = score;
+				else
+					result[m] += score;
 			}
+			memcpy(previous[m], line, sizeof(line));
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runX, runHistory, qrsize) * PENALTY_N3;
 	}
-	// Adjacent modules in column having same color, and finder-like patterns
+	
+	// Columns: runs and finder-like patterns
+	struct BitGrid columns;
+	gridTranspose(grid, &columns);
+	dirty = cache != NULL ? cache->dirtyColumns : NULL;
 	for (int x = 0; x < qrsize; x++) {
-		bool runColor = false;
-		int runY = 0;
-		int runHistory[7] = {0};
-		for (int y = 0; y < qrsize; y++) {
-			if (getModuleBounded(qrcode, x, y) == runColor) {
-				runY++;
-				if (runY == 5)
-					result += PENALTY_N1;
-				else if (runY > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runY, runHistory, qrsize);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory, qrsize) * PENALTY_N3;
-				runColor = getModuleBounded(qrcode, x, y);
-				runY = 1;
+		if (dirty != NULL && !dirty[x])
+			continue;
+		int fmt = formatLineIndex(x, qrsize);
+		for (int m = firstMask; m < endMask; m++) {
+			const uint64_t *pattern = MASK_PATTERNS.columns[m][x % MASK_PATTERN_ROWS];
+			uint64_t line[Words];
+			for (int w = 0; w < Words; w++) {
+				line[w] = columns.rows[x][w] ^ (pattern[w] & ~functionModules->rows[x][w] & edge[w]);
+				if (fmt != -1)
+					line[w] = (line[w] & ~format.positions[fmt][w]) | format.columns[m][fmt][w];
 			}
+			long score = estimate ? getRunPenaltyScore<Words>(line, qrsize) : getLinePenaltyScore<Words>(line, qrsize);
+			if (cache != NULL)
+				cache->columns[m][x] = score;
+			else
+				result[m] += score;
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runY, runHistory, qrsize) * PENALTY_N3;
 	}
 	
-	// 2*2 blocks of modules having same color
-	for (int y = 0; y < qrsize - 1; y++) {
-		for (int x = 0; x < qrsize - 1; x++) {
-			bool  color = getModuleBounded(qrcode, x, y);
-			if (  color == getModuleBounded(qrcode, x + 1, y) &&
-			      color == getModuleBounded(qrcode, x, y + 1) &&
-			      color == getModuleBounded(qrcode, x + 1, y + 1))
-				result += PENALTY_N2;
+	for (int m = firstMask; m < endMask; m++) {
+		if (cache != NULL) {
+			for (int i = 0; i < qrsize; i++) {
+				result[m] += cache->rows[m][i] + cache->columns[m][i] + (i > 0 ? cache->blocks[m][i] : 0);
+				dark[m] += cache->dark[m][i];
+			}
 		}
+		result[m] += getBalancePenaltyScore(dark[m], qrsize);
+		assert(0 <= result[m] && result[m] <= 2568888L);  // Non-tight upper bound based on default values of PENALTY_N1, ..., N4
+	}
+}
+
+
+// Calculates the same penalty scores as getMaskPenaltyScores() for all 8 masks, but splits the masks into
+// contiguous groups that are scored on separate threads, each of which reads the shared grids and keeps
+// its own masked lines and transposed copy. Below PARALLEL_MASK_MIN_VERSION the cost of starting threads
+// outweighs the work, so small grids are scored serially, as they are without thread support. Each thread
+// only writes the scores of its own masks in the cache, if there is one.
+static void getMaskPenaltyScoresParallel(const struct BitGrid *grid, const struct BitGrid *functionModules,
+		enum qrcodegen_Ecc ecl, struct LinePenalties *cache, long result[8]) {
+#ifndef QRCODEGEN_NO_THREADS
+	int numWorkers = (int)std::thread::hardware_concurrency();
+	if (numWorkers > 8)
+		numWorkers = 8;
+	if (numWorkers >= 2 && (grid->size - 17) / 4 >= PARALLEL_MASK_MIN_VERSION) {
+		std::thread threads[8];
+		int started = 1;
+		try {
+			for (; started < numWorkers; started++) {
+				threads[started] = std::thread(getMaskPenaltyScores, grid, functionModules,
+					ecl, started * 8 / numWorkers, (started + 1) * 8 / numWorkers, false, cache, result);
+			}
+		} catch (...) {}  // If a thread can't be started, its masks are scored below instead
+		getMaskPenaltyScores(grid, functionModules, ecl, 0, 8 / numWorkers, false, cache, result);
+		if (started < numWorkers)
+			getMaskPenaltyScores(grid, functionModules, ecl, started * 8 / numWorkers, 8, false, cache, result);
+		for (int i = 1; i < started; i++)
+			threads[i].join();
+		return;
+	}
+#endif
+	getMaskPenaltyScores(grid, functionModules, ecl, 0, 8, false, cache, result);
+}
+
+
+// Returns the mask with the lowest penalty score among those that could be scored exactly before the deadline.
+// The masks are tried in order of their estimated scores, so the first one (which is always scored, even past
+// the deadline) is the choice of qrcodegen_Mask_AUTO_FAST. If every mask is scored, the result is the same
+// as that of qrcodegen_Mask_AUTO, including the tie-break toward the lowest index.
+static enum qrcodegen_Mask chooseMaskByDeadline(const struct BitGrid *grid, const struct BitGrid *functionModules,
+		enum qrcodegen_Ecc ecl, std::chrono::steady_clock::time_point deadline) {
+	long estimates[8];
+	getMaskPenaltyScores(grid, functionModules, ecl, 0, 8, true, NULL, estimates);
+	int order[8];
+	for (int i = 0; i < 8; i++) {  // Stable insertion sort, so equal estimates keep index order
+		int j = i;
+		for (; j > 0 && estimates[order[j - 1]] > estimates[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
 	}
 	
-	// Balance of dark and light modules
-	int dark = 0;
-	for (int y = 0; y < qrsize; y++) {
-		for (int x = 0; x < qrsize; x++) {
-			if (getModuleBounded(qrcode, x, y))
-				dark++;
+	int best = order[0];
+	long minPenalty = LONG_MAX;
+	for (int i = 0; i < 8 && (i == 0 || std::chrono::steady_clock::now() < deadline); i++) {
+		int m = order[i];
+		long penalties[8];
+		getMaskPenaltyScores(grid, functionModules, ecl, m, m + 1, false, NULL, penalties);
+		if (penalties[m] < minPenalty || (penalties[m] == minPenalty && m < best)) {
+			best = m;
+			minPenalty = penalties[m];
+		}
+	}
+	return (enum qrcodegen_Mask)best;
+}
+
+
+// Returns the penalty for runs of same-colored modules and finder-like patterns along one row of
+// a BitGrid (or one column, as a row of the transposed grid). Rather than visiting every module,
+// this collects the run lengths from the color changes, which are the set bits of the line XOR itself
+// shifted by one, and then applies both rules to the list of runs.
+template <int Words>
+static long getLinePenaltyScore(const uint64_t line[Words], int qrsize) {
+	// In a line of one word, if no dark run is 6 or longer, the only finder-like patterns are those with
+	// runs of 1, 1, 3, 1, 1, which are matched at every position at once, so the runs need not be listed
+	if (Words == 1) {
+		uint64_t pairs = line[0] & line[0] >> 1;
+		uint64_t fours = pairs & pairs >> 2;
+		if ((fours & pairs >> 4) == 0)
+			return getRunPenaltyScore<1>(line, qrsize) + countSmallFinderPatterns(line[0]) * PENALTY_N3;
+	}
+	
+	// runs[0] is light, as if preceded by the light border, so it is empty if the line starts dark.
+	// The colors alternate from there, so the light runs are exactly the even indexes.
+	int runs[Words * 64 + 2];
+	int numRuns = 0;
+	int runStart = 0;
+	for (int w = 0; w < Words; w++) {
+		uint64_t carry = w > 0 ? line[w - 1] >> 63 : 0;
+		uint64_t changes = line[w] ^ (line[w] << 1 | carry);
+		int width = qrsize - w * 64;
+		if (width < 64)
+			changes &= ((uint64_t)1 << width) - 1;
+		for (; changes != 0; changes &= changes - 1) {
+			int x = w * 64 + countTrailingZeros64(changes);
+			runs[numRuns] = x - runStart;
+			numRuns++;
+			runStart = x;
+		}
+	}
+	runs[numRuns] = qrsize - runStart;
+	numRuns++;
+	
+	// Adjacent modules having same color
+	long result = 0;
+	for (int i = 0; i < numRuns; i++) {
+		if (runs[i] >= 5)
+			result += PENALTY_N1 + (runs[i] - 5);
+	}
+	
+	// Finder-like patterns, checked at the end of every light run against the six runs before it.
+	// The light border of width qrsize extends the first and last light runs.
+	if (numRuns % 2 == 0) {  // Line ends dark, so the border is its own light run
+		runs[numRuns] = 0;
+		numRuns++;
+	}
+	runs[0] += qrsize;
+	runs[numRuns - 1] += qrsize;
+	for (int i = 6; i < numRuns; i += 2) {
+		int n = runs[i - 1];
+		assert(n <= qrsize * 3);
+		// The maximum QR Code size is 177, hence the dark run length n <= 177.
+		// Arithmetic is promoted to int, so n*4 will not overflow.
+		if (runs[i - 2] == n && runs[i - 3] == n * 3 && runs[i - 4] == n && runs[i - 5] == n) {
+			result += ((runs[i - 6] >= n * 4 && runs[i] >= n ? 1 : 0)
+			        +  (runs[i] >= n * 4 && runs[i - 6] >= n ? 1 : 0)) * PENALTY_N3;
 		}
 	}
-	int total = qrsize * qrsize;  // Note that size is odd, so dark/total != 1/2
-	// Compute the smallest integer k >= 0 such that (45-5k)% <= dark/total <= (55+5k)%
-	int k = (int)((labs(dark * 20L - total * 10L) + total - 1) / total) - 1;
-	assert(0 <= k && k <= 9);
-	result += k * PENALTY_N4;
-	assert(0 <= result && result <= 2568888L);  // Non-tight upper bound based on default values of PENALTY_N1, ..., N4
 	return result;
 }
 
 
-// Can only be called immediately after a light run is added, and
-// returns either 0, 1, or 2. A helper function for getPenaltyScore().
-static int finderPenaltyCountPatterns(const int runHistory[7], int qrsize) {
-	int n = runHistory[1];
-	assert(n <= qrsize * 3);  (void)qrsize;
-	bool core = n > 0 && runHistory[2] == n && runHistory[3] == n * 3 && runHistory[4] == n && runHistory[5] == n;
-	// The maximum QR Code size is 177, hence the dark run length n <= 177.
-	// Arithmetic is promoted to int, so n*4 will not overflow.
-	return (core && runHistory[0] >= n * 4 && runHistory[6] >= n ? 1 : 0)
-	     + (core && runHistory[6] >= n * 4 && runHistory[0] >= n ? 1 : 0);
+
+// Returns the penalty for runs of same-colored modules along one line, like the first part of
+// getLinePenaltyScore(), but without listing the runs. A run of length n >= 5 scores PENALTY_N1 + (n - 5),
+// which is the number of windows of 5 same-colored modules in it plus PENALTY_N1 - 1 for the run itself.
+// Bit x of 'same' is set iff modules x and x + 1 match, so a window starts at x iff same[x .. x + 3] are all set.
+template <int Words>
+static long getRunPenaltyScore(const uint64_t line[Words], int qrsize) {
+	uint64_t same[Words + 1] = {0};  // Zero-padded for reading the next word
+	for (int w = 0; w < Words; w++) {
+		uint64_t next = w + 1 < Words ? line[w + 1] : 0;
+		same[w] = ~(line[w] ^ (line[w] >> 1 | next << 63));
+		int width = qrsize - 1 - w * 64;  // Only x < qrsize - 1 has a next module
+		if (width < 64)
+			same[w] &= ((uint64_t)1 << width) - 1;
+	}
+	long windows = 0, runs = 0;
+	uint64_t previous = 0;  // Whether a window starts at the last module of the previous word
+	for (int w = 0; w < Words; w++) {
+		uint64_t s = same[w], t = same[w + 1];
+		uint64_t starts = s & (s >> 1 | t << 63) & (s >> 2 | t << 62) & (s >> 3 | t << 61);
+		windows += popcount64(starts);
+		runs += popcount64(starts & ~(starts << 1 | previous));
+		previous = starts >> 63;
+	}
+	return windows + runs * (PENALTY_N1 - 1);
+}
+
+
+// Returns the number of finder-like patterns with runs of 1, 1, 3, 1, 1 in the given line of one word, counted
+// like getLinePenaltyScore(): once for 4 light modules before the core and once for 4 after it. Bit p of core is
+// set iff the core starts at module p, namely modules p - 1 to p + 7 are light, dark, light, dark * 3, light, dark,
+// light. The padding past the right edge is already light, and the shifts fill in light modules at both ends.
+static int countSmallFinderPatterns(uint64_t line) {
+	uint64_t light = ~line;
+	uint64_t lightAfter[11], lightBefore[5];  // Bit p is set iff module p + k (or p - k) is light
+	for (int k = 1; k < 11; k++)
+		lightAfter[k] = light >> k | ~(~(uint64_t)0 >> k);
+	for (int k = 1; k < 5; k++)
+		lightBefore[k] = light << k | (((uint64_t)1 << k) - 1);
+	uint64_t core = line & lightAfter[1] & line >> 2 & line >> 3 & line >> 4 & lightAfter[5] & line >> 6
+		& lightAfter[7] & lightBefore[1];
+	uint64_t before = lightBefore[2] & lightBefore[3] & lightBefore[4];
+	uint64_t after = lightAfter[8] & lightAfter[9] & lightAfter[10];
+	return popcount64(core & before) + popcount64(core & after);
 }
 
 
-// Must be called at the end of a line (row or column) of modules. A helper function for getPenaltyScore().
-static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, int runHistory[7], int qrsize) {
-	if (currentRunColor) {  // Terminate dark run
-		finderPenaltyAddHistory(currentRunLength, runHistory, qrsize);
-		currentRunLength = 0;
+// Returns the penalty for 2*2 blocks of modules having same color, among those whose top halves lie in the
+// given row. Bit x of 'same' is set iff modules (x, y) and (x, y + 1) match, and bit x of 'across' is set iff
+// (x, y) and (x + 1, y) match, so a block starts at x iff same[x], same[x + 1] and across[x] are all set.
+template <int Words>
+static long getBlockPenaltyScore(const uint64_t top[Words], const uint64_t bottom[Words], int qrsize) {
+	long result = 0;
+	for (int w = 0; w < Words; w++) {
+		bool hasNext = w + 1 < Words;
+		uint64_t same = ~(top[w] ^ bottom[w]);
+		uint64_t sameNext = hasNext ? ~(top[w + 1] ^ bottom[w + 1]) : 0;
+		uint64_t topNext = hasNext ? top[w + 1] : 0;
+		uint64_t across = ~(top[w] ^ (top[w] >> 1 | topNext << 63));
+		uint64_t blocks = same & (same >> 1 | sameNext << 63) & across;
+		int width = qrsize - 1 - w * 64;  // Only x < qrsize - 1 can start a block
+		if (width < 64)
+			blocks &= ((uint64_t)1 << width) - 1;
+		result += popcount64(blocks) * PENALTY_N2;
 	}
-	currentRunLength += qrsize;  // Add light border to final run
-	finderPenaltyAddHistory(currentRunLength, runHistory, qrsize);
-	return finderPenaltyCountPatterns(runHistory, qrsize);
+	return result;
 }
 
 
-// Pushes the given value to the front and drops the last value. A helper function for getPenaltyScore().
-static void finderPenaltyAddHistory(int currentRunLength, int runHistory[7], int qrsize) {
-	if (runHistory[0] == 0)
-		currentRunLength += qrsize;  // Add light border to initial run
-	memmove(&runHistory[1], &runHistory[0], 6 * sizeof(runHistory[0]));
-	runHistory[0] = currentRunLength;
+// Returns the penalty for the balance of dark and light modules, given the number of dark modules.
+static long getBalancePenaltyScore(int dark, int qrsize) {
+	int total = qrsize * qrsize;  // Note that size is odd, so dark/total != 1/2
+	// Compute the smallest integer k >= 0 such that (45-5k)% <= dark/total <= (55+5k)%
+	int k = (int)((labs(dark * 20L - total * 10L) + total - 1) / total) - 1;
+	assert(0 <= k && k <= 9);
+	return k * PENALTY_N4;
 }
 
 
@@ -769,6 +1801,36 @@ bool qrcodegen_getModule(const uint8_t qrcode[], int x, int y) {
 }
 
 
+// Public function - see documentation comment in header file.
+enum qrcodegen_Mask qrcodegen_getMaskPenalties(const uint8_t qrcode[], long penalties[8]) {
+	assert(qrcode != NULL && penalties != NULL);
+	int qrsize = qrcode[0];
+	assert(21 <= qrsize && qrsize <= 177 && (qrsize - 17) % 4 == 0);
+	int version = (qrsize - 17) / 4;
+	
+	// Read the first copy of the format bits, which this library always draws without errors
+	int bits = 0;
+	for (int i = 0; i < 15; i++) {
+		int x, y;
+		getFormatBitPosition(i, 0, qrsize, &x, &y);
+		bits |= (int)getModuleBounded(qrcode, x, y) << i;
+	}
+	int data = (bits ^ 0x5412) >> 10;
+	static const enum qrcodegen_Ecc table[] = {  // Inverse of the table in getFormatBits()
+		qrcodegen_Ecc_MEDIUM, qrcodegen_Ecc_LOW, qrcodegen_Ecc_HIGH, qrcodegen_Ecc_QUARTILE};
+	enum qrcodegen_Ecc ecl = table[data >> 3];
+	enum qrcodegen_Mask mask = (enum qrcodegen_Mask)(data & 7);
+	
+	// Undo the mask, then score every mask against the unmasked modules
+	struct BitGrid grid, functionModules;
+	getFunctionTemplate(version, &functionModules, NULL);
+	gridFromQrcode(qrcode, &grid);
+	applyMask(&functionModules, &grid, mask);
+	getMaskPenaltyScores(&grid, &functionModules, ecl, 0, 8, false, NULL, penalties);
+	return mask;
+}
+
+
 // Returns the color of the module at the given coordinates, which must be in bounds.
 testable bool getModuleBounded(const uint8_t qrcode[], int x, int y) {
 	int qrsize = qrcode[0];
@@ -778,31 +1840,154 @@ testable bool getModuleBounded(const uint8_t qrcode[], int x, int y) {
 }
 
 
+// Returns true iff the i'th bit of x is set to 1. Requires x >= 0 and 0 <= i <= 14.
+static bool getBit(int x, int i) {
+	return ((x >> i) & 1) != 0;
+}
+
+
+
+/*---- Row-aligned grid ----*/
+
+// Returns the grid functions for the number of words that a row of the given size takes.
+static const struct GridKernels *getGridKernels(int qrsize) {
+	assert(21 <= qrsize && qrsize <= 177);
+	return &GRID_KERNELS[(qrsize + 63) / 64 - 1];
+}
+
+
+// Converts the given QR Code from the public packed bitstream format to the row-aligned format.
+testable void gridFromQrcode(const uint8_t qrcode[], struct BitGrid *grid) {
+	int qrsize = qrcodegen_getSize(qrcode);
+	grid->size = qrsize;
+	memset(grid->rows, 0, (size_t)qrsize * sizeof(grid->rows[0]));
+	const uint8_t *bytes = &qrcode[1];
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x += 64) {
+			int count = qrsize - x < 64 ? qrsize - x : 64;
+			int index = y * qrsize + x;  // Bit index of the first module into the bitstream
+			int shift = index & 7;
+			const uint8_t *src = &bytes[index >> 3];
+			int numBytes = (shift + count + 7) >> 3;  // Up to 9 bytes, never past the end of the bitstream
+			uint64_t word = 0;
+			for (int i = 0; i < numBytes && i < 8; i++)
+				word |= (uint64_t)src[i] << (i * 8);
+			word >>= shift;
+			if (numBytes > 8)
+				word |= (uint64_t)src[8] << (64 - shift);
+			if (count < 64)
+				word &= ((uint64_t)1 << count) - 1;
+			grid->rows[y][x >> 6] = word;
+		}
+	}
+}
+
+
+// Converts the given row-aligned grid back to the public packed bitstream format,
+// overwriting all of qrcode[0 : qrcodegen_BUFFER_LEN_FOR_VERSION(version)].
+testable void gridToQrcode(const struct BitGrid *grid, uint8_t qrcode[]) {
+	int qrsize = grid->size;
+	assert(21 <= qrsize && qrsize <= 177);
+	memset(qrcode, 0, (size_t)((qrsize * qrsize + 7) / 8 + 1) * sizeof(qrcode[0]));
+	qrcode[0] = (uint8_t)qrsize;
+	uint8_t *bytes = &qrcode[1];
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x += 64) {
+			int count = qrsize - x < 64 ? qrsize - x : 64;
+			int index = y * qrsize + x;
+			int shift = index & 7;
+			uint8_t *dest = &bytes[index >> 3];
+			uint64_t word = grid->rows[y][x >> 6];
+			// The first byte may already hold modules of the previous word, so merge instead of storing
+			*dest++ |= (uint8_t)(word << shift);
+			word >>= 8 - shift;
+			for (int remain = count - (8 - shift); remain > 0; remain -= 8, word >>= 8)
+				*dest++ = (uint8_t)word;
+		}
+	}
+}
+
+
 // Sets the color of the module at the given coordinates, which must be in bounds.
-testable void setModuleBounded(uint8_t qrcode[], int x, int y, bool isDark) {
-	int qrsize = qrcode[0];
-	assert(21 <= qrsize && qrsize <= 177 && 0 <= x && x < qrsize && 0 <= y && y < qrsize);
-	int index = y * qrsize + x;
-	int bitIndex = index & 7;
-	int byteIndex = (index >> 3) + 1;
+static void gridSetModule(struct BitGrid *grid, int x, int y, bool isDark) {
+	assert(0 <= x && x < grid->size && 0 <= y && y < grid->size);
+	uint64_t bit = (uint64_t)1 << (x & 63);
 	if (isDark)
-		qrcode[byteIndex] |= 1 << bitIndex;
+		grid->rows[y][x >> 6] |= bit;
 	else
-		qrcode[byteIndex] &= (1 << bitIndex) ^ 0xFF;
+		grid->rows[y][x >> 6] &= ~bit;
 }
 
 
-// Sets the color of the module at the given coordinates, doing nothing if out of bounds.
-testable void setModuleUnbounded(uint8_t qrcode[], int x, int y, bool isDark) {
-	int qrsize = qrcode[0];
-	if (0 <= x && x < qrsize && 0 <= y && y < qrsize)
-		setModuleBounded(qrcode, x, y, isDark);
+
+// Stores the transpose of the given grid into result, so that columns can be scanned as rows.
+testable void gridTranspose(const struct BitGrid *grid, struct BitGrid *result) {
+	int qrsize = grid->size;
+	result->size = qrsize;
+	memset(result->rows, 0, (size_t)qrsize * sizeof(result->rows[0]));
+	// Transpose each 64*64 block, moving block (i, j) to (j, i)
+	for (int i = 0; i * 64 < qrsize; i++) {
+		for (int j = 0; j * 64 < qrsize; j++) {
+			uint64_t block[64];
+			for (int k = 0; k < 64; k++)
+				block[k] = i * 64 + k < qrsize ? grid->rows[i * 64 + k][j] : 0;
+			transposeBlock64(block);
+			for (int k = 0; k < 64 && j * 64 + k < qrsize; k++)
+				result->rows[j * 64 + k][i] = block[k];
+		}
+	}
 }
 
 
-// Returns true iff the i'th bit of x is set to 1. Requires x >= 0 and 0 <= i <= 14.
-static bool getBit(int x, int i) {
-	return ((x >> i) & 1) != 0;
+// Transposes the given 64*64 bit matrix in place, where bit c of block[r] is the entry at row r and
+// column c. Swaps the off-diagonal quadrants of every 32*32, then 16*16, ..., 2*2 submatrix.
+static void transposeBlock64(uint64_t block[64]) {
+	uint64_t mask = UINT64_C(0x00000000FFFFFFFF);  // The low half of each group of 2j columns
+	for (int j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+		for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+			uint64_t swap = ((block[k] >> j) ^ block[k | j]) & mask;
+			block[k] ^= swap << j;
+			block[k | j] ^= swap;
+		}
+	}
+}
+
+
+// Returns the number of set bits in the given word.
+static int popcount64(uint64_t x) {
+#if defined(__GNUC__)
+	return __builtin_popcountll(x);
+#else
+	x -= (x >> 1) & UINT64_C(0x5555555555555555);
+	x = (x & UINT64_C(0x3333333333333333)) + ((x >> 2) & UINT64_C(0x3333333333333333));
+	x = (x + (x >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	return (int)((x * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+
+// Returns the given word with the order of its 64 bits reversed.
+static uint64_t reverseBits64(uint64_t x) {
+	x = (x >> 1 & UINT64_C(0x5555555555555555)) | (x & UINT64_C(0x5555555555555555)) << 1;
+	x = (x >> 2 & UINT64_C(0x3333333333333333)) | (x & UINT64_C(0x3333333333333333)) << 2;
+	x = (x >> 4 & UINT64_C(0x0F0F0F0F0F0F0F0F)) | (x & UINT64_C(0x0F0F0F0F0F0F0F0F)) << 4;
+	x = (x >> 8 & UINT64_C(0x00FF00FF00FF00FF)) | (x & UINT64_C(0x00FF00FF00FF00FF)) << 8;
+	x = (x >> 16 & UINT64_C(0x0000FFFF0000FFFF)) | (x & UINT64_C(0x0000FFFF0000FFFF)) << 16;
+	return x >> 32 | x << 32;
+}
+
+
+// Returns the index of the lowest set bit of the given word, which must be nonzero.
+static int countTrailingZeros64(uint64_t x) {
+	assert(x != 0);
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int result = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		result++;
+	return result;
+#endif
 }
 
 
@@ -811,23 +1996,113 @@ static bool getBit(int x, int i) {
 
 // Public function - see documentation comment in header file.
 bool qrcodegen_isNumeric(const char *text) {
+	return qrcodegen_getTextMode(text, NULL) == qrcodegen_Mode_NUMERIC;
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_isAlphanumeric(const char *text) {
+	return qrcodegen_getTextMode(text, NULL) != qrcodegen_Mode_BYTE;
+}
+
+
+// Public function - see documentation comment in header file.
+bool qrcodegen_isKanji(const char *text) {
 	assert(text != NULL);
-	for (; *text != '\0'; text++) {
-		if (*text < '0' || *text > '9')
+	while (*text != '\0') {
+		int kanjiValue;
+		text += decodeTextChar(text, &kanjiValue);
+		if (kanjiValue == -1)
 			return false;
 	}
 	return true;
 }
 
 
+#ifdef QRCODEGEN_X86_DISPATCH
+
+// The vector kernels of getTextMode() classify the first len bytes of the text, a whole vector at a time while
+// one fits, so nothing past the end of the text is read. Each returns the index of the first byte that is not in
+// the alphanumeric set, or else the number of bytes it checked, which leaves a tail of fewer than one vector for
+// the caller. It clears *numeric if a byte before that index is not a digit.
+// Signed comparisons reject the bytes from 0x80 up, which are negative, so each character range takes two comparisons.
+__attribute__((target("avx2")))
+static size_t scanTextAvx2(const char *text, size_t len, bool *numeric) {
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		__m256i c = _mm256_loadu_si256((const __m256i *)&text[i]);
+		__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+		__m256i other = _mm256_or_si256(
+			_mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c)),
+			_mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('-' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(':' + 1), c)));  // -./0-9:
+		other = _mm256_or_si256(other, _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')));
+		other = _mm256_or_si256(other, _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('$' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('%' + 1), c)));
+		other = _mm256_or_si256(other, _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('*' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('+' + 1), c)));
+		uint64_t notDigit = ~(uint64_t)(uint32_t)_mm256_movemask_epi8(digit) & UINT32_MAX;
+		uint64_t notOther = ~(uint64_t)(uint32_t)_mm256_movemask_epi8(other) & UINT32_MAX;
+		if (notOther != 0) {
+			if ((notDigit & ((notOther & (~notOther + 1)) - 1)) != 0)  // A non-digit before the first byte-mode byte
+				*numeric = false;
+			return i + (size_t)countTrailingZeros64(notOther);
+		}
+		if (notDigit != 0)
+			*numeric = false;
+	}
+	return i;
+}
+
+
+// Same as scanTextAvx2(), but 16 bytes per vector.
+__attribute__((target("sse2")))
+static size_t scanTextSse2(const char *text, size_t len, bool *numeric) {
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)&text[i]);
+		__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+		__m128i other = _mm_or_si128(
+			_mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1))),
+			_mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('-' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(':' + 1))));  // -./0-9:
+		other = _mm_or_si128(other, _mm_cmpeq_epi8(c, _mm_set1_epi8(' ')));
+		other = _mm_or_si128(other, _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('$' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('%' + 1))));
+		other = _mm_or_si128(other, _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('*' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('+' + 1))));
+		uint64_t notDigit = ~(uint64_t)(uint32_t)_mm_movemask_epi8(digit) & 0xFFFF;
+		uint64_t notOther = ~(uint64_t)(uint32_t)_mm_movemask_epi8(other) & 0xFFFF;
+		if (notOther != 0) {
+			if ((notDigit & ((notOther & (~notOther + 1)) - 1)) != 0)
+				*numeric = false;
+			return i + (size_t)countTrailingZeros64(notOther);
+		}
+		if (notDigit != 0)
+			*numeric = false;
+	}
+	return i;
+}
+
+#endif
+
+
 // Public function - see documentation comment in header file.
-bool qrcodegen_isAlphanumeric(const char *text) {
+enum qrcodegen_Mode qrcodegen_getTextMode(const char *text, size_t *textLen) {
 	assert(text != NULL);
-	for (; *text != '\0'; text++) {
-		if (strchr(ALPHANUMERIC_CHARSET, *text) == NULL)
-			return false;
+	size_t len = strlen(text);
+	if (textLen != NULL)
+		*textLen = len;
+	bool numeric = true;
+	size_t i = 0;
+#ifdef QRCODEGEN_X86_DISPATCH
+	if (__builtin_cpu_supports("avx2"))
+		i = scanTextAvx2(text, len, &numeric);
+	else if (__builtin_cpu_supports("sse2"))
+		i = scanTextSse2(text, len, &numeric);
+#endif
+	for (; i < len; i++) {
+		if ('0' <= text[i] && text[i] <= '9')
+			continue;
+		if (ALPHANUMERIC_VALUES.values[(uint8_t)text[i]] < 0)
+			return qrcodegen_Mode_BYTE;
+		numeric = false;
 	}
-	return true;
+	return numeric ? qrcodegen_Mode_NUMERIC : qrcodegen_Mode_ALPHANUMERIC;
 }
 
 
@@ -896,29 +2171,9 @@ struct qrcodegen_Segment qrcodegen_makeNumeric(const char *digits, uint8_t buf[]
 	struct qrcodegen_Segment result;
 	size_t len = strlen(digits);
 	result.mode = qrcodegen_Mode_NUMERIC;
-	int bitLen = calcSegmentBitLength(result.mode, len);
-	assert(bitLen != LENGTH_OVERFLOW);
+	assert(calcSegmentBitLength(result.mode, len) != LENGTH_OVERFLOW);
 	result.numChars = (int)len;
-	if (bitLen > 0)
-		memset(buf, 0, ((size_t)bitLen + 7) / 8 * sizeof(buf[0]));
-	result.bitLength = 0;
-	
-	unsigned int accumData = 0;
-	int accumCount = 0;
-	for (; *digits != '\0'; digits++) {
-		char c = *digits;
-		assert('0' <= c && c <= '9');
-		accumData = accumData * 10 + (unsigned int)(c - '0');
-		accumCount++;
-		if (accumCount == 3) {
-			appendBitsToBuffer(accumData, 10, buf, &result.bitLength);
-			accumData = 0;
-			accumCount = 0;
-		}
-	}
-	if (accumCount > 0)  // 1 or 2 digits remaining
-		appendBitsToBuffer(accumData, accumCount * 3 + 1, buf, &result.bitLength);
-	assert(result.bitLength == bitLen);
+	result.bitLength = packNumeric(digits, len, buf);
 	result.data = buf;
 	return result;
 }
@@ -930,31 +2185,225 @@ struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t bu
 	struct qrcodegen_Segment result;
 	size_t len = strlen(text);
 	result.mode = qrcodegen_Mode_ALPHANUMERIC;
-	int bitLen = calcSegmentBitLength(result.mode, len);
-	assert(bitLen != LENGTH_OVERFLOW);
+	assert(calcSegmentBitLength(result.mode, len) != LENGTH_OVERFLOW);
 	result.numChars = (int)len;
-	if (bitLen > 0)
-		memset(buf, 0, ((size_t)bitLen + 7) / 8 * sizeof(buf[0]));
-	result.bitLength = 0;
-	
-	unsigned int accumData = 0;
-	int accumCount = 0;
-	for (; *text != '\0'; text++) {
-		const char *temp = strchr(ALPHANUMERIC_CHARSET, *text);
-		assert(temp != NULL);
-		accumData = accumData * 45 + (unsigned int)(temp - ALPHANUMERIC_CHARSET);
-		accumCount++;
+	result.bitLength = packAlphanumeric(text, len, buf);
+	result.data = buf;
+	return result;
+}
+
+
+// Public function - see documentation comment in header file.
+struct qrcodegen_Segment qrcodegen_makeKanji(const char *text, uint8_t buf[]) {
+	assert(text != NULL);
+	struct qrcodegen_Segment result;
+	size_t numChars = 0;
+	for (const char *p = text; *p != '\0'; numChars++) {
+		int kanjiValue;
+		p += decodeTextChar(p, &kanjiValue);
+		assert(kanjiValue != -1);
+	}
+	result.mode = qrcodegen_Mode_KANJI;
+	assert(calcSegmentBitLength(result.mode, numChars) != LENGTH_OVERFLOW);
+	result.numChars = (int)numChars;
+	result.bitLength = packKanji(text, numChars, buf);
+	result.data = buf;
+	return result;
+}
+
+
+#ifdef QRCODEGEN_X86_DISPATCH
+
+// Packs the digits of the given string 12 at a time, while at least 16 remain so that every load stays
+// within the string, and returns the number of digits packed. A helper function for packNumeric().
+__attribute__((target("ssse3")))
+static size_t packNumericSsse3(const char *digits, size_t len, struct BitWriter *writer) {
+	// Spread each group of 3 digits over a 32-bit lane, then weight and sum the digits of each lane
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i weights = _mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0);
+	const __m128i merge = _mm_setr_epi16(1 << 10, 1, 1 << 10, 1, 1 << 10, 1, 1 << 10, 1);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 12) {
+		__m128i c = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)&digits[i]), _mm_set1_epi8('0'));
+		__m128i groups = _mm_madd_epi16(_mm_maddubs_epi16(_mm_shuffle_epi8(c, spread), weights), _mm_set1_epi16(1));
+		__m128i pairs = _mm_madd_epi16(_mm_packs_epi32(groups, groups), merge);  // Two 20-bit values
+		uint64_t bits = (uint64_t)(uint32_t)_mm_cvtsi128_si32(pairs) << 20
+			| (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(pairs, 4));
+		bitWriterAppend(writer, bits, 40);
+	}
+	return i;
+}
+
+
+// Packs the characters of the given string 16 at a time, while at least 16 remain,
+// and returns the number of characters packed. A helper function for packAlphanumeric().
+__attribute__((target("ssse3")))
+static size_t packAlphanumericSsse3(const char *text, size_t len, struct BitWriter *writer) {
+	// The values of space $ % * + - . / indexed by the low nibble of the character
+	const __m128i symbols = _mm_setr_epi8(36, 0, 0, 0, 37, 38, 0, 0, 0, 0, 39, 40, 0, 41, 42, 43);
+	const __m128i weights = _mm_setr_epi8(45, 1, 45, 1, 45, 1, 45, 1, 45, 1, 45, 1, 45, 1, 45, 1);
+	const __m128i merge = _mm_setr_epi16(1 << 11, 1, 1 << 11, 1, 1 << 11, 1, 1 << 11, 1);
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i c = _mm_loadu_si128((const __m128i *)&text[i]);
+		__m128i val = _mm_sub_epi8(c, _mm_set1_epi8('0'));  // Digits
+		val = _mm_sub_epi8(val, _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_set1_epi8('A' - '0' - 10)));  // Letters
+		__m128i isSymbol = _mm_cmplt_epi8(c, _mm_set1_epi8('0'));
+		val = _mm_or_si128(_mm_andnot_si128(isSymbol, val), _mm_and_si128(isSymbol, _mm_shuffle_epi8(symbols, c)));
+		__m128i isColon = _mm_cmpeq_epi8(c, _mm_set1_epi8(':'));
+		val = _mm_or_si128(_mm_andnot_si128(isColon, val), _mm_and_si128(isColon, _mm_set1_epi8(44)));
+		__m128i quads = _mm_madd_epi16(_mm_maddubs_epi16(val, weights), merge);  // Four 22-bit values
+		uint64_t hi = (uint64_t)(uint32_t)_mm_cvtsi128_si32(quads) << 22 | (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(quads, 4));
+		uint64_t lo = (uint64_t)(uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(quads, 8)) << 22 | (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(quads, 12));
+		bitWriterAppend(writer, hi, 44);
+		bitWriterAppend(writer, lo, 44);
+	}
+	return i;
+}
+
+#endif
+
+
+// Writes the numeric mode data bits of the given digits to the given buffer and returns the
+// number of bits, which is calcSegmentBitLength(qrcodegen_Mode_NUMERIC, len). Each group of
+// 3 digits becomes 10 bits, and the groups are appended 5 at a time or 4 at a time with vectors.
+static int packNumeric(const char *digits, size_t len, uint8_t buf[]) {
+	struct BitWriter writer = {buf, 0, 0};
+	size_t i = 0;
+#ifdef QRCODEGEN_X86_DISPATCH
+	if (__builtin_cpu_supports("ssse3"))
+		i = packNumericSsse3(digits, len, &writer);
+#endif
+	for (; i + 15 <= len; i += 15) {
+		uint64_t bits = 0;
+		for (int j = 0; j < 15; j += 3) {
+			const char *d = &digits[i + j];
+			assert('0' <= d[0] && d[0] <= '9' && '0' <= d[1] && d[1] <= '9' && '0' <= d[2] && d[2] <= '9');
+			bits = bits << 10 | (uint64_t)((d[0] - '0') * 100 + (d[1] - '0') * 10 + (d[2] - '0'));
+		}
+		bitWriterAppend(&writer, bits, 50);
+	}
+	unsigned int accumData = 0;
+	int accumCount = 0;
+	for (; i < len; i++) {
+		char c = digits[i];
+		assert('0' <= c && c <= '9');
+		accumData = accumData * 10 + (unsigned int)(c - '0');
+		accumCount++;
+		if (accumCount == 3) {
+			bitWriterAppend(&writer, accumData, 10);
+			accumData = 0;
+			accumCount = 0;
+		}
+	}
+	if (accumCount > 0)  // 1 or 2 digits remaining
+		bitWriterAppend(&writer, accumData, accumCount * 3 + 1);
+	assert(writer.bitLen == calcSegmentBitLength(qrcodegen_Mode_NUMERIC, len));
+	return writer.bitLen;
+}
+
+
+// Writes the alphanumeric mode data bits of the given text to the given buffer and returns the
+// number of bits, which is calcSegmentBitLength(qrcodegen_Mode_ALPHANUMERIC, len). Each pair of
+// characters becomes 11 bits, and the pairs are appended 5 at a time or 8 at a time with vectors.
+static int packAlphanumeric(const char *text, size_t len, uint8_t buf[]) {
+	struct BitWriter writer = {buf, 0, 0};
+	size_t i = 0;
+#ifdef QRCODEGEN_X86_DISPATCH
+	if (__builtin_cpu_supports("ssse3"))
+		i = packAlphanumericSsse3(text, len, &writer);
+#endif
+	for (; i + 10 <= len; i += 10) {
+		uint64_t bits = 0;
+		for (int j = 0; j < 10; j += 2) {
+			int first = ALPHANUMERIC_VALUES.values[(uint8_t)text[i + j]];
+			int second = ALPHANUMERIC_VALUES.values[(uint8_t)text[i + j + 1]];
+			assert(first >= 0 && second >= 0);
+			bits = bits << 11 | (uint64_t)(first * 45 + second);
+		}
+		bitWriterAppend(&writer, bits, 55);
+	}
+	unsigned int accumData = 0;
+	int accumCount = 0;
+	for (; i < len; i++) {
+		int val = ALPHANUMERIC_VALUES.values[(uint8_t)text[i]];
+		assert(val >= 0);
+		accumData = accumData * 45 + (unsigned int)val;
+		accumCount++;
 		if (accumCount == 2) {
-			appendBitsToBuffer(accumData, 11, buf, &result.bitLength);
+			bitWriterAppend(&writer, accumData, 11);
 			accumData = 0;
 			accumCount = 0;
 		}
 	}
 	if (accumCount > 0)  // 1 character remaining
-		appendBitsToBuffer(accumData, 6, buf, &result.bitLength);
-	assert(result.bitLength == bitLen);
-	result.data = buf;
-	return result;
+		bitWriterAppend(&writer, accumData, 6);
+	assert(writer.bitLen == calcSegmentBitLength(qrcodegen_Mode_ALPHANUMERIC, len));
+	return writer.bitLen;
+}
+
+
+// Writes the kanji mode data bits of the first numChars characters of the given UTF-8 text to the
+// given buffer and returns the number of bits, which is 13 per character. Every character must be
+// encodable in kanji mode.
+static int packKanji(const char *text, size_t numChars, uint8_t buf[]) {
+	struct BitWriter writer = {buf, 0, 0};
+	for (size_t i = 0; i < numChars; i++) {
+		int kanjiValue;
+		text += decodeTextChar(text, &kanjiValue);
+		assert(0 <= kanjiValue && kanjiValue < (1 << 13));
+		bitWriterAppend(&writer, (uint64_t)kanjiValue, 13);
+	}
+	return writer.bitLen;
+}
+
+
+// Decodes the UTF-8 character at the start of the given non-empty string and returns its length in bytes.
+// A byte that does not start a valid encoded character counts as a character of length 1. Also sets
+// *kanjiValue to the character's kanji mode value, or -1 if kanji mode cannot encode it.
+static int decodeTextChar(const char *text, int *kanjiValue) {
+	const uint8_t *p = (const uint8_t *)text;
+	*kanjiValue = -1;
+	int len;
+	long codePoint;
+	if (0xC2 <= p[0] && p[0] <= 0xDF) {
+		len = 2;
+		codePoint = p[0] & 0x1F;
+	} else if (0xE0 <= p[0] && p[0] <= 0xEF) {
+		len = 3;
+		codePoint = p[0] & 0x0F;
+	} else if (0xF0 <= p[0] && p[0] <= 0xF4) {
+		len = 4;
+		codePoint = p[0] & 0x07;
+	} else  // ASCII, or not the start of a character
+		return 1;
+	for (int i = 1; i < len; i++) {
+		if ((p[i] & 0xC0) != 0x80)  // Also stops at the terminator
+			return 1;
+		codePoint = codePoint << 6 | (p[i] & 0x3F);
+	}
+	if ((len == 3 && (codePoint < 0x800 || (0xD800 <= codePoint && codePoint <= 0xDFFF)))
+			|| (len == 4 && (codePoint < 0x10000 || codePoint > 0x10FFFF)))
+		return 1;  // Overlong encoding or invalid code point
+	*kanjiValue = getKanjiValue(codePoint);
+	return len;
+}
+
+
+// Returns the kanji mode value of the given Unicode code point, or -1 if kanji mode cannot encode it.
+static int getKanjiValue(long codePoint) {
+	int low = 0;
+	int high = KANJI_CHARS_COUNT;
+	while (low < high) {  // Binary search in KANJI_CODE_POINTS[low : high]
+		int mid = (low + high) / 2;
+		if (KANJI_CODE_POINTS[mid] < codePoint)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < KANJI_CHARS_COUNT && KANJI_CODE_POINTS[low] == codePoint)
+		return KANJI_VALUES[low];
+	return -1;
 }
 
 
@@ -985,6 +2434,149 @@ struct qrcodegen_Segment qrcodegen_makeEci(long assignVal, uint8_t buf[]) {
 }
 
 
+// Public function - see documentation comment in header file.
+int qrcodegen_makeSegmentsOptimally(const char *text, enum qrcodegen_Ecc ecl, int minVersion, int maxVersion,
+		struct qrcodegen_Segment segs[], size_t maxSegs, uint8_t buf[]) {
+	assert(text != NULL && (segs != NULL || maxSegs == 0));
+	assert(qrcodegen_VERSION_MIN <= minVersion && minVersion <= maxVersion && maxVersion <= qrcodegen_VERSION_MAX);
+	assert(0 <= (int)ecl && (int)ecl <= 3);
+	if (*text == '\0')
+		return 0;
+	
+	// Find the optimal split for each width of the character count fields in
+	// turn, like qrcodegen_getMinVersion(), until one fits in its versions
+	uint8_t choices[OPTIMAL_SEGMENTS_CHARS_MAX];
+	static const int rangeEnds[] = {9, 26, qrcodegen_VERSION_MAX};
+	int version = 0;
+	int numChars = 0;
+	int totalBits = LENGTH_OVERFLOW;
+	for (int i = 0, low = minVersion; i < 3 && low <= maxVersion && version == 0; i++) {
+		int high = rangeEnds[i] < maxVersion ? rangeEnds[i] : maxVersion;
+		if (low > high)
+			continue;
+		totalBits = computeCharacterModes(text, low, getDataCapacityBits(high, ecl), choices, &numChars);
+		if (totalBits != LENGTH_OVERFLOW) {
+			while (low < high) {  // Binary search for the first version that fits
+				int mid = (low + high) / 2;
+				if (totalBits <= getDataCapacityBits(mid, ecl))
+					high = mid;
+				else
+					low = mid + 1;
+			}
+			version = low;
+		}
+		low = high + 1;
+	}
+	if (version == 0)
+		return -1;
+	
+	// Make a segment of each run of characters in the same mode
+	size_t numSegs = 0;
+	const char *p = text;
+	for (int i = 0; i < numChars; numSegs++) {
+		if (numSegs == maxSegs)
+			return -1;
+		int mode = choices[i];
+		const char *start = p;
+		size_t runChars = 0;
+		for (; i < numChars && choices[i] == mode; i++, runChars++) {
+			int kanjiValue;
+			p += decodeTextChar(p, &kanjiValue);
+		}
+		size_t runBytes = (size_t)(p - start);
+		struct qrcodegen_Segment *seg = &segs[numSegs];
+		seg->mode = SEGMENT_MODES[mode];
+		seg->numChars = (int)(seg->mode == qrcodegen_Mode_KANJI ? runChars : runBytes);
+		if (seg->mode == qrcodegen_Mode_NUMERIC)
+			seg->bitLength = packNumeric(start, runBytes, buf);
+		else if (seg->mode == qrcodegen_Mode_ALPHANUMERIC)
+			seg->bitLength = packAlphanumeric(start, runBytes, buf);
+		else if (seg->mode == qrcodegen_Mode_KANJI)
+			seg->bitLength = packKanji(start, runChars, buf);
+		else {
+			memcpy(buf, start, runBytes * sizeof(buf[0]));
+			seg->bitLength = (int)runBytes * 8;
+		}
+		seg->data = buf;
+		buf += ((size_t)seg->bitLength + 7) / 8;
+	}
+	assert(getTotalBits(segs, numSegs, version) == totalBits);
+	return (int)numSegs;
+}
+
+
+// Finds the split of the given non-empty UTF-8 text into segments that takes the fewest bits, with the
+// character count fields of the given version, by dynamic programming over the characters. State j is
+// "the encoding of the text so far ends in a segment of mode SEGMENT_MODES[j]", and costs are in sixths of
+// a bit, so that the 10/3 and 11/2 bits per character of numeric and alphanumeric mode are exact. If the
+// text fits in maxBits, this sets *numChars, sets each choices[i] to the index of the mode of character i,
+// and returns the total bit length. Otherwise it returns LENGTH_OVERFLOW as early as possible.
+static int computeCharacterModes(const char *text, int version, int maxBits, uint8_t choices[], int *numChars) {
+	int headCosts[4];  // The mode indicator and character count field of each mode
+	for (int j = 0; j < 4; j++)
+		headCosts[j] = (4 + numCharCountBits(SEGMENT_MODES[j], version)) * 6;
+	int costs[4];
+	memcpy(costs, headCosts, sizeof(costs));
+	
+	// Bits 2j and 2j+1 of choices[i] are the mode of character i in the cheapest encoding that ends in state j
+	int n = 0;
+	for (const char *p = text; *p != '\0'; n++) {
+		if (n == OPTIMAL_SEGMENTS_CHARS_MAX)
+			return LENGTH_OVERFLOW;
+		int kanjiValue;
+		int charBytes = decodeTextChar(p, &kanjiValue);
+		int alphanumeric = charBytes == 1 ? ALPHANUMERIC_VALUES.values[(uint8_t)*p] : -1;
+		p += charBytes;
+		
+		// Append the character to a segment of each mode that can encode it
+		const int impossible = INT_MAX;
+		int charCosts[4];
+		charCosts[0] = 0 <= alphanumeric && alphanumeric < 10 ? costs[0] + 20 : impossible;
+		charCosts[1] = alphanumeric >= 0 ? costs[1] + 33 : impossible;
+		charCosts[2] = costs[2] + charBytes * 48;
+		charCosts[3] = kanjiValue >= 0 ? costs[3] + 78 : impossible;
+		
+		// Then either continue in each mode, or end the segment (rounding up to a whole bit) and start one of that mode
+		uint8_t choice = 0;
+		int minCost = impossible;
+		for (int j = 0; j < 4; j++) {
+			int best = charCosts[j];
+			int bestMode = j;
+			for (int k = 0; k < 4; k++) {
+				if (k == j || charCosts[k] == impossible)
+					continue;
+				int cost = (charCosts[k] + 5) / 6 * 6 + headCosts[j];
+				if (cost < best) {
+					best = cost;
+					bestMode = k;
+				}
+			}
+			costs[j] = best;  // Always possible, since byte mode can encode every character
+			choice |= (uint8_t)(bestMode << (j * 2));
+			if (best < minCost)
+				minCost = best;
+		}
+		choices[n] = choice;
+		if (minCost > maxBits * 6)
+			return LENGTH_OVERFLOW;
+	}
+	
+	// Trace the cheapest final state back to the mode of every character
+	int state = 0;
+	for (int j = 1; j < 4; j++) {
+		if (costs[j] < costs[state])
+			state = j;
+	}
+	int totalBits = (costs[state] + 5) / 6;
+	for (int i = n - 1; i >= 0; i--) {
+		state = choices[i] >> (state * 2) & 3;
+		choices[i] = (uint8_t)state;
+	}
+	*numChars = n;
+	return totalBits;
+}
+
+
 // Calculates the number of bits needed to encode the given segments at the given version.
 // Returns a non-negative number if successful. Otherwise returns LENGTH_OVERFLOW if a segment
 // has too many characters to fit its length field, or the total bits exceeds INT16_MAX.
@@ -1025,4 +2617,1282 @@ static int numCharCountBits(enum qrcodegen_Mode mode, int version) {
 }
 
 
+/*---- Reusable encoder for C++ ----*/
+
+namespace qrcodegen {
+
+// The scratch space and last QR Code of an Encoder. The byte buffers are aligned to
+// cache lines, which the C++14 operator new does not do, hence the custom allocation.
+struct EncoderWorkspace {
+	struct EncoderState state;
+	bool valid;  // Whether state.grid holds a complete QR Code
+	alignas(64) uint8_t dataCodewords[qrcodegen_BUFFER_LEN_MAX];
+	alignas(64) uint8_t allCodewords[qrcodegen_BUFFER_LEN_MAX];
+	alignas(64) uint8_t segmentData[qrcodegen_BUFFER_LEN_MAX];
+	struct qrcodegen_Segment segments[ENCODER_SEGMENTS_MAX];
+	
+	// Starts with no function modules loaded and no QR Code made
+	EncoderWorkspace() {
+		state.templateVersion = 0;
+		valid = false;
+	}
+	
+	static void *operator new(size_t size) {
+		void *block = malloc(size + 64);
+		if (block == NULL)
+			throw std::bad_alloc();
+		uintptr_t result = ((uintptr_t)block + 64) & ~(uintptr_t)63;
+		((void **)result)[-1] = block;  // At least 8 bytes of padding precede the result
+		return (void *)result;
+	}
+	
+	static void operator delete(void *ptr) {
+		if (ptr != NULL)
+			free(((void **)ptr)[-1]);
+	}
+};
+
+
+static bool makeTextSegments(const char *text, const EncodeOptions &options,
+	struct qrcodegen_Segment segs[ENCODER_SEGMENTS_MAX], uint8_t segmentData[qrcodegen_BUFFER_LEN_MAX], size_t *numSegs);
+
+
+Encoder::Encoder() : workspace(new EncoderWorkspace) {}
+
+
+Encoder::~Encoder() = default;
+Encoder::Encoder(Encoder &&other) noexcept = default;
+Encoder &Encoder::operator=(Encoder &&other) noexcept = default;
+
+
+// Records whether the last encoding with the given workspace succeeded, and returns the view of its QR Code.
+// Shared by all the encoders that build their QR Codes in an EncoderWorkspace.
+QrCodeView QrCodeView::finish(EncoderWorkspace *ws, bool ok) {
+	ws->valid = ok;
+	return QrCodeView(ok ? ws : nullptr);
+}
+
+
+QrCodeView Encoder::encode(const char *text, const EncodeOptions &options) {
+	assert(text != NULL);
+	EncoderWorkspace *ws = workspace.get();
+	size_t numSegs;
+	if (!makeTextSegments(text, options, ws->segments, ws->segmentData, &numSegs))
+		return QrCodeView::finish(ws, false);
+	return encodeSegments(ws->segments, numSegs, options);
+}
+
+
+// Makes the segments of the given text like Encoder::encode(), with options.optimalSegments or else like
+// qrcodegen_encodeText() but without copying byte mode text. Returns false if they would not fit in the buffers.
+static bool makeTextSegments(const char *text, const EncodeOptions &options,
+		struct qrcodegen_Segment segs[ENCODER_SEGMENTS_MAX], uint8_t segmentData[qrcodegen_BUFFER_LEN_MAX], size_t *numSegs) {
+	if (options.optimalSegments) {
+		int count = qrcodegen_makeSegmentsOptimally(text, options.ecl, options.minVersion, options.maxVersion,
+			segs, ENCODER_SEGMENTS_MAX, segmentData);
+		*numSegs = count >= 0 ? (size_t)count : 0;
+		return count >= 0;
+	}
+	return makeTextSegment(text, segmentData, qrcodegen_BUFFER_LEN_MAX, false, segs, numSegs);
+}
+
+
+QrCodeView Encoder::encodeBinary(const uint8_t data[], size_t dataLen, const EncodeOptions &options) {
+	assert(data != NULL || dataLen == 0);
+	struct qrcodegen_Segment seg;
+	seg.mode = qrcodegen_Mode_BYTE;
+	seg.bitLength = calcSegmentBitLength(seg.mode, dataLen);
+	if (seg.bitLength == LENGTH_OVERFLOW)
+		return QrCodeView::finish(workspace.get(), false);
+	seg.numChars = (int)dataLen;
+	seg.data = const_cast<uint8_t *>(data);  // Only read
+	return encodeSegments(&seg, 1, options);
+}
+
+
+QrCodeView Encoder::encodeSegments(const struct qrcodegen_Segment segs[], size_t len, const EncodeOptions &options) {
+	EncoderWorkspace *ws = workspace.get();
+	return QrCodeView::finish(ws, encodeSegmentsCore(segs, len, options.ecl, options.minVersion, options.maxVersion,
+		options.mask, options.boostEcl, options.budgetMicros, ws->dataCodewords, ws->allCodewords, &ws->state));
+}
+
+
+int QrCodeView::size() const {
+	assert(workspace != nullptr && workspace->valid);
+	return workspace->state.grid.size;
+}
+
+
+int QrCodeView::version() const {
+	return (size() - 17) / 4;
+}
+
+
+enum qrcodegen_Ecc QrCodeView::ecl() const {
+	assert(workspace != nullptr && workspace->valid);
+	return workspace->state.ecl;
+}
+
+
+enum qrcodegen_Mask QrCodeView::mask() const {
+	assert(workspace != nullptr && workspace->valid);
+	return workspace->state.mask;
+}
+
+
+bool QrCodeView::getModule(int x, int y) const {
+	int qrsize = size();
+	const struct BitGrid *grid = &workspace->state.grid;
+	return (0 <= x && x < qrsize && 0 <= y && y < qrsize) && ((grid->rows[y][x >> 6] >> (x & 63)) & 1) != 0;
+}
+
+
+void QrCodeView::copyTo(uint8_t qrcode[]) const {
+	assert(workspace != nullptr && workspace->valid && qrcode != NULL);
+	gridToQrcode(&workspace->state.grid, qrcode);
+}
+
+
+enum qrcodegen_Mask QrCodeView::getMaskPenalties(long penalties[8]) const {
+	assert(workspace != nullptr && workspace->valid && penalties != NULL);
+	const struct EncoderState *state = &workspace->state;
+	
+	// Undo the mask on a copy, then score every mask like qrcodegen_getMaskPenalties()
+	struct BitGrid grid;
+	grid.size = state->grid.size;
+	memcpy(grid.rows, state->grid.rows, (size_t)grid.size * sizeof(grid.rows[0]));
+	applyMask(&state->functionModules, &grid, state->mask);
+	getMaskPenaltyScores(&grid, &state->functionModules, state->ecl, 0, 8, false, NULL, penalties);
+	return state->mask;
+}
+
+}
+
+
+
+/*---- Bit-sliced batch encoder for C++ ----*/
+
+namespace qrcodegen {
+
+// A BatchEncoder encodes groups of up to this many QR Codes with the same version and error correction level.
+// In the bit-sliced words of a group, bit j belongs to the jth QR Code of the group, called lane j.
+#define BATCH_LANES 64
+
+// A bit-sliced group costs about as much as this many QR Codes encoded one at a time, so smaller groups are not sliced.
+#define BATCH_MIN_LANES 12
+
+// The number of bits of a bit-sliced counter, enough for every count of the penalty rules in a QR Code.
+#define SLICED_COUNTER_BITS 20
+
+// The light modules on either side of a bit-sliced line, enough for the light runs next to
+// the largest finder-like pattern that fits in a line (4 times a run of 177 / 7 modules).
+#define SLICED_LINE_PADDING 100
+
+// A text of a batch whose data codewords have been built.
+struct BatchJob {
+	size_t index;            // Of the text and its QR Code in the arguments of BatchEncoder::encode()
+	int version;
+	enum qrcodegen_Ecc ecl;  // After boosting
+	size_t dataOffset;       // Of its data codewords in BatchWorkspace::data
+};
+
+// The counts of the penalty rules for every lane of a group, as bit-sliced counters:
+// bit j of counter[k] is bit k of the count for lane j. See getSlicedPenaltyScores().
+struct SlicedPenaltyCounts {
+	uint64_t windows[SLICED_COUNTER_BITS];  // Windows of 5 same-colored modules along a row or column
+	uint64_t runs[SLICED_COUNTER_BITS];     // Runs of 5 or more same-colored modules
+	uint64_t blocks[SLICED_COUNTER_BITS];   // 2*2 blocks of same-colored modules
+	uint64_t finders[SLICED_COUNTER_BITS];  // Finder-like patterns, once for each side with 4n light modules
+	uint64_t dark[SLICED_COUNTER_BITS];     // Dark modules
+};
+
+// The scratch space of a BatchEncoder. The vectors keep their capacity between calls.
+// In the bit-sliced grids, modules[y * qrsize + x] holds module (x, y) of every lane.
+struct BatchWorkspace {
+	std::vector<struct BatchJob> jobs;
+	std::vector<uint8_t> data;           // The data codewords of all jobs, back to back
+	std::vector<uint64_t> codewords;     // Bit-sliced bytes, where codewords[k * 8 + b] is bit b (from the least
+	                                     // significant) of byte k; the data codewords and then the ECC of each block
+	std::vector<int> interleaved;        // The index in codewords of each byte of the interleaved sequence
+	std::vector<uint64_t> modules;       // Bit-sliced grid of the group before masking, with light format bits
+	std::vector<uint64_t> masked;        // Bit-sliced grid with masks and format bits drawn
+	
+	int layoutVersion;                   // The version of the following, or 0 if none yet
+	struct BitGrid functionModules;
+	struct BitGrid patterns;
+	std::vector<int> codewordModules;    // The index in modules of each codeword bit, in the order of the zigzag scan
+	
+	struct EncoderState state;           // For the groups that are too small to slice
+	uint8_t dataCodewords[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t allCodewords[qrcodegen_BUFFER_LEN_MAX];
+	uint8_t segmentData[qrcodegen_BUFFER_LEN_MAX];
+	struct qrcodegen_Segment segments[ENCODER_SEGMENTS_MAX];
+};
+
+
+static void encodeSlicedGroup(struct BatchWorkspace *ws, const struct BatchJob jobs[], int numJobs,
+	enum qrcodegen_Mask mask, uint8_t *const qrcodes[]);
+static void setSlicedLayout(struct BatchWorkspace *ws, int version);
+static void reedSolomonComputeSlicedRemainder(const uint64_t data[], int dataLen,
+	const uint8_t generator[], int degree, uint64_t result[]);
+static void drawSlicedMasks(const uint64_t modules[], const struct BitGrid *functionModules,
+	enum qrcodegen_Ecc ecl, const uint64_t lanes[8], uint64_t result[]);
+static void getSlicedPenaltyScores(const uint64_t grid[], int qrsize, bool estimate, long result[BATCH_LANES]);
+static void addSlicedLinePenalties(const uint64_t line[], int qrsize, bool estimate, struct SlicedPenaltyCounts *counts);
+static void slicedCounterAdd(uint64_t counter[SLICED_COUNTER_BITS], int k, uint64_t x);
+static void slicedCounterAddAll(uint64_t counter[SLICED_COUNTER_BITS], const uint64_t x[], int n);
+static long slicedCounterGet(const uint64_t counter[SLICED_COUNTER_BITS], int lane);
+
+
+BatchEncoder::BatchEncoder() : workspace(new BatchWorkspace) {
+	workspace->layoutVersion = 0;
+	workspace->state.templateVersion = 0;
+}
+
+
+BatchEncoder::~BatchEncoder() = default;
+BatchEncoder::BatchEncoder(BatchEncoder &&other) noexcept = default;
+BatchEncoder &BatchEncoder::operator=(BatchEncoder &&other) noexcept = default;
+
+
+size_t BatchEncoder::encode(const char *const texts[], size_t count, uint8_t *const qrcodes[], const EncodeOptions &options) {
+	assert((texts != NULL && qrcodes != NULL) || count == 0);
+	BatchWorkspace *ws = workspace.get();
+	
+	// Build the data codewords of every text one at a time, which also settles its version and error correction level
+	ws->jobs.clear();
+	ws->data.clear();
+	for (size_t i = 0; i < count; i++) {
+		assert(texts[i] != NULL && qrcodes[i] != NULL);
+		size_t numSegs;
+		bool ok = makeTextSegments(texts[i], options, ws->segments, ws->segmentData, &numSegs);
+		struct BatchJob job;
+		job.index = i;
+		job.ecl = options.ecl;
+		job.version = ok ? makeDataCodewords(ws->segments, numSegs, &job.ecl,
+			options.minVersion, options.maxVersion, options.boostEcl, ws->dataCodewords) : 0;
+		if (job.version == 0) {
+			qrcodes[i][0] = 0;  // Set size to invalid value for safety
+			continue;
+		}
+		job.dataOffset = ws->data.size();
+		ws->data.insert(ws->data.end(), ws->dataCodewords, ws->dataCodewords + getNumDataCodewords(job.version, job.ecl));
+		ws->jobs.push_back(job);
+	}
+	
+	// Encode the jobs in groups of the same version and error correction level, and the small groups one at a time
+	std::vector<struct BatchJob> &jobs = ws->jobs;
+	std::sort(jobs.begin(), jobs.end(), [](const BatchJob &a, const BatchJob &b) {
+		if (a.version != b.version)
+			return a.version < b.version;
+		if (a.ecl != b.ecl)
+			return a.ecl < b.ecl;
+		return a.index < b.index;
+	});
+	for (size_t start = 0, end; start < jobs.size(); start = end) {
+		for (end = start + 1; end < jobs.size() && end - start < BATCH_LANES; end++) {
+			if (jobs[end].version != jobs[start].version || jobs[end].ecl != jobs[start].ecl)
+				break;
+		}
+		if (end - start >= BATCH_MIN_LANES) {
+			encodeSlicedGroup(ws, &jobs[start], (int)(end - start), options.mask, qrcodes);
+			continue;
+		}
+		for (size_t i = start; i < end; i++) {
+			const struct BatchJob *job = &jobs[i];
+			memcpy(ws->dataCodewords, &ws->data[job->dataOffset], (size_t)getNumDataCodewords(job->version, job->ecl));
+			drawQrCode(ws->dataCodewords, job->version, job->ecl, options.mask, NULL, ws->allCodewords, &ws->state);
+			gridToQrcode(&ws->state.grid, qrcodes[job->index]);
+		}
+	}
+	return jobs.size();
+}
+
+
+// Encodes the given jobs, which all have the same version and error correction level, each in one lane of the
+// bit-sliced grid, and writes every QR Code into qrcodes[job.index]. Every step follows encodeSegmentsCore().
+static void encodeSlicedGroup(struct BatchWorkspace *ws, const struct BatchJob jobs[], int numJobs,
+		enum qrcodegen_Mask mask, uint8_t *const qrcodes[]) {
+	assert(1 <= numJobs && numJobs <= BATCH_LANES);
+	int version = jobs[0].version;
+	enum qrcodegen_Ecc ecl = jobs[0].ecl;
+	int qrsize = version * 4 + 17;
+	int numModules = qrsize * qrsize;
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)ecl][version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [(int)ecl][version];
+	int rawCodewords = getNumRawDataModules(version) / 8;
+	int dataLen = getNumDataCodewords(version, ecl);
+	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
+	int shortBlockDataLen = rawCodewords / numBlocks - blockEccLen;
+	if (ws->layoutVersion != version)
+		setSlicedLayout(ws, version);
+	
+	// Slice the data codewords, transposing 8 bytes of each job at a time into 64 words
+	ws->codewords.resize((size_t)rawCodewords * 8);
+	uint64_t *codewords = ws->codewords.data();
+	for (int k = 0; k < dataLen; k += 8) {
+		int n = dataLen - k < 8 ? dataLen - k : 8;
+		uint64_t block[64] = {0};
+		for (int j = 0; j < numJobs; j++) {
+			const uint8_t *dat = &ws->data[jobs[j].dataOffset + (size_t)k];
+			for (int t = 0; t < n; t++)
+				block[j] |= (uint64_t)dat[t] << (t * 8);
+		}
+		transposeBlock64(block);
+		memcpy(&codewords[k * 8], block, (size_t)n * 8 * sizeof(block[0]));
+	}
+	
+	// Calculate the ECC of every block, and the order in which the bytes are interleaved like in addEccAndInterleave()
+	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	reedSolomonComputeDivisor(blockEccLen, rsdiv);
+	ws->interleaved.resize((size_t)rawCodewords);
+	int *interleaved = ws->interleaved.data();
+	for (int i = 0, start = 0; i < numBlocks; i++) {
+		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
+		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {
+			if (j == shortBlockDataLen)
+				k -= numShortBlocks;
+			interleaved[k] = start + j;
+		}
+		int eccStart = dataLen + i * blockEccLen;
+		for (int j = 0, k = dataLen + i; j < blockEccLen; j++, k += numBlocks)
+			interleaved[k] = eccStart + j;
+		reedSolomonComputeSlicedRemainder(&codewords[start * 8], datLen, rsdiv, blockEccLen, &codewords[eccStart * 8]);
+		start += datLen;
+	}
+	
+	// Draw the function patterns, then the codeword bits along the zigzag scan, and light remainder bits
+	ws->modules.resize((size_t)numModules);
+	ws->masked.resize((size_t)numModules);
+	uint64_t *modules = ws->modules.data();
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x++)
+			modules[y * qrsize + x] = (uint64_t)0 - ((ws->patterns.rows[y][x >> 6] >> (x & 63)) & 1);
+	}
+	const int *codewordModules = ws->codewordModules.data();
+	for (int i = 0; i < rawCodewords * 8; i++)
+		modules[codewordModules[i]] = codewords[interleaved[i >> 3] * 8 + (7 - (i & 7))];
+	for (size_t i = (size_t)rawCodewords * 8; i < ws->codewordModules.size(); i++)
+		modules[codewordModules[i]] = 0;
+	
+	// Choose the mask of every lane, scoring each mask on all lanes at once
+	uint64_t used = numJobs < 64 ? ((uint64_t)1 << numJobs) - 1 : ~(uint64_t)0;
+	uint64_t lanes[8] = {0};  // The lanes that take each mask
+	if ((int)mask >= 0)
+		lanes[(int)mask] = used;
+	else {
+		long minPenalty[BATCH_LANES];
+		int choice[BATCH_LANES] = {0};
+		for (int m = 0; m < 8; m++) {
+			uint64_t only[8] = {0};
+			only[m] = used;
+			long penalties[BATCH_LANES];
+			drawSlicedMasks(modules, &ws->functionModules, ecl, only, ws->masked.data());
+			getSlicedPenaltyScores(ws->masked.data(), qrsize, mask == qrcodegen_Mask_AUTO_FAST, penalties);
+			for (int j = 0; j < numJobs; j++) {
+				if (m == 0 || penalties[j] < minPenalty[j]) {
+					minPenalty[j] = penalties[j];
+					choice[j] = m;
+				}
+			}
+		}
+		for (int j = 0; j < numJobs; j++)
+			lanes[choice[j]] |= (uint64_t)1 << j;
+	}
+	drawSlicedMasks(modules, &ws->functionModules, ecl, lanes, ws->masked.data());
+	
+	// Transpose the grid back into the packed format of each job, 64 modules at a time
+	const uint64_t *masked = ws->masked.data();
+	for (int base = 0; base < numModules; base += 64) {
+		int n = numModules - base < 64 ? numModules - base : 64;
+		uint64_t block[64] = {0};
+		memcpy(block, &masked[base], (size_t)n * sizeof(block[0]));
+		transposeBlock64(block);
+		int numBytes = (n + 7) / 8;
+		for (int j = 0; j < numJobs; j++) {
+			uint8_t *qrcode = qrcodes[jobs[j].index];
+			for (int t = 0; t < numBytes; t++)
+				qrcode[1 + base / 8 + t] = (uint8_t)(block[j] >> (t * 8));
+		}
+	}
+	for (int j = 0; j < numJobs; j++)
+		qrcodes[jobs[j].index][0] = (uint8_t)qrsize;
+}
+
+
+// Loads the function modules of the given version and lists its codeword modules in the order of the zigzag scan.
+static void setSlicedLayout(struct BatchWorkspace *ws, int version) {
+	getFunctionTemplate(version, &ws->functionModules, &ws->patterns);
+	ws->codewordModules.resize((size_t)getNumRawDataModules(version));
+	listCodewordModules(&ws->functionModules, ws->codewordModules.data());
+	ws->layoutVersion = version;
+}
+
+
+// Computes the Reed-Solomon remainders of bit-sliced blocks like reedSolomonComputeRemainder(), for all lanes at
+// once. data[i * 8 + b] is bit b of byte i of the data, and likewise for the result. Multiplying by a constant
+// is linear over GF(2), so the factor is multiplied by each power of x with a shift and the reduction by 0x11D,
+// and each generator coefficient picks out the sum of those powers that make it up.
+static void reedSolomonComputeSlicedRemainder(const uint64_t data[], int dataLen,
+		const uint8_t generator[], int degree, uint64_t result[]) {
+	assert(1 <= degree && degree <= qrcodegen_REED_SOLOMON_DEGREE_MAX);
+	memset(result, 0, (size_t)degree * 8 * sizeof(result[0]));
+	for (int i = 0; i < dataLen; i++) {  // Polynomial division
+		uint64_t factor[8][8];  // factor[e] is the factor times x^e
+		for (int b = 0; b < 8; b++)
+			factor[0][b] = data[i * 8 + b] ^ result[b];
+		for (int e = 1; e < 8; e++) {
+			const uint64_t *prev = factor[e - 1];
+			uint64_t top = prev[7];
+			factor[e][0] = top;
+			factor[e][1] = prev[0];
+			factor[e][2] = prev[1] ^ top;
+			factor[e][3] = prev[2] ^ top;
+			factor[e][4] = prev[3] ^ top;
+			factor[e][5] = prev[4];
+			factor[e][6] = prev[5];
+			factor[e][7] = prev[6];
+		}
+		memmove(&result[0], &result[8], (size_t)(degree - 1) * 8 * sizeof(result[0]));
+		memset(&result[(degree - 1) * 8], 0, 8 * sizeof(result[0]));
+		for (int j = 0; j < degree; j++) {
+			for (int e = 0; e < 8; e++) {
+				if (((generator[j] >> e) & 1) != 0) {
+					for (int b = 0; b < 8; b++)
+						result[j * 8 + b] ^= factor[e][b];
+				}
+			}
+		}
+	}
+}
+
+
+// Writes the given bit-sliced grid into result with the mask m applied in the lanes lanes[m], and the format bits
+// of that mask drawn, like applyMask() and drawFormatBits(). Masks without lanes are skipped, and lanes without a
+// mask are left unmasked.
+static void drawSlicedMasks(const uint64_t modules[], const struct BitGrid *functionModules,
+		enum qrcodegen_Ecc ecl, const uint64_t lanes[8], uint64_t result[]) {
+	int qrsize = functionModules->size;
+	memcpy(result, modules, (size_t)qrsize * qrsize * sizeof(result[0]));
+	for (int m = 0; m < 8; m++) {
+		if (lanes[m] == 0)
+			continue;
+		for (int y = 0; y < qrsize; y++) {
+			const uint64_t *pattern = MASK_PATTERNS.rows[m][y % MASK_PATTERN_ROWS];
+			for (int w = 0; w * 64 < qrsize; w++) {
+				uint64_t invert = pattern[w] & ~functionModules->rows[y][w];
+				int width = qrsize - w * 64;
+				if (width < 64)
+					invert &= ((uint64_t)1 << width) - 1;
+				for (; invert != 0; invert &= invert - 1)
+					result[y * qrsize + w * 64 + countTrailingZeros64(invert)] ^= lanes[m];
+			}
+		}
+		int bits = getFormatBits(ecl, (enum qrcodegen_Mask)m);
+		for (int copy = 0; copy < 2; copy++) {
+			for (int i = 0; i < 15; i++) {
+				int x, y;
+				getFormatBitPosition(i, copy, qrsize, &x, &y);
+				if (getBit(bits, i))
+					result[y * qrsize + x] |= lanes[m];
+			}
+		}
+	}
+	result[(qrsize - 8) * qrsize + 8] = ~(uint64_t)0;  // Always dark
+}
+
+
+// Calculates the penalty score of the QR Code in each lane of the given masked bit-sliced grid, like
+// getMaskPenaltyScores() with one mask. Each rule is checked at every position of every line for all
+// lanes at once, and its matches are added to a per-lane count, from which the scores are finally made.
+static void getSlicedPenaltyScores(const uint64_t grid[], int qrsize, bool estimate, long result[BATCH_LANES]) {
+	struct SlicedPenaltyCounts counts;
+	memset(&counts, 0, sizeof(counts));
+	uint64_t padded[SLICED_LINE_PADDING * 2 + qrcodegen_VERSION_MAX * 4 + 17] = {0};
+	uint64_t *line = &padded[SLICED_LINE_PADDING];
+	
+	// Rows: runs and finder-like patterns, 2*2 blocks, and dark modules
+	for (int y = 0; y < qrsize; y++) {
+		const uint64_t *row = &grid[y * qrsize];
+		memcpy(line, row, (size_t)qrsize * sizeof(line[0]));
+		addSlicedLinePenalties(line, qrsize, estimate, &counts);
+		if (y > 0) {
+			uint64_t blocks[qrcodegen_VERSION_MAX * 4 + 17];
+			for (int x = 0; x < qrsize - 1; x++) {
+				uint64_t color = row[x];
+				blocks[x] = ~((color ^ row[x + 1]) | (color ^ row[x - qrsize]) | (color ^ row[x + 1 - qrsize]));
+			}
+			slicedCounterAddAll(counts.blocks, blocks, qrsize - 1);
+		}
+		slicedCounterAddAll(counts.dark, row, qrsize);
+	}
+	
+	// Columns: runs and finder-like patterns
+	for (int x = 0; x < qrsize; x++) {
+		for (int y = 0; y < qrsize; y++)
+			line[y] = grid[y * qrsize + x];
+		addSlicedLinePenalties(line, qrsize, estimate, &counts);
+	}
+	
+	for (int j = 0; j < BATCH_LANES; j++) {
+		result[j] = slicedCounterGet(counts.windows, j)
+			+ slicedCounterGet(counts.runs, j) * (PENALTY_N1 - 1)
+			+ slicedCounterGet(counts.blocks, j) * PENALTY_N2
+			+ slicedCounterGet(counts.finders, j) * PENALTY_N3
+			+ getBalancePenaltyScore((int)slicedCounterGet(counts.dark, j), qrsize);
+	}
+}
+
+
+// Counts the runs and (unless estimate is true) the finder-like patterns of the given bit-sliced line in every lane,
+// like getLinePenaltyScore(). The SLICED_LINE_PADDING words on either side of the line must be zero, i.e. light.
+// Runs are counted as windows of 5 same-colored modules, like in getRunPenaltyScore(). A finder-like pattern with
+// runs of n, n, 3n, n, n modules is found from its center run, which starts at c: modules c to c + 3n - 1 are dark,
+// and c - 1 and c + 3n are light. The dark runs of 3n are found for n = 1, 2, ... by extending those of the last n,
+// which stops as soon as no lane has one. The rest of the pattern is only checked where some lane has such a run.
+static void addSlicedLinePenalties(const uint64_t line[], int qrsize, bool estimate, struct SlicedPenaltyCounts *counts) {
+	uint64_t windows[qrcodegen_VERSION_MAX * 4 + 17];  // The lanes where a window starts at module p
+	uint64_t runs[qrcodegen_VERSION_MAX * 4 + 17];     // The lanes where a run of 5 or more starts at module p
+	int numWindows = qrsize - 4;
+	for (int p = 0; p < numWindows; p++) {
+		uint64_t color = line[p];
+		windows[p] = ~((color ^ line[p + 1]) | (color ^ line[p + 2]) | (color ^ line[p + 3]) | (color ^ line[p + 4]));
+		runs[p] = windows[p] & ~(p > 0 ? windows[p - 1] : 0);
+	}
+	slicedCounterAddAll(counts->windows, windows, numWindows);
+	slicedCounterAddAll(counts->runs, runs, numWindows);
+	if (estimate)
+		return;
+	
+	// Patterns with n = 1 are common enough in some lane that the whole line is checked without branches
+	uint64_t finders[2][qrcodegen_VERSION_MAX * 4 + 17];  // With 4 light modules before and after the pattern
+	int numCenters = qrsize - 6;  // The center run starts at c = 2 to qrsize - 5
+	for (int i = 0; i < numCenters; i++) {
+		const uint64_t *center = &line[i + 2];
+		uint64_t core = center[-2] & ~center[-1] & center[0] & center[1] & center[2] & ~center[3] & center[4]
+			& ~center[-3] & ~center[5];
+		finders[0][i] = core & ~center[-4] & ~center[-5] & ~center[-6];
+		finders[1][i] = core & ~center[6] & ~center[7] & ~center[8];
+	}
+	slicedCounterAddAll(counts->finders, finders[0], numCenters);
+	slicedCounterAddAll(counts->finders, finders[1], numCenters);
+	
+	uint64_t triples[qrcodegen_VERSION_MAX * 4 + 17];   // Modules p to p + 2 are dark
+	uint64_t darkRuns[qrcodegen_VERSION_MAX * 4 + 17];  // Modules p to p + 3n - 1 are dark
+	for (int p = 0; p + 3 <= qrsize; p++) {
+		triples[p] = line[p] & line[p + 1] & line[p + 2];
+		darkRuns[p] = triples[p];
+	}
+	for (int n = 2; n * 7 <= qrsize; n++) {
+		uint64_t any = 0;
+		for (int p = 0; p + n * 3 <= qrsize; p++) {
+			darkRuns[p] &= triples[p + n * 3 - 3];
+			any |= darkRuns[p];
+		}
+		if (any == 0)
+			break;
+		for (int c = n * 2; c + n * 5 <= qrsize; c++) {
+			uint64_t core = ~line[c - 1] & darkRuns[c] & ~line[c + n * 3];
+			for (int k = 1; k <= n * 2 && core != 0; k++) {
+				if (k <= n)  // Light runs of n on both sides of the center
+					core &= ~line[c - k] & ~line[c + n * 3 + k - 1];
+				else  // Then dark runs of n
+					core &= line[c - k] & line[c + n * 3 + k - 1];
+			}
+			core &= ~line[c - n * 2 - 1] & ~line[c + n * 5];
+			if (core == 0)
+				continue;
+			// The light modules before the pattern (which starts at c - 2n) and after it (which ends at c + 5n)
+			uint64_t before = ~(uint64_t)0, after = ~(uint64_t)0;
+			uint64_t beforeN = 0, afterN = 0;
+			for (int k = 1; k <= n * 4; k++) {
+				before &= ~line[c - n * 2 - k];
+				after &= ~line[c + n * 5 + k - 1];
+				if (k == n) {
+					beforeN = before;
+					afterN = after;
+				}
+			}
+			slicedCounterAdd(counts->finders, 0, core & before & afterN);
+			slicedCounterAdd(counts->finders, 0, core & after & beforeN);
+		}
+	}
+}
+
+
+// Adds 2^k to the given bit-sliced counter in every lane whose bit of x is set.
+static void slicedCounterAdd(uint64_t counter[SLICED_COUNTER_BITS], int k, uint64_t x) {
+	for (; x != 0; k++) {
+		assert(k < SLICED_COUNTER_BITS);
+		uint64_t carry = counter[k] & x;
+		counter[k] ^= x;
+		x = carry;
+	}
+}
+
+
+// Adds to the given bit-sliced counter the number of the words x[0 : n] that have each lane's bit set. Rather than
+// adding them one at a time, every 8 words are summed with a tree of carry-save adders into the ones, twos and fours
+// bits of a running sum, so that only the eights go into the counter (which is known as the Harley-Seal method).
+static void slicedCounterAddAll(uint64_t counter[SLICED_COUNTER_BITS], const uint64_t x[], int n) {
+	// Each step adds a and b to the running bit *sum, which keeps the low bit and returns the carry
+	struct CarrySave {
+		static uint64_t add(uint64_t *sum, uint64_t a, uint64_t b) {
+			uint64_t half = *sum ^ a;
+			uint64_t carry = (*sum & a) | (half & b);
+			*sum = half ^ b;
+			return carry;
+		}
+	};
+	uint64_t ones = 0, twos = 0, fours = 0;
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint64_t twosA = CarrySave::add(&ones, x[i + 0], x[i + 1]);
+		uint64_t twosB = CarrySave::add(&ones, x[i + 2], x[i + 3]);
+		uint64_t foursA = CarrySave::add(&twos, twosA, twosB);
+		twosA = CarrySave::add(&ones, x[i + 4], x[i + 5]);
+		twosB = CarrySave::add(&ones, x[i + 6], x[i + 7]);
+		uint64_t foursB = CarrySave::add(&twos, twosA, twosB);
+		slicedCounterAdd(counter, 3, CarrySave::add(&fours, foursA, foursB));
+	}
+	for (; i < n; i++)
+		slicedCounterAdd(counter, 0, x[i]);
+	slicedCounterAdd(counter, 0, ones);
+	slicedCounterAdd(counter, 1, twos);
+	slicedCounterAdd(counter, 2, fours);
+}
+
+
+// Returns the count of the given lane of the given bit-sliced counter.
+static long slicedCounterGet(const uint64_t counter[SLICED_COUNTER_BITS], int lane) {
+	long result = 0;
+	for (int k = 0; k < SLICED_COUNTER_BITS; k++)
+		result |= (long)((counter[k] >> lane) & 1) << k;
+	return result;
+}
+
+}
+
+
+
+/*---- Incremental codeword updates for C++ ----*/
+
+namespace qrcodegen {
+
+// The codewords and the unmasked grid of the last QR Code of an encoder that updates them in place, with the tables
+// that place each data codeword and the penalty scores of its lines. The vectors are sized by setCodewordStream()
+// for a version and error correction level.
+struct CodewordStream {
+	int version;                         // 0 if nothing is laid out yet
+	enum qrcodegen_Ecc ecl;
+	bool drawn;                          // Whether the following hold a QR Code of the version
+	std::vector<uint8_t> data;           // The data codewords, block after block
+	std::vector<uint8_t> codewords;      // The interleaved data and ECC codewords
+	struct BitGrid unmasked;             // The codewords drawn on the function patterns
+	struct LinePenalties penalties;      // The lines of unmasked, with the lines that changed since maskQrCode() marked
+	std::vector<int> codewordModules;    // See listCodewordModules()
+	std::vector<int> dataIndexes;        // The index in codewords of each data codeword
+	std::vector<int> dataBlocks;         // The block of each data codeword
+	std::vector<int> blockStarts;        // The index in data where each block starts, then the number of data codewords
+	uint8_t rsdiv[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+	std::vector<uint8_t> changedBlocks;  // Scratch space for the blocks and codewords that an update changes
+	std::vector<int> changedCodewords;
+};
+
+
+static void setCodewordStream(struct CodewordStream *cs, int version, enum qrcodegen_Ecc ecl,
+	const struct BitGrid *functionModules);
+static void drawCodewordStream(struct CodewordStream *cs, uint8_t data[], const struct BitGrid *functionModules);
+static void redrawChangedCodewords(struct CodewordStream *cs, const struct BitGrid *functionModules);
+static void markAllLinesDirty(struct CodewordStream *cs);
+
+
+// Lays out the codewords of the given version and error correction level like addEccAndInterleave() and drawCodewords()
+// do, where functionModules holds the function modules of the version. Nothing is drawn until drawCodewordStream().
+static void setCodewordStream(struct CodewordStream *cs, int version, enum qrcodegen_Ecc ecl,
+		const struct BitGrid *functionModules) {
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)ecl][version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [(int)ecl][version];
+	int rawCodewords = getNumRawDataModules(version) / 8;
+	int dataLen = getNumDataCodewords(version, ecl);
+	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
+	int shortBlockDataLen = rawCodewords / numBlocks - blockEccLen;
+	cs->version = version;
+	cs->ecl = ecl;
+	cs->drawn = false;
+	cs->data.resize((size_t)dataLen);
+	cs->codewords.resize((size_t)rawCodewords);
+	cs->dataIndexes.resize((size_t)dataLen);
+	cs->dataBlocks.resize((size_t)dataLen);
+	cs->blockStarts.resize((size_t)numBlocks + 1);
+	for (int i = 0, p = 0; i < numBlocks; i++) {
+		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
+		cs->blockStarts[i] = p;
+		for (int j = 0, k = i; j < datLen; j++, k += numBlocks, p++) {
+			if (j == shortBlockDataLen)
+				k -= numShortBlocks;
+			cs->dataIndexes[p] = k;
+			cs->dataBlocks[p] = i;
+		}
+	}
+	cs->blockStarts[numBlocks] = dataLen;
+	reedSolomonComputeDivisor(blockEccLen, cs->rsdiv);
+	cs->changedBlocks.resize((size_t)numBlocks);
+	cs->changedCodewords.reserve((size_t)rawCodewords);
+	cs->codewordModules.resize((size_t)getNumRawDataModules(version));
+	listCodewordModules(functionModules, cs->codewordModules.data());
+}
+
+
+// Draws the QR Code of the given data codewords, as built by makeDataCodewords() at the version and error correction
+// level of the stream, in full. data is clobbered past the data codewords like in addEccAndInterleave().
+static void drawCodewordStream(struct CodewordStream *cs, uint8_t data[], const struct BitGrid *functionModules) {
+	memcpy(cs->data.data(), data, cs->data.size() * sizeof(cs->data[0]));
+	addEccAndInterleave(data, cs->version, cs->ecl, cs->codewords.data());
+	getFunctionTemplate(cs->version, NULL, &cs->unmasked);
+	drawCodewords(cs->codewords.data(), (int)cs->codewords.size(), functionModules, &cs->unmasked);
+	markAllLinesDirty(cs);
+	cs->drawn = true;
+}
+
+
+// Redraws the codewords listed in cs->changedCodewords on the unmasked grid, and marks their lines dirty.
+// Setting each module costs about as much as the whole zigzag scan of drawCodewords() divided among an
+// eighth of the codewords, so when more than that changed, the grid is drawn afresh instead.
+static void redrawChangedCodewords(struct CodewordStream *cs, const struct BitGrid *functionModules) {
+	const std::vector<int> &changed = cs->changedCodewords;
+	const uint8_t *codewords = cs->codewords.data();
+	if (changed.size() > cs->codewords.size() / 8) {
+		getFunctionTemplate(cs->version, NULL, &cs->unmasked);
+		drawCodewords(codewords, (int)cs->codewords.size(), functionModules, &cs->unmasked);
+		markAllLinesDirty(cs);
+		return;
+	}
+	int qrsize = cs->unmasked.size;
+	for (int k : changed) {
+		for (int b = 0; b < 8; b++) {
+			int index = cs->codewordModules[k * 8 + b];
+			int x = index % qrsize, y = index / qrsize;
+			gridSetModule(&cs->unmasked, x, y, ((codewords[k] >> (7 - b)) & 1) != 0);
+			cs->penalties.dirtyRows[y] = 1;
+			cs->penalties.dirtyColumns[x] = 1;
+		}
+	}
+}
+
+
+// Marks every line of the stream's grid for rescoring, as after it is drawn afresh.
+static void markAllLinesDirty(struct CodewordStream *cs) {
+	memset(cs->penalties.dirtyRows, 1, sizeof(cs->penalties.dirtyRows));
+	memset(cs->penalties.dirtyColumns, 1, sizeof(cs->penalties.dirtyColumns));
+}
+
+}
+
+
+
+/*---- Sequence encoder for C++ ----*/
+
+namespace qrcodegen {
+
+// The most digits that a counter can have, which is enough for every uint64_t value.
+#define SEQUENCE_DIGITS_MAX 20
+
+// The state of a SequenceEncoder. The vectors are sized by start() for the version of the sequence.
+struct SequenceWorkspace {
+	std::unique_ptr<EncoderWorkspace> encoder;  // The scratch buffers, and the QR Code that the views read
+	EncodeOptions options;
+	std::vector<char> text;        // The text of the current counter value, NUL-terminated
+	size_t counterEnd;             // The index in text just past the last digit of the counter
+	int counterWidth;
+	uint64_t counter;
+	uint64_t counterMax;
+	bool started;                  // Whether start() succeeded
+	bool exhausted;                // Whether next() has made the QR Code of counterMax
+	struct CodewordStream stream;  // The last QR Code of the sequence
+	
+	// The ECC of the block of each data codeword, when that codeword is 1 and the rest of the block is 0.
+	// These are computed when the codeword first changes, from the polynomial 1 in unit.
+	std::vector<uint8_t> contributions;
+	std::vector<uint8_t> hasContribution;
+	std::vector<uint8_t> unit;
+};
+
+
+static void setSequenceStream(struct SequenceWorkspace *ws, int version, enum qrcodegen_Ecc ecl);
+static void writeSequenceCounter(struct SequenceWorkspace *ws);
+static void updateSequenceCodewords(struct SequenceWorkspace *ws, const uint8_t newData[]);
+
+
+SequenceEncoder::SequenceEncoder() : workspace(new SequenceWorkspace) {
+	workspace->encoder.reset(new EncoderWorkspace);
+	workspace->counter = 0;
+	workspace->started = false;
+	workspace->exhausted = false;
+	workspace->stream.version = 0;
+}
+
+
+SequenceEncoder::~SequenceEncoder() = default;
+SequenceEncoder::SequenceEncoder(SequenceEncoder &&other) noexcept = default;
+SequenceEncoder &SequenceEncoder::operator=(SequenceEncoder &&other) noexcept = default;
+
+
+
+bool SequenceEncoder::start(const char *pattern, uint64_t first, const EncodeOptions &options) {
+	assert(pattern != NULL);
+	SequenceWorkspace *ws = workspace.get();
+	EncoderWorkspace *enc = ws->encoder.get();
+	ws->started = false;
+	
+	// The counter replaces the last run of '#'
+	size_t len = strlen(pattern);
+	size_t end = len;
+	while (end > 0 && pattern[end - 1] != '#')
+		end--;
+	size_t begin = end;
+	while (begin > 0 && pattern[begin - 1] == '#')
+		begin--;
+	int width = (int)(end - begin);
+	if (width == 0 || width > SEQUENCE_DIGITS_MAX)
+		return false;
+	uint64_t max = UINT64_MAX;
+	if (width < SEQUENCE_DIGITS_MAX) {
+		max = 1;
+		for (int i = 0; i < width; i++)
+			max *= 10;
+		max--;
+	}
+	if (first > max)
+		return false;
+	ws->text.assign(pattern, pattern + len + 1);
+	ws->counterEnd = end;
+	ws->counterWidth = width;
+	ws->counter = first;
+	ws->counterMax = max;
+	ws->options = options;
+	
+	// Every text of the sequence has the version and error correction level of the first
+	writeSequenceCounter(ws);
+	size_t numSegs;
+	if (!makeTextSegments(ws->text.data(), options, enc->segments, enc->segmentData, &numSegs))
+		return false;
+	enum qrcodegen_Ecc ecl = options.ecl;
+	int version = makeDataCodewords(enc->segments, numSegs, &ecl,
+		options.minVersion, options.maxVersion, options.boostEcl, enc->dataCodewords);
+	if (version == 0)
+		return false;
+	setSequenceStream(ws, version, ecl);
+	ws->started = true;
+	ws->exhausted = false;
+	return true;
+}
+
+
+QrCodeView SequenceEncoder::next() {
+	SequenceWorkspace *ws = workspace.get();
+	EncoderWorkspace *enc = ws->encoder.get();
+	if (!ws->started || ws->exhausted)
+		return QrCodeView::finish(enc, false);
+	const EncodeOptions &options = ws->options;
+	std::chrono::steady_clock::time_point deadline;
+	if (options.budgetMicros >= 0)
+		deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(options.budgetMicros);
+	
+	// Build the data codewords of the text, which only differ from the last ones where the digits changed
+	writeSequenceCounter(ws);
+	size_t numSegs;
+	bool ok = makeTextSegments(ws->text.data(), options, enc->segments, enc->segmentData, &numSegs);
+	enum qrcodegen_Ecc ecl = options.ecl;
+	int version = ok ? makeDataCodewords(enc->segments, numSegs, &ecl,
+		options.minVersion, options.maxVersion, options.boostEcl, enc->dataCodewords) : 0;
+	struct CodewordStream *cs = &ws->stream;
+	bool last = ws->counter == ws->counterMax;
+	if (!last)
+		ws->counter++;
+	ws->exhausted = last;
+	if (version == 0)
+		return QrCodeView::finish(enc, false);
+	
+	// The codewords of a text are only laid out like the last ones if the version and error correction level are
+	// the same, which the texts of a sequence share. Should one differ, its QR Code is drawn afresh.
+	if (version != cs->version || ecl != cs->ecl)
+		setSequenceStream(ws, version, ecl);
+	
+	// The first QR Code is drawn in full, and the others are updated from it
+	if (!cs->drawn)
+		drawCodewordStream(cs, enc->dataCodewords, &enc->state.functionModules);
+	else
+		updateSequenceCodewords(ws, enc->dataCodewords);
+	enc->state.grid.size = cs->unmasked.size;
+	memcpy(enc->state.grid.rows, cs->unmasked.rows, (size_t)cs->unmasked.size * sizeof(cs->unmasked.rows[0]));
+	maskQrCode(ecl, options.mask, options.budgetMicros >= 0 ? &deadline : NULL, &cs->penalties, &enc->state);
+	return QrCodeView::finish(enc, true);
+}
+
+
+bool SequenceEncoder::done() const {
+	return !workspace->started || workspace->exhausted;
+}
+
+
+uint64_t SequenceEncoder::counter() const {
+	return workspace->counter;
+}
+
+
+// Lays out the codeword stream of the sequence for the given version and error correction level, with nothing drawn
+// yet, and forgets the ECC contributions of the data codewords, which depend on the blocks.
+static void setSequenceStream(struct SequenceWorkspace *ws, int version, enum qrcodegen_Ecc ecl) {
+	EncoderWorkspace *enc = ws->encoder.get();
+	if (enc->state.templateVersion != version) {
+		getFunctionTemplate(version, &enc->state.functionModules, NULL);
+		enc->state.templateVersion = version;
+	}
+	struct CodewordStream *cs = &ws->stream;
+	setCodewordStream(cs, version, ecl, &enc->state.functionModules);
+	
+	int dataLen = (int)cs->data.size();
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK[(int)ecl][version];
+	ws->contributions.resize((size_t)dataLen * blockEccLen);
+	ws->hasContribution.assign((size_t)dataLen, 0);
+	ws->unit.assign((size_t)(cs->blockStarts[cs->blockStarts.size() - 1] - cs->blockStarts[cs->blockStarts.size() - 2]), 0);
+	ws->unit[0] = 1;
+}
+
+
+// Writes the current counter value into the text, zero-padded to the width of the counter.
+static void writeSequenceCounter(struct SequenceWorkspace *ws) {
+	uint64_t value = ws->counter;
+	for (int i = 1; i <= ws->counterWidth; i++) {
+		ws->text[ws->counterEnd - i] = (char)('0' + value % 10);
+		value /= 10;
+	}
+}
+
+
+// Changes the codewords and the unmasked grid of the last QR Code to those of the given data codewords. The new ECC
+// of a block is its old ECC plus, for every data codeword that changed by delta, delta times that codeword's
+// contribution, since the remainder of a sum of polynomials is the sum of their remainders. Then the modules of
+// just the changed data and ECC codewords are redrawn.
+static void updateSequenceCodewords(struct SequenceWorkspace *ws, const uint8_t newData[]) {
+	struct CodewordStream *cs = &ws->stream;
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)cs->ecl][cs->version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [(int)cs->ecl][cs->version];
+	int dataLen = (int)cs->data.size();
+	uint8_t *codewords = cs->codewords.data();
+	std::vector<int> &changed = cs->changedCodewords;
+	changed.clear();
+	std::fill(cs->changedBlocks.begin(), cs->changedBlocks.end(), 0);
+	for (int p = 0; p < dataLen; p++) {
+		uint8_t delta = cs->data[p] ^ newData[p];
+		if (delta == 0)
+			continue;
+		cs->data[p] = newData[p];
+		codewords[cs->dataIndexes[p]] = newData[p];
+		changed.push_back(cs->dataIndexes[p]);
+		
+		int block = cs->dataBlocks[p];
+		uint8_t *contribution = &ws->contributions[(size_t)p * blockEccLen];
+		if (!ws->hasContribution[p]) {  // The remainder of x^(blockEccLen + codewords after p in its block)
+			reedSolomonComputeRemainder(ws->unit.data(), cs->blockStarts[block + 1] - p,
+				cs->rsdiv, blockEccLen, contribution);
+			ws->hasContribution[p] = 1;
+		}
+		int logDelta = GF.log[delta];
+		for (int j = 0, k = dataLen + block; j < blockEccLen; j++, k += numBlocks) {
+			if (contribution[j] != 0)
+				codewords[k] ^= GF.exp[logDelta + GF.log[contribution[j]]];
+		}
+		cs->changedBlocks[block] = 1;
+	}
+	for (int i = 0; i < numBlocks; i++) {
+		for (int j = 0, k = dataLen + i; cs->changedBlocks[i] && j < blockEccLen; j++, k += numBlocks)
+			changed.push_back(k);
+	}
+	redrawChangedCodewords(cs, &ws->encoder->state.functionModules);
+}
+
+}
+
+
+
+/*---- Incremental encoder for C++ ----*/
+
+namespace qrcodegen {
+
+// The state of an IncrementalEncoder.
+struct IncrementalWorkspace {
+	std::unique_ptr<EncoderWorkspace> encoder;  // The scratch buffers, and the QR Code that the views read
+	struct CodewordStream stream;               // The last QR Code, if the last encoding succeeded
+};
+
+
+static bool updateIncrementalCodewords(struct CodewordStream *cs, const uint8_t newData[],
+	const struct BitGrid *functionModules);
+
+
+IncrementalEncoder::IncrementalEncoder() : workspace(new IncrementalWorkspace) {
+	workspace->encoder.reset(new EncoderWorkspace);
+	workspace->stream.version = 0;
+}
+
+
+IncrementalEncoder::~IncrementalEncoder() = default;
+IncrementalEncoder::IncrementalEncoder(IncrementalEncoder &&other) noexcept = default;
+IncrementalEncoder &IncrementalEncoder::operator=(IncrementalEncoder &&other) noexcept = default;
+
+
+
+QrCodeView IncrementalEncoder::encode(const char *text, const EncodeOptions &options) {
+	assert(text != NULL);
+	assert(-3 <= (int)options.mask && (int)options.mask <= 7);
+	IncrementalWorkspace *ws = workspace.get();
+	EncoderWorkspace *enc = ws->encoder.get();
+	struct CodewordStream *cs = &ws->stream;
+	std::chrono::steady_clock::time_point deadline;
+	if (options.budgetMicros >= 0)
+		deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(options.budgetMicros);
+	
+	size_t numSegs;
+	if (!makeTextSegments(text, options, enc->segments, enc->segmentData, &numSegs))
+		return QrCodeView::finish(enc, false);
+	enum qrcodegen_Ecc ecl = options.ecl;
+	int version = makeDataCodewords(enc->segments, numSegs, &ecl,
+		options.minVersion, options.maxVersion, options.boostEcl, enc->dataCodewords);
+	if (version == 0)
+		return QrCodeView::finish(enc, false);
+	
+	// Keep the last QR Code if it has the same version and error correction level, else lay out the new one
+	struct BitGrid *functionModules = &enc->state.functionModules;
+	if (enc->state.templateVersion != version) {
+		getFunctionTemplate(version, functionModules, NULL);
+		enc->state.templateVersion = version;
+	}
+	if (version != cs->version || ecl != cs->ecl)
+		setCodewordStream(cs, version, ecl, functionModules);
+	if (!cs->drawn || !updateIncrementalCodewords(cs, enc->dataCodewords, functionModules))
+		drawCodewordStream(cs, enc->dataCodewords, functionModules);
+	enc->state.grid.size = cs->unmasked.size;
+	memcpy(enc->state.grid.rows, cs->unmasked.rows, (size_t)cs->unmasked.size * sizeof(cs->unmasked.rows[0]));
+	maskQrCode(ecl, options.mask, options.budgetMicros >= 0 ? &deadline : NULL, &cs->penalties, &enc->state);
+	return QrCodeView::finish(enc, true);
+}
+
+
+// Changes the codewords and the unmasked grid of the last QR Code to those of the given data codewords, by computing
+// the ECC of only the blocks whose data changed and redrawing only the codewords that changed. Returns false without
+// changing anything if more than half of the blocks changed, where drawing the QR Code afresh is faster.
+static bool updateIncrementalCodewords(struct CodewordStream *cs, const uint8_t newData[],
+		const struct BitGrid *functionModules) {
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[(int)cs->ecl][cs->version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [(int)cs->ecl][cs->version];
+	int dataLen = (int)cs->data.size();
+	int numChanged = 0;
+	for (int i = 0; i < numBlocks; i++) {
+		int start = cs->blockStarts[i];
+		bool blockChanged = memcmp(&cs->data[start], &newData[start], (size_t)(cs->blockStarts[i + 1] - start)) != 0;
+		cs->changedBlocks[i] = blockChanged;
+		numChanged += blockChanged;
+	}
+	if (numChanged * 2 > numBlocks)
+		return false;
+	
+	uint8_t *codewords = cs->codewords.data();
+	std::vector<int> &changed = cs->changedCodewords;
+	changed.clear();
+	for (int i = 0; i < numBlocks; i++) {
+		if (!cs->changedBlocks[i])
+			continue;
+		int start = cs->blockStarts[i], end = cs->blockStarts[i + 1];
+		for (int p = start; p < end; p++) {
+			if (cs->data[p] != newData[p]) {
+				cs->data[p] = newData[p];
+				codewords[cs->dataIndexes[p]] = newData[p];
+				changed.push_back(cs->dataIndexes[p]);
+			}
+		}
+		uint8_t ecc[qrcodegen_REED_SOLOMON_DEGREE_MAX];
+		reedSolomonComputeRemainder(&cs->data[start], end - start, cs->rsdiv, blockEccLen, ecc);
+		for (int j = 0, k = dataLen + i; j < blockEccLen; j++, k += numBlocks) {
+			if (codewords[k] != ecc[j]) {
+				codewords[k] = ecc[j];
+				changed.push_back(k);
+			}
+		}
+	}
+	redrawChangedCodewords(cs, functionModules);
+	return true;
+}
+
+}
+
+
+
+/*---- Multi-threaded batch encoding for C++ ----*/
+
+namespace qrcodegen {
+
+// The number of jobs that a thread of encodeBatch() takes at a time, which fills a bit-sliced group.
+#define POOL_CHUNK_JOBS BATCH_LANES
+
+// The jobs of the sorted order that a thread of encodeBatch() starts with, from next to end, where next is
+// advanced by the thread itself and by the threads that steal from it. It is past end once all are taken.
+// Padded so that the threads advancing different ranges do not contend for a cache line.
+struct PoolRange {
+	std::atomic<size_t> next;
+	size_t end;
+	char padding[64 - sizeof(size_t)];
+};
+
+// The scratch space of a thread of encodeBatch().
+struct PoolWorker {
+	BatchEncoder encoder;
+	std::vector<const char *> texts;
+	std::vector<uint8_t *> qrcodes;
+	size_t numOk;
+};
+
+
+static uint64_t getPoolJobKey(const EncodeJob &job);
+static size_t takePoolChunk(struct PoolRange *range);
+template <typename Work> static void runOnThreads(int numThreads, const Work &work);
+
+
+size_t encodeBatch(const EncodeJob jobs[], EncodeResult results[], size_t count, int numThreads) {
+	assert((jobs != NULL && results != NULL) || count == 0);
+#ifndef QRCODEGEN_NO_THREADS
+	if (numThreads <= 0)
+		numThreads = (int)std::thread::hardware_concurrency();
+#else
+	numThreads = 1;
+#endif
+	size_t numChunks = (count + POOL_CHUNK_JOBS - 1) / POOL_CHUNK_JOBS;
+	if ((size_t)numThreads > numChunks)
+		numThreads = (int)numChunks;
+	if (numThreads < 1)
+		numThreads = 1;
+	
+	// Sort the jobs by their options and then by the version that they probably need, so that each thread
+	// works through long runs that share the function templates, divisors and bit-sliced groups
+	std::vector<std::pair<uint64_t, size_t> > order(count);
+	runOnThreads(numThreads, [&](int thread) {
+		for (size_t i = count * thread / numThreads; i < count * (thread + 1) / numThreads; i++)
+			order[i] = std::make_pair(getPoolJobKey(jobs[i]), i);
+	});
+	std::sort(order.begin(), order.end());
+	
+	// Give each thread a contiguous range of whole chunks, and its own scratch space
+	std::unique_ptr<PoolRange[]> ranges(new PoolRange[numThreads]);
+	std::vector<PoolWorker> workers((size_t)numThreads);
+	for (int i = 0; i < numThreads; i++) {
+		ranges[i].next.store(numChunks * i / numThreads * POOL_CHUNK_JOBS, std::memory_order_relaxed);
+		ranges[i].end = std::min(numChunks * (i + 1) / numThreads * POOL_CHUNK_JOBS, count);
+		workers[i].texts.reserve(POOL_CHUNK_JOBS);
+		workers[i].qrcodes.reserve(POOL_CHUNK_JOBS);
+		workers[i].numOk = 0;
+	}
+	
+	runOnThreads(numThreads, [&](int thread) {
+		struct PoolWorker *worker = &workers[thread];
+		for (;;) {
+			// Take the next chunk of this thread's range, or else of the range with the most jobs left
+			struct PoolRange *range = &ranges[thread];
+			size_t start = takePoolChunk(range);
+			while (start == SIZE_MAX) {
+				range = NULL;
+				size_t mostLeft = 0;
+				for (int i = 0; i < numThreads; i++) {
+					size_t next = ranges[i].next.load(std::memory_order_relaxed);
+					if (next < ranges[i].end && ranges[i].end - next > mostLeft) {
+						range = &ranges[i];
+						mostLeft = ranges[i].end - next;
+					}
+				}
+				if (range == NULL)
+					return;
+				start = takePoolChunk(range);
+			}
+			size_t end = std::min(start + POOL_CHUNK_JOBS, range->end);
+			
+			// Encode each run of jobs with the same options as one batch
+			for (size_t runEnd; start < end; start = runEnd) {
+				uint64_t options = order[start].first >> 8;
+				worker->texts.clear();
+				worker->qrcodes.clear();
+				for (runEnd = start; runEnd < end && order[runEnd].first >> 8 == options; runEnd++) {
+					size_t i = order[runEnd].second;
+					assert(jobs[i].text != NULL && results[i].qrcode != NULL);
+					worker->texts.push_back(jobs[i].text);
+					worker->qrcodes.push_back(results[i].qrcode);
+				}
+				EncodeOptions opts = jobs[order[start].second].options;
+				if (opts.mask == qrcodegen_Mask_AUTO_PARALLEL)
+					opts.mask = qrcodegen_Mask_AUTO;
+				worker->numOk += worker->encoder.encode(worker->texts.data(), worker->texts.size(), worker->qrcodes.data(), opts);
+				for (size_t j = start; j < runEnd; j++) {
+					size_t i = order[j].second;
+					results[i].ok = results[i].qrcode[0] != 0;
+				}
+			}
+		}
+	});
+	
+	size_t numOk = 0;
+	for (const PoolWorker &worker : workers)
+		numOk += worker.numOk;
+	return numOk;
+}
+
+
+// Returns the sort key of the given job, which holds the options that BatchEncoder::encode() uses, above the
+// lowest 8 bits, which hold the version that the text needs as a single segment (or 0 if it does not fit).
+static uint64_t getPoolJobKey(const EncodeJob &job) {
+	const EncodeOptions &opts = job.options;
+	int mask = opts.mask == qrcodegen_Mask_AUTO_PARALLEL ? (int)qrcodegen_Mask_AUTO : (int)opts.mask;
+	uint64_t key = (uint64_t)opts.ecl;
+	key = key << 6 | (uint64_t)opts.minVersion;
+	key = key << 6 | (uint64_t)opts.maxVersion;
+	key = key << 4 | (uint64_t)(mask + 3);
+	key = key << 1 | (opts.boostEcl ? 1 : 0);
+	key = key << 1 | (opts.optimalSegments ? 1 : 0);
+	int version = qrcodegen_getMinVersionForText(job.text, opts.ecl, opts.minVersion, opts.maxVersion);
+	return key << 8 | (uint64_t)version;
+}
+
+
+// Takes the next chunk of jobs from the given range, and returns its start, or SIZE_MAX if none are left.
+static size_t takePoolChunk(struct PoolRange *range) {
+	size_t start = range->next.fetch_add(POOL_CHUNK_JOBS, std::memory_order_relaxed);
+	return start < range->end ? start : SIZE_MAX;
+}
+
+
+// Calls work(i) for every i in [0, numThreads), on a thread of its own except for work(0), which runs on the
+// calling thread. If a thread can't be started, its work runs on the calling thread instead, after work(0).
+template <typename Work>
+static void runOnThreads(int numThreads, const Work &work) {
+	int started = 1;
+#ifndef QRCODEGEN_NO_THREADS
+	std::vector<std::thread> threads;
+	try {
+		threads.reserve((size_t)numThreads);
+		for (; started < numThreads; started++)
+			threads.emplace_back([&work, started] { work(started); });
+	} catch (...) {}
+#endif
+	work(0);
+	for (int i = started; i < numThreads; i++)
+		work(i);
+#ifndef QRCODEGEN_NO_THREADS
+	for (std::thread &thread : threads)
+		thread.join();
+#endif
+}
+
+}
+
+
+
+#undef qrcodegen_REED_SOLOMON_DEGREE_MAX
 #undef LENGTH_OVERFLOW
\ No newline at end of file
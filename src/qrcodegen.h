@@ -46,6 +46,22 @@ extern "C" {
  * - Low level: Custom-make the list of segments and call
  *   qrcodegen_encodeSegments() or qrcodegen_encodeSegmentsAdvanced().
  * (Note that all ways require supplying the desired error correction level and various byte buffers.)
+ * 
+ * Resource use of the C functions: they don't perform I/O or allocate memory on the heap, they use
+ * only their arguments and constant tables, and they are thread-safe as long as concurrent calls
+ * don't share a writable buffer. The exceptions are:
+ * - The encoding functions (qrcodegen_encodeText(), qrcodegen_encodeBinary(), qrcodegen_encodeSegments(),
+ *   qrcodegen_encodeSegmentsAdvanced() and qrcodegen_encodeSegmentsDeadline()) and qrcodegen_getMaskPenalties()
+ *   work on row-aligned copies of the module grid of about 4 KB each, which are kept on the stack.
+ *   They need about 24 KB of stack (measured with GCC -O2 on x86-64) for any version, or about 18 KB
+ *   with a fixed mask. qrcodegen_makeSegmentsOptimally() needs about 8 KB, and the rest well under 1 KB.
+ * - With qrcodegen_Mask_AUTO_PARALLEL, the encoding functions start up to 7 std::thread workers for
+ *   versions 10 and up, which allocates memory and gives each thread its own stack. Where the
+ *   library is built with QRCODEGEN_NO_THREADS, such as Emscripten without pthreads, it behaves
+ *   like qrcodegen_Mask_AUTO.
+ * - qrcodegen_encodeSegmentsDeadline() reads std::chrono::steady_clock when budgetMicros is not negative.
+ * - On x86 with GCC or Clang, vector kernels are chosen from the CPU features that the compiler
+ *   runtime detects once at startup (__builtin_cpu_supports).
  */
 
 
@@ -71,6 +87,12 @@ enum qrcodegen_Mask {
 	// A special value to tell the QR Code encoder to
 	// automatically select an appropriate mask pattern
 	qrcodegen_Mask_AUTO = -1,
+	// Selects the same mask as qrcodegen_Mask_AUTO, but scores the candidates
+	// on several threads, which lowers the latency of large QR Codes
+	qrcodegen_Mask_AUTO_PARALLEL = -2,
+	// Selects a mask quickly from estimated penalty scores, which
+	// skip the finder-like pattern rule, so it may not be the best
+	qrcodegen_Mask_AUTO_FAST = -3,
 	// The eight actual mask patterns
 	qrcodegen_Mask_0 = 0,
 	qrcodegen_Mask_1,
@@ -159,7 +181,8 @@ struct qrcodegen_Segment {
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO, qrcodegen_Mask_AUTO_PARALLEL or qrcodegen_Mask_AUTO_FAST
+ * to automatically choose an appropriate mask (which may be slow).
  * 
  * About the arrays, letting len = qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion):
  * - Before calling the function:
@@ -199,7 +222,8 @@ bool qrcodegen_encodeText(const char *text, uint8_t tempBuffer[], uint8_t qrcode
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO, qrcodegen_Mask_AUTO_PARALLEL or qrcodegen_Mask_AUTO_FAST
+ * to automatically choose an appropriate mask (which may be slow).
  * 
  * About the arrays, letting len = qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion):
  * - Before calling the function:
@@ -275,7 +299,8 @@ bool qrcodegen_encodeSegments(const struct qrcodegen_Segment segs[], size_t len,
  * chosen for the output. Iff boostEcl is true, then the ECC level of the result
  * may be higher than the ecl argument if it can be done without increasing the
  * version. The mask is either between qrcodegen_Mask_0 to 7 to force that mask, or
- * qrcodegen_Mask_AUTO to automatically choose an appropriate mask (which may be slow).
+ * qrcodegen_Mask_AUTO, qrcodegen_Mask_AUTO_PARALLEL or qrcodegen_Mask_AUTO_FAST
+ * to automatically choose an appropriate mask (which may be slow).
  * 
  * About the byte arrays, letting len = qrcodegen_BUFFER_LEN_FOR_VERSION(qrcodegen_VERSION_MAX):
  * - Before calling the function:
@@ -303,6 +328,46 @@ bool qrcodegen_encodeSegmentsAdvanced(const struct qrcodegen_Segment segs[], siz
 	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, uint8_t tempBuffer[], uint8_t qrcode[]);
 
 
+/* 
+ * Encodes the given segments to a QR Code like qrcodegen_encodeSegmentsAdvanced(),
+ * but with a time budget for choosing the mask. If budgetMicros is negative then
+ * there is no budget, and this function is equivalent to qrcodegen_encodeSegmentsAdvanced().
+ * 
+ * Otherwise, if mask is qrcodegen_Mask_AUTO or qrcodegen_Mask_AUTO_PARALLEL, the
+ * candidate masks are ranked by their estimated penalty scores (as with
+ * qrcodegen_Mask_AUTO_FAST) and then scored exactly in that order, one at a time,
+ * until all are done or budgetMicros microseconds have passed since the call began.
+ * The mask with the lowest exact score so far is used, and at least the top ranked
+ * one is always scored. So the result is the same as with qrcodegen_Mask_AUTO if
+ * the budget suffices, and never worse than with qrcodegen_Mask_AUTO_FAST.
+ * The budget does not affect the other mask values, nor the rest of the encoding work.
+ */
+bool qrcodegen_encodeSegmentsDeadline(const struct qrcodegen_Segment segs[], size_t len, enum qrcodegen_Ecc ecl,
+	int minVersion, int maxVersion, enum qrcodegen_Mask mask, bool boostEcl, long budgetMicros,
+	uint8_t tempBuffer[], uint8_t qrcode[]);
+
+
+/* 
+ * Returns the smallest version number in the range [minVersion, maxVersion] whose
+ * capacity at the given ECC level can hold the given segments, or 0 if the data
+ * is too long for every version in the range. This is the version that
+ * qrcodegen_encodeSegmentsAdvanced() chooses, without doing any encoding.
+ * Only the mode, numChars and bitLength of each segment are read; the data
+ * pointers may be NULL. Requires 1 <= minVersion <= maxVersion <= 40.
+ */
+int qrcodegen_getMinVersion(const struct qrcodegen_Segment segs[], size_t len,
+	enum qrcodegen_Ecc ecl, int minVersion, int maxVersion);
+
+
+/* 
+ * Returns the version number that qrcodegen_encodeText() would choose for the
+ * given text and arguments before any ECC boost, or 0 if encoding would fail.
+ * This takes time linear in the text length, and is meant for quick feedback
+ * while the text is being edited. Requires 1 <= minVersion <= maxVersion <= 40.
+ */
+int qrcodegen_getMinVersionForText(const char *text, enum qrcodegen_Ecc ecl, int minVersion, int maxVersion);
+
+
 /* 
  * Tests whether the given string can be encoded as a segment in numeric mode.
  * A string is encodable iff each character is in the range 0 to 9.
@@ -318,6 +383,24 @@ bool qrcodegen_isNumeric(const char *text);
 bool qrcodegen_isAlphanumeric(const char *text);
 
 
+/* 
+ * Tests whether the given UTF-8 string can be encoded as a segment in kanji mode.
+ * A string is encodable iff each character is in the double-byte part of Shift JIS
+ * (JIS X 0208), which includes the kanji, kana and full-width forms used in Japanese.
+ */
+bool qrcodegen_isKanji(const char *text);
+
+
+/* 
+ * Returns the most compact of the three modes that can encode the whole given string
+ * as one segment: qrcodegen_Mode_NUMERIC if qrcodegen_isNumeric() is true (which
+ * includes the empty string), else qrcodegen_Mode_ALPHANUMERIC if qrcodegen_isAlphanumeric()
+ * is true, else qrcodegen_Mode_BYTE. If textLen is not NULL, the length of the string
+ * is stored there, which spares the caller a strlen(). No byte past the NUL terminator is read.
+ */
+enum qrcodegen_Mode qrcodegen_getTextMode(const char *text, size_t *textLen);
+
+
 /* 
  * Returns the number of bytes (uint8_t) needed for the data buffer of a segment
  * containing the given number of characters using the given mode. Notes:
@@ -354,6 +437,15 @@ struct qrcodegen_Segment qrcodegen_makeNumeric(const char *digits, uint8_t buf[]
 struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t buf[]);
 
 
+/* 
+ * Returns a segment representing the given UTF-8 text string encoded in kanji mode,
+ * with 13 bits per character. Requires qrcodegen_isKanji(text) to be true. The buffer
+ * needs qrcodegen_calcSegmentBufferSize(qrcodegen_Mode_KANJI, numChars) bytes,
+ * where numChars counts characters, not bytes.
+ */
+struct qrcodegen_Segment qrcodegen_makeKanji(const char *text, uint8_t buf[]);
+
+
 /* 
  * Returns a segment representing an Extended Channel Interpretation
  * (ECI) designator with the given assignment value.
@@ -361,6 +453,29 @@ struct qrcodegen_Segment qrcodegen_makeAlphanumeric(const char *text, uint8_t bu
 struct qrcodegen_Segment qrcodegen_makeEci(long assignVal, uint8_t buf[]);
 
 
+/* 
+ * Splits the given UTF-8 text into numeric, alphanumeric, byte and kanji mode segments
+ * such that their total bit length is the minimum possible, and returns the number of
+ * segments, or -1 on failure. Pass the segments and the same ecl, minVersion and maxVersion
+ * to qrcodegen_encodeSegmentsAdvanced() to get the smallest QR Code for the text.
+ * Notes:
+ * - The widths of the character count fields depend on the version, so the split is
+ *   made for the smallest version in the range whose capacity at the given ECC level
+ *   can hold it, which is never larger than the version qrcodegen_encodeText() uses.
+ * - Byte mode segments hold the UTF-8 bytes of their characters, as in qrcodegen_encodeText(),
+ *   and kanji mode segments hold the Shift JIS values of theirs. Bytes that are not valid
+ *   UTF-8 are allowed, and are encoded in byte mode.
+ * - Fails if the text does not fit in any version in the range, or if the split needs more
+ *   than maxSegs segments. A text of n bytes never needs more than n segments.
+ * - The data of all segments is written to buf, which must have room for
+ *   qrcodegen_BUFFER_LEN_FOR_VERSION(maxVersion) bytes. It is not a valid tempBuffer
+ *   argument to qrcodegen_encodeSegmentsAdvanced(), since the segments point into it.
+ * - Returns 0 for the empty string. Requires 1 <= minVersion <= maxVersion <= 40.
+ */
+int qrcodegen_makeSegmentsOptimally(const char *text, enum qrcodegen_Ecc ecl, int minVersion, int maxVersion,
+	struct qrcodegen_Segment segs[], size_t maxSegs, uint8_t buf[]);
+
+
 /*---- Functions to extract raw data from QR Codes ----*/
 
 /* 
@@ -380,6 +495,257 @@ int qrcodegen_getSize(const uint8_t qrcode[]);
 bool qrcodegen_getModule(const uint8_t qrcode[], int x, int y);
 
 
+/* 
+ * Calculates the penalty score that each of the 8 mask patterns would give the
+ * given QR Code, storing the score of mask i in penalties[i], and returns the
+ * mask that the QR Code actually uses. The QR Code must have been successfully
+ * generated by this library. With qrcodegen_Mask_AUTO, the encoder chooses the
+ * mask with the lowest penalty (the lowest index among equals), so this can be
+ * used to show why a particular mask was chosen. All 8 scores are computed in a
+ * single pass over the modules, which is about as fast as scoring one mask.
+ */
+enum qrcodegen_Mask qrcodegen_getMaskPenalties(const uint8_t qrcode[], long penalties[8]);
+
+
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+
+#ifdef __cplusplus
+
+#include <memory>
+
+namespace qrcodegen {
+
+/*---- Reusable encoder for C++ ----*/
+
+/* 
+ * The arguments of an encoding, with the same meaning as in qrcodegen_encodeSegmentsDeadline().
+ * With optimalSegments, text is split into segments by qrcodegen_makeSegmentsOptimally()
+ * instead of being encoded as a single segment like in qrcodegen_encodeText().
+ */
+struct EncodeOptions {
+	enum qrcodegen_Ecc ecl = qrcodegen_Ecc_LOW;
+	int minVersion = qrcodegen_VERSION_MIN;
+	int maxVersion = qrcodegen_VERSION_MAX;
+	enum qrcodegen_Mask mask = qrcodegen_Mask_AUTO;
+	bool boostEcl = true;
+	bool optimalSegments = false;
+	long budgetMicros = -1;
+};
+
+
+struct EncoderWorkspace;  // Private scratch space and state of an Encoder
+
+
+/* 
+ * The QR Code last made by an Encoder, read in place. A view is only valid until the next
+ * call to encode on the same Encoder, and converts to false if that encoding failed.
+ */
+class QrCodeView {
+public:
+	explicit operator bool() const { return workspace != nullptr; }
+	
+	// The side length in the range [21, 177], and the parameters that the QR Code was made with
+	int size() const;
+	int version() const;
+	enum qrcodegen_Ecc ecl() const;
+	enum qrcodegen_Mask mask() const;
+	
+	// Returns the color of the module at the given coordinates, like qrcodegen_getModule()
+	bool getModule(int x, int y) const;
+	
+	// Writes the QR Code into qrcode in the packed format that the C functions produce,
+	// which needs qrcodegen_BUFFER_LEN_FOR_VERSION(version()) bytes
+	void copyTo(uint8_t qrcode[]) const;
+	
+	// Returns the mask and its penalty scores like qrcodegen_getMaskPenalties()
+	enum qrcodegen_Mask getMaskPenalties(long penalties[8]) const;
+	
+private:
+	friend class Encoder;
+	friend class SequenceEncoder;
+	friend class IncrementalEncoder;
+	explicit QrCodeView(const EncoderWorkspace *ws) : workspace(ws) {}
+	static QrCodeView finish(EncoderWorkspace *ws, bool ok);
+	const EncoderWorkspace *workspace;
+};
+
+
+/* 
+ * Encodes QR Codes one after another with the same scratch space, which is allocated once by
+ * the constructor and aligned for the vector kernels. The QR Code is built in place and read
+ * through the returned view, so an encoding makes no heap allocations and no copies of the
+ * text or of the finished QR Code. If the next QR Code has the same version as the last one,
+ * its function modules are still loaded. An Encoder is not safe to use from several threads
+ * at once, but separate Encoders are independent.
+ */
+class Encoder {
+public:
+	Encoder();
+	~Encoder();
+	Encoder(Encoder &&other) noexcept;
+	Encoder &operator=(Encoder &&other) noexcept;
+	Encoder(const Encoder &) = delete;
+	Encoder &operator=(const Encoder &) = delete;
+	
+	// Encodes the given UTF-8 text like qrcodegen_encodeText(), without copying byte mode text
+	QrCodeView encode(const char *text, const EncodeOptions &options = EncodeOptions());
+	
+	// Encodes the given bytes like qrcodegen_encodeBinary(), reading them in place
+	QrCodeView encodeBinary(const uint8_t data[], size_t dataLen, const EncodeOptions &options = EncodeOptions());
+	
+	// Encodes the given segments like qrcodegen_encodeSegmentsDeadline(), ignoring options.optimalSegments
+	QrCodeView encodeSegments(const struct qrcodegen_Segment segs[], size_t len, const EncodeOptions &options = EncodeOptions());
+	
+private:
+	std::unique_ptr<EncoderWorkspace> workspace;
+};
+
+
+
+/*---- Bit-sliced batch encoder for C++ ----*/
+
+struct BatchWorkspace;  // Private scratch space of a BatchEncoder
+
+
+/* 
+ * Encodes many texts at once, with the same results as Encoder::encode(). The texts are grouped by the
+ * version and error correction level that they need, and each group of up to 64 is encoded in bit-sliced
+ * form: every module of the grid is a 64-bit word that holds this module of all the QR Codes, one bit
+ * each, so that the Reed-Solomon coding, drawing, masking and penalty rules work on 64 QR Codes with
+ * each word operation. This pays off when many of the texts need the same version, as with a run of
+ * tickets or labels. The scratch space is kept between calls. A BatchEncoder is not safe to use from
+ * several threads at once, but separate BatchEncoders are independent.
+ */
+class BatchEncoder {
+public:
+	BatchEncoder();
+	~BatchEncoder();
+	BatchEncoder(BatchEncoder &&other) noexcept;
+	BatchEncoder &operator=(BatchEncoder &&other) noexcept;
+	BatchEncoder(const BatchEncoder &) = delete;
+	BatchEncoder &operator=(const BatchEncoder &) = delete;
+	
+	// Encodes the UTF-8 text texts[i] into the packed QR Code qrcodes[i] for every i in [0, count), where each
+	// buffer needs qrcodegen_BUFFER_LEN_FOR_VERSION(options.maxVersion) bytes. Returns how many texts fit; the
+	// QR Code of every other text gets the invalid size 0. The automatic masks are all scored exactly, except
+	// qrcodegen_Mask_AUTO_FAST, which is estimated like in the C functions, and options.budgetMicros is ignored.
+	size_t encode(const char *const texts[], size_t count, uint8_t *const qrcodes[],
+		const EncodeOptions &options = EncodeOptions());
+	
+private:
+	std::unique_ptr<BatchWorkspace> workspace;
+};
+
+
+
+/*---- Sequence encoder for C++ ----*/
+
+struct SequenceWorkspace;  // Private scratch space and state of a SequenceEncoder
+
+
+/* 
+ * Encodes a run of texts that differ only in a decimal counter, such as ASSET-000000001 to ASSET-010000000.
+ * The texts come from a pattern whose last run of '#' characters is replaced by the counter, zero-padded to
+ * the width of the run. All of them have the same length and kinds of characters, so they are encoded in the
+ * same segments at the same version and error correction level, and only the few data codewords that hold the
+ * last digits usually change. Reed-Solomon codes are linear, so the ECC of each block is updated by XORing in
+ * the contribution of each changed data byte, which is computed once for each byte position, and only the
+ * modules of the changed codewords are redrawn before the mask is chosen again. The QR Codes are the same as
+ * Encoder::encode() makes from each text. Like an Encoder, the QR Code is read through a view that is valid
+ * until the next call, and next() makes no heap allocations.
+ */
+class SequenceEncoder {
+public:
+	SequenceEncoder();
+	~SequenceEncoder();
+	SequenceEncoder(SequenceEncoder &&other) noexcept;
+	SequenceEncoder &operator=(SequenceEncoder &&other) noexcept;
+	SequenceEncoder(const SequenceEncoder &) = delete;
+	SequenceEncoder &operator=(const SequenceEncoder &) = delete;
+	
+	// Starts the sequence of the given pattern at the given counter value. Returns false if the pattern has no '#',
+	// or the value has too many digits, or the texts do not fit in the version range of the options.
+	bool start(const char *pattern, uint64_t first, const EncodeOptions &options = EncodeOptions());
+	
+	// Encodes the text of the current counter value, then increments the counter. The view converts to false if the
+	// sequence was not started or the counter has gone past the largest value that its width can hold.
+	QrCodeView next();
+	
+	// Returns whether next() has no QR Code left to make, because the sequence was not started, or the
+	// last start() failed, or next() has already made the QR Code of the largest value of the counter
+	bool done() const;
+	
+	// The counter value of the QR Code that next() makes. Only meaningful while done() is false.
+	uint64_t counter() const;
+	
+private:
+	std::unique_ptr<SequenceWorkspace> workspace;
+};
+
+
+
+/*---- Incremental encoder for C++ ----*/
+
+struct IncrementalWorkspace;  // Private scratch space and state of an IncrementalEncoder
+
+
+/* 
+ * Encodes text like an Encoder, but keeps the codewords and the unmasked grid of the last QR Code, which suits
+ * re-encoding a text after each small edit. If the new text has the same version and error correction level,
+ * the ECC is recomputed only for the blocks whose data codewords changed, and only the changed codewords are
+ * redrawn, before the mask is chosen again. When most blocks changed, such as after an edit near the start of
+ * the text that shifts the rest of it, the QR Code is drawn afresh. The QR Codes are the same as Encoder::encode()
+ * makes. The view is valid until the next call, and encoding only allocates for a larger QR Code than before.
+ */
+class IncrementalEncoder {
+public:
+	IncrementalEncoder();
+	~IncrementalEncoder();
+	IncrementalEncoder(IncrementalEncoder &&other) noexcept;
+	IncrementalEncoder &operator=(IncrementalEncoder &&other) noexcept;
+	IncrementalEncoder(const IncrementalEncoder &) = delete;
+	IncrementalEncoder &operator=(const IncrementalEncoder &) = delete;
+	
+	// Encodes the given UTF-8 text like Encoder::encode()
+	QrCodeView encode(const char *text, const EncodeOptions &options = EncodeOptions());
+	
+private:
+	std::unique_ptr<IncrementalWorkspace> workspace;
+};
+
+
+
+/*---- Multi-threaded batch encoding for C++ ----*/
+
+// A text for encodeBatch() to encode, with its own options.
+struct EncodeJob {
+	const char *text;
+	EncodeOptions options;
+};
+
+// Where encodeBatch() puts the QR Code of a job. The caller points qrcode at a buffer of
+// qrcodegen_BUFFER_LEN_FOR_VERSION(options.maxVersion) bytes, and ok tells whether the text fit.
+struct EncodeResult {
+	uint8_t *qrcode;
+	bool ok;
+};
+
+
+/* 
+ * Encodes the text of jobs[i] into results[i] for every i in [0, count) on the given number of threads, or on
+ * one per hardware thread if numThreads is 0, and returns how many texts fit. Each QR Code is the same as
+ * BatchEncoder::encode() makes, so the results do not depend on the number of threads or on the order in which
+ * the jobs run. The jobs are sorted by their options and then by the version that they need, and each thread
+ * takes a contiguous run of them, encoding 64 at a time with its own BatchEncoder. A thread that runs out of
+ * work steals the next 64 from the thread with the most left. The threads already run in parallel, so
+ * qrcodegen_Mask_AUTO_PARALLEL is scored like qrcodegen_Mask_AUTO. Without thread support, everything runs
+ * on the calling thread.
+ */
+size_t encodeBatch(const EncodeJob jobs[], EncodeResult results[], size_t count, int numThreads = 0);
+
+}
+
+#endif
@@ -0,0 +1,652 @@
+/* 
+ * QR Code generator library (C)
+ * 
+ * Copyright (c) Project Nayuki. (MIT License)
+ * https://www.nayuki.io/page/qr-code-generator-library
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ * - The above copyright notice and this permission notice shall be included in
+ *   all copies or substantial portions of the Software.
+ * - The Software is provided "as is", without warranty of any kind, express or
+ *   implied, including but not limited to the warranties of merchantability,
+ *   fitness for a particular purpose and noninfringement. In no event shall the
+ *   authors or copyright holders be liable for any claim, damages or other
+ *   liability, whether in an action of contract, tort or otherwise, arising from,
+ *   out of or in connection with the Software or the use or other dealings in the
+ *   Software.
+ */
+
+#pragma once
+
+#include "qrcodegen.h"
+
+
+/* 
+ * Compile-time encoding of fixed text, for QR Codes whose payload is known when
+ * the program is built, such as support URLs and Wi-Fi onboarding strings:
+ * 
+ *   constexpr auto qr = qrcodegen::encodeConstexpr("WIFI:T:WPA;S:x;;", qrcodegen_Ecc_MEDIUM);
+ *   constexpr auto qr = qrcodegen::encodeConstexpr<"WIFI:T:WPA;S:x;;">(qrcodegen_Ecc_MEDIUM);  // C++20
+ * 
+ * The result holds the QR Code in the same packed format as the qrcode[] arrays of the
+ * C functions, and is the same QR Code that qrcodegen_encodeText() makes with versions
+ * 1 to 40 and the same arguments. qrcodegen_Mask_AUTO_PARALLEL scores the 8 masks serially
+ * like qrcodegen_Mask_AUTO, which chooses the same mask. qrcodegen_Mask_AUTO_FAST, whose
+ * estimate can choose another mask, is a compile error, and so is text that does not fit
+ * in any version.
+ * 
+ * This is a separate, straightforward implementation of the encoder, because the run-time
+ * one relies on vector kernels, threads and memcpy(). The two share their tables of constants.
+ * test/qrcodegen_test.cpp compares QR Codes of both at run time, and static_asserts there
+ * compare a few compile-time ones with hashes of the bytes that qrcodegen_encodeText() makes.
+ * Compilers bound the work of a constant evaluation, which with GCC's default limit allows
+ * up to about version 13. Larger QR Codes need a higher -fconstexpr-ops-limit (GCC) or
+ * -fconstexpr-steps (Clang).
+ */
+
+
+namespace qrcodegen {
+
+/* 
+ * A QR Code made at compile time, with qrcode[] sized for the largest version its text could need.
+ */
+template <size_t BufferLen>
+struct StaticQrCode {
+	uint8_t qrcode[BufferLen];
+	
+	// Returns the side length like qrcodegen_getSize()
+	constexpr int size() const {
+		return qrcode[0];
+	}
+	
+	// Returns the version number in the range [1, 40]
+	constexpr int version() const {
+		return (qrcode[0] - 17) / 4;
+	}
+	
+	// Returns the color of the module at the given coordinates like qrcodegen_getModule()
+	constexpr bool getModule(int x, int y) const {
+		int qrsize = qrcode[0];
+		int index = y * qrsize + x;
+		return 0 <= x && x < qrsize && 0 <= y && y < qrsize && ((qrcode[(index >> 3) + 1] >> (index & 7)) & 1) != 0;
+	}
+};
+
+
+namespace constexpr_detail {
+
+// The tables of constants below are the only definitions, and qrcodegen.cpp uses them too.
+
+// The set of all legal characters in alphanumeric mode, where each character
+// value maps to the index in the string. For checking text and encoding segments.
+constexpr char ALPHANUMERIC_CHARSET[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+// The index of every byte value in ALPHANUMERIC_CHARSET, or -1 if it is not in the set.
+// For checking and packing a character without searching the string.
+struct AlphanumericValues {
+	int8_t values[256];
+};
+
+constexpr struct AlphanumericValues makeAlphanumericValues() {
+	struct AlphanumericValues result = {};
+	for (int i = 0; i < 256; i++)
+		result.values[i] = -1;
+	for (int i = 0; ALPHANUMERIC_CHARSET[i] != '\0'; i++)
+		result.values[(uint8_t)ALPHANUMERIC_CHARSET[i]] = (int8_t)i;
+	return result;
+}
+
+constexpr struct AlphanumericValues ALPHANUMERIC_VALUES = makeAlphanumericValues();
+
+// For generating error correction codes.
+constexpr int8_t ECC_CODEWORDS_PER_BLOCK[4][41] = {
+	// Version: (note that index 0 is for padding, and is set to an illegal value)
+	//0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40    Error correction level
+	{-1,  7, 10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26, 30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},  // Low
+	{-1, 10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22, 24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},  // Medium
+	{-1, 13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24, 20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},  // Quartile
+	{-1, 17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22, 24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},  // High
+};
+
+// For generating error correction codes.
+constexpr int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41] = {
+	// Version: (note that index 0 is for padding, and is set to an illegal value)
+	//0, 1, 2, 3, 4, 5, 6, 7, 8, 9,10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40    Error correction level
+	{-1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 4,  4,  4,  4,  4,  6,  6,  6,  6,  7,  8,  8,  9,  9, 10, 12, 12, 12, 13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},  // Low
+	{-1, 1, 1, 1, 2, 2, 4, 4, 4, 5, 5,  5,  8,  9,  9, 10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25, 26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},  // Medium
+	{-1, 1, 1, 2, 2, 4, 4, 6, 6, 8, 8,  8, 10, 12, 16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34, 35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},  // Quartile
+	{-1, 1, 1, 2, 4, 4, 4, 5, 6, 8, 8, 11, 11, 16, 16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40, 42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},  // High
+};
+
+
+// Called in place of an encoding that cannot succeed, which stops the constant evaluation with an error
+// that names this function. Not constexpr on purpose.
+inline void textDoesNotFitInAnyVersion() {}
+
+// Like textDoesNotFitInAnyVersion(), for qrcodegen_Mask_AUTO_FAST.
+inline void maskAutoFastIsNotSupported() {}
+
+
+constexpr int getNumRawDataModules(int ver) {
+	int result = (16 * ver + 128) * ver + 64;
+	if (ver >= 2) {
+		int numAlign = ver / 7 + 2;
+		result -= (25 * numAlign - 10) * numAlign - 55;
+		if (ver >= 7)
+			result -= 36;
+	}
+	return result;
+}
+
+
+constexpr int getNumDataCodewords(int version, int ecl) {
+	return getNumRawDataModules(version) / 8
+		- ECC_CODEWORDS_PER_BLOCK[ecl][version] * NUM_ERROR_CORRECTION_BLOCKS[ecl][version];
+}
+
+
+// Returns the value of c in the alphanumeric charset, or -1 if it is not in the charset.
+constexpr int getAlphanumericValue(char c) {
+	return ALPHANUMERIC_VALUES.values[(uint8_t)c];
+}
+
+
+// The text of a single segment, classified like qrcodegen_getTextMode()
+struct TextSegment {
+	enum qrcodegen_Mode mode;
+	int numChars;
+	int bitLength;
+};
+
+
+constexpr TextSegment makeTextSegment(const char *text) {
+	int len = 0;
+	bool numeric = true, alphanumeric = true;
+	for (; text[len] != '\0'; len++) {
+		numeric = numeric && '0' <= text[len] && text[len] <= '9';
+		alphanumeric = alphanumeric && getAlphanumericValue(text[len]) >= 0;
+	}
+	if (numeric)
+		return TextSegment{qrcodegen_Mode_NUMERIC, len, len / 3 * 10 + (len % 3 == 0 ? 0 : len % 3 * 3 + 1)};
+	if (alphanumeric)
+		return TextSegment{qrcodegen_Mode_ALPHANUMERIC, len, len / 2 * 11 + len % 2 * 6};
+	return TextSegment{qrcodegen_Mode_BYTE, len, len * 8};
+}
+
+
+constexpr int numCharCountBits(enum qrcodegen_Mode mode, int version) {
+	int i = (version + 7) / 17;
+	return mode == qrcodegen_Mode_NUMERIC ? 10 + i * 2
+		: mode == qrcodegen_Mode_ALPHANUMERIC ? 9 + i * 2
+		: i == 0 ? 8 : 16;
+}
+
+
+// Returns the number of data bits the segment takes in the given version, or -1 if its count does not fit.
+constexpr int getTotalBits(const TextSegment &seg, int version) {
+	if (seg.numChars == 0)
+		return 0;
+	int ccbits = numCharCountBits(seg.mode, version);
+	return seg.numChars < (1L << ccbits) ? 4 + ccbits + seg.bitLength : -1;
+}
+
+
+// Returns the first version in [1, 40] that holds the segment at the given level, or 0 if none does.
+constexpr int getMinVersion(const TextSegment &seg, int ecl) {
+	for (int version = qrcodegen_VERSION_MIN; version <= qrcodegen_VERSION_MAX; version++) {
+		int bits = getTotalBits(seg, version);
+		if (bits != -1 && bits <= getNumDataCodewords(version, ecl) * 8)
+			return version;
+	}
+	return 0;
+}
+
+
+// Returns the buffer length for a text of the given number of bytes at the worst level and mode.
+constexpr size_t getBufferLenForText(size_t len) {
+	TextSegment seg{qrcodegen_Mode_BYTE, (int)len, (int)len * 8};
+	int version = len <= 7089 ? getMinVersion(seg, qrcodegen_Ecc_HIGH) : 0;
+	if (version == 0)
+		version = qrcodegen_VERSION_MAX;
+	return (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version);
+}
+
+
+constexpr void appendBits(unsigned int val, int numBits, uint8_t buffer[], int &bitLen) {
+	for (int i = numBits - 1; i >= 0; i--, bitLen++)
+		buffer[bitLen >> 3] |= (uint8_t)(((val >> i) & 1) << (7 - (bitLen & 7)));
+}
+
+
+constexpr uint8_t reedSolomonMultiply(uint8_t x, uint8_t y) {
+	uint8_t z = 0;
+	for (int i = 7; i >= 0; i--) {
+		z = (uint8_t)((z << 1) ^ ((z >> 7) * 0x11D));
+		z = (uint8_t)(z ^ ((y >> i) & 1) * x);
+	}
+	return z;
+}
+
+
+// Adds the ECC of each block to data[0 : dataLen] and interleaves all codewords into result.
+constexpr void addEccAndInterleave(const uint8_t data[], int version, int ecl, uint8_t result[]) {
+	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[ecl][version];
+	int blockEccLen = ECC_CODEWORDS_PER_BLOCK[ecl][version];
+	int rawCodewords = getNumRawDataModules(version) / 8;
+	int dataLen = getNumDataCodewords(version, ecl);
+	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
+	int shortBlockDataLen = rawCodewords / numBlocks - blockEccLen;
+	
+	uint8_t divisor[30] = {};
+	divisor[blockEccLen - 1] = 1;
+	uint8_t root = 1;
+	for (int i = 0; i < blockEccLen; i++) {
+		for (int j = 0; j < blockEccLen; j++) {
+			divisor[j] = reedSolomonMultiply(divisor[j], root);
+			if (j + 1 < blockEccLen)
+				divisor[j] ^= divisor[j + 1];
+		}
+		root = reedSolomonMultiply(root, 0x02);
+	}
+	
+	const uint8_t *dat = data;
+	for (int i = 0; i < numBlocks; i++) {
+		int datLen = shortBlockDataLen + (i < numShortBlocks ? 0 : 1);
+		uint8_t ecc[30] = {};
+		for (int j = 0; j < datLen; j++) {
+			uint8_t factor = dat[j] ^ ecc[0];
+			for (int k = 0; k < blockEccLen; k++)
+				ecc[k] = (uint8_t)((k + 1 < blockEccLen ? ecc[k + 1] : 0) ^ reedSolomonMultiply(divisor[k], factor));
+		}
+		for (int j = 0, k = i; j < datLen; j++, k += numBlocks) {
+			if (j == shortBlockDataLen)
+				k -= numShortBlocks;
+			result[k] = dat[j];
+		}
+		for (int j = 0, k = dataLen + i; j < blockEccLen; j++, k += numBlocks)
+			result[k] = ecc[j];
+		dat += datLen;
+	}
+}
+
+
+constexpr bool getModule(const uint8_t qrcode[], int x, int y) {
+	int index = y * qrcode[0] + x;
+	return ((qrcode[(index >> 3) + 1] >> (index & 7)) & 1) != 0;
+}
+
+
+constexpr void setModule(uint8_t qrcode[], int x, int y, bool isDark) {
+	int index = y * qrcode[0] + x;
+	if (isDark)
+		qrcode[(index >> 3) + 1] |= (uint8_t)(1 << (index & 7));
+	else
+		qrcode[(index >> 3) + 1] &= (uint8_t)~(1 << (index & 7));
+}
+
+
+constexpr void setModuleUnbounded(uint8_t qrcode[], int x, int y, bool isDark) {
+	if (0 <= x && x < qrcode[0] && 0 <= y && y < qrcode[0])
+		setModule(qrcode, x, y, isDark);
+}
+
+
+constexpr void fillRectangle(int left, int top, int width, int height, uint8_t qrcode[]) {
+	for (int dy = 0; dy < height; dy++) {
+		for (int dx = 0; dx < width; dx++)
+			setModule(qrcode, left + dx, top + dy, true);
+	}
+}
+
+
+constexpr int getAlignmentPatternPositions(int version, int result[7]) {
+	if (version == 1)
+		return 0;
+	int numAlign = version / 7 + 2;
+	int step = version == 32 ? 26 : (version * 4 + numAlign * 2 + 1) / (numAlign * 2 - 2) * 2;
+	for (int i = numAlign - 1, pos = version * 4 + 10; i >= 1; i--, pos -= step)
+		result[i] = pos;
+	result[0] = 6;
+	return numAlign;
+}
+
+
+// Marks every function module of the version dark in qrcode, which must be all light.
+constexpr void fillFunctionModules(int version, uint8_t qrcode[]) {
+	int qrsize = qrcode[0];
+	fillRectangle(6, 0, 1, qrsize, qrcode);
+	fillRectangle(0, 6, qrsize, 1, qrcode);
+	fillRectangle(0, 0, 9, 9, qrcode);
+	fillRectangle(qrsize - 8, 0, 8, 9, qrcode);
+	fillRectangle(0, qrsize - 8, 9, 8, qrcode);
+	int alignPatPos[7] = {};
+	int numAlign = getAlignmentPatternPositions(version, alignPatPos);
+	for (int i = 0; i < numAlign; i++) {
+		for (int j = 0; j < numAlign; j++) {
+			if (!((i == 0 && j == 0) || (i == 0 && j == numAlign - 1) || (i == numAlign - 1 && j == 0)))
+				fillRectangle(alignPatPos[i] - 2, alignPatPos[j] - 2, 5, 5, qrcode);
+		}
+	}
+	if (version >= 7) {
+		fillRectangle(qrsize - 11, 0, 3, 6, qrcode);
+		fillRectangle(0, qrsize - 11, 6, 3, qrcode);
+	}
+}
+
+
+// Draws the light modules and the version blocks over the dark function modules from fillFunctionModules().
+constexpr void drawLightFunctionModules(int version, uint8_t qrcode[]) {
+	int qrsize = qrcode[0];
+	for (int i = 7; i < qrsize - 7; i += 2) {
+		setModule(qrcode, 6, i, false);
+		setModule(qrcode, i, 6, false);
+	}
+	for (int dy = -4; dy <= 4; dy++) {
+		for (int dx = -4; dx <= 4; dx++) {
+			int dist = dx < 0 ? -dx : dx;
+			if ((dy < 0 ? -dy : dy) > dist)
+				dist = dy < 0 ? -dy : dy;
+			if (dist == 2 || dist == 4) {
+				setModuleUnbounded(qrcode, 3 + dx, 3 + dy, false);
+				setModuleUnbounded(qrcode, qrsize - 4 + dx, 3 + dy, false);
+				setModuleUnbounded(qrcode, 3 + dx, qrsize - 4 + dy, false);
+			}
+		}
+	}
+	int alignPatPos[7] = {};
+	int numAlign = getAlignmentPatternPositions(version, alignPatPos);
+	for (int i = 0; i < numAlign; i++) {
+		for (int j = 0; j < numAlign; j++) {
+			if ((i == 0 && j == 0) || (i == 0 && j == numAlign - 1) || (i == numAlign - 1 && j == 0))
+				continue;
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++)
+					setModule(qrcode, alignPatPos[i] + dx, alignPatPos[j] + dy, dx == 0 && dy == 0);
+			}
+		}
+	}
+	if (version >= 7) {
+		int rem = version;
+		for (int i = 0; i < 12; i++)
+			rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+		long bits = (long)version << 12 | rem;
+		for (int i = 0; i < 6; i++) {
+			for (int j = 0; j < 3; j++, bits >>= 1) {
+				setModule(qrcode, qrsize - 11 + j, i, (bits & 1) != 0);
+				setModule(qrcode, i, qrsize - 11 + j, (bits & 1) != 0);
+			}
+		}
+	}
+}
+
+
+constexpr void drawFormatBits(int ecl, int mask, uint8_t qrcode[]) {
+	int data = (ecl ^ 1) << 3 | mask;  // Maps the levels 0, 1, 2, 3 to the format values 1, 0, 3, 2
+	int rem = data;
+	for (int i = 0; i < 10; i++)
+		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+	int bits = (data << 10 | rem) ^ 0x5412;
+	int qrsize = qrcode[0];
+	for (int i = 0; i <= 5; i++)
+		setModule(qrcode, 8, i, ((bits >> i) & 1) != 0);
+	setModule(qrcode, 8, 7, ((bits >> 6) & 1) != 0);
+	setModule(qrcode, 8, 8, ((bits >> 7) & 1) != 0);
+	setModule(qrcode, 7, 8, ((bits >> 8) & 1) != 0);
+	for (int i = 9; i < 15; i++)
+		setModule(qrcode, 14 - i, 8, ((bits >> i) & 1) != 0);
+	for (int i = 0; i < 8; i++)
+		setModule(qrcode, qrsize - 1 - i, 8, ((bits >> i) & 1) != 0);
+	for (int i = 8; i < 15; i++)
+		setModule(qrcode, 8, qrsize - 15 + i, ((bits >> i) & 1) != 0);
+	setModule(qrcode, 8, qrsize - 8, true);
+}
+
+
+// Draws the codewords in the zigzag order onto the modules that are not marked in functionModules.
+constexpr void drawCodewords(const uint8_t data[], int dataLen, const uint8_t functionModules[], uint8_t qrcode[]) {
+	int qrsize = qrcode[0];
+	int i = 0;
+	for (int right = qrsize - 1; right >= 1; right -= 2) {
+		if (right == 6)
+			right = 5;
+		for (int vert = 0; vert < qrsize; vert++) {
+			for (int j = 0; j < 2; j++) {
+				int x = right - j;
+				int y = ((right + 1) & 2) == 0 ? qrsize - 1 - vert : vert;
+				if (!getModule(functionModules, x, y) && i < dataLen * 8) {
+					setModule(qrcode, x, y, ((data[i >> 3] >> (7 - (i & 7))) & 1) != 0);
+					i++;
+				}
+			}
+		}
+	}
+}
+
+
+constexpr void applyMask(const uint8_t functionModules[], uint8_t qrcode[], int mask) {
+	int qrsize = qrcode[0];
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x++) {
+			if (getModule(functionModules, x, y))
+				continue;
+			bool invert =
+				mask == 0 ? (x + y) % 2 == 0 :
+				mask == 1 ? y % 2 == 0 :
+				mask == 2 ? x % 3 == 0 :
+				mask == 3 ? (x + y) % 3 == 0 :
+				mask == 4 ? (x / 3 + y / 2) % 2 == 0 :
+				mask == 5 ? x * y % 2 + x * y % 3 == 0 :
+				mask == 6 ? (x * y % 2 + x * y % 3) % 2 == 0 :
+				((x + y) % 2 + x * y % 3) % 2 == 0;
+			if (invert)
+				setModule(qrcode, x, y, !getModule(qrcode, x, y));
+		}
+	}
+}
+
+
+// The run history of the finder-like pattern rule, with the light borders added.
+struct RunHistory {
+	int runs[7];
+	int qrsize;
+	
+	constexpr void add(int run) {
+		if (runs[0] == 0)
+			run += qrsize;
+		for (int i = 6; i > 0; i--)
+			runs[i] = runs[i - 1];
+		runs[0] = run;
+	}
+	
+	constexpr int countPatterns() const {
+		int n = runs[1];
+		bool core = n > 0 && runs[2] == n && runs[3] == n * 3 && runs[4] == n && runs[5] == n;
+		return (core && runs[0] >= n * 4 && runs[6] >= n ? 1 : 0)
+		     + (core && runs[6] >= n * 4 && runs[0] >= n ? 1 : 0);
+	}
+	
+	constexpr int terminateAndCount(bool runColor, int run) {
+		if (runColor) {
+			add(run);
+			run = 0;
+		}
+		add(run + qrsize);
+		return countPatterns();
+	}
+};
+
+
+// Returns the penalty score of the modules, the same as the run-time encoder's scores.
+constexpr long getPenaltyScore(const uint8_t qrcode[]) {
+	int qrsize = qrcode[0];
+	long result = 0;
+	for (int transpose = 0; transpose < 2; transpose++) {
+		for (int i = 0; i < qrsize; i++) {
+			bool runColor = false;
+			int run = 0;
+			RunHistory history = {{0, 0, 0, 0, 0, 0, 0}, qrsize};
+			for (int j = 0; j < qrsize; j++) {
+				bool color = transpose ? getModule(qrcode, i, j) : getModule(qrcode, j, i);
+				if (color == runColor) {
+					run++;
+					if (run == 5)
+						result += 3;
+					else if (run > 5)
+						result++;
+				} else {
+					history.add(run);
+					if (!runColor)
+						result += history.countPatterns() * 40;
+					runColor = color;
+					run = 1;
+				}
+			}
+			result += history.terminateAndCount(runColor, run) * 40;
+		}
+	}
+	int dark = 0;
+	for (int y = 0; y < qrsize; y++) {
+		for (int x = 0; x < qrsize; x++) {
+			bool color = getModule(qrcode, x, y);
+			dark += color ? 1 : 0;
+			if (x + 1 < qrsize && y + 1 < qrsize && color == getModule(qrcode, x + 1, y)
+					&& color == getModule(qrcode, x, y + 1) && color == getModule(qrcode, x + 1, y + 1))
+				result += 3;
+		}
+	}
+	int total = qrsize * qrsize;
+	long diff = dark * 20L - total * 10L;
+	result += ((diff < 0 ? -diff : diff) + total - 1) / total * 10 - 10;
+	return result;
+}
+
+
+template <size_t BufferLen>
+constexpr StaticQrCode<BufferLen> encodeText(const char *text, enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask, bool boostEcl) {
+	StaticQrCode<BufferLen> result = {};
+	if (mask == qrcodegen_Mask_AUTO_FAST) {
+		maskAutoFastIsNotSupported();
+		return result;
+	}
+	TextSegment seg = makeTextSegment(text);
+	int e = (int)ecl;
+	int version = getMinVersion(seg, e);
+	if (version == 0 || (size_t)qrcodegen_BUFFER_LEN_FOR_VERSION(version) > BufferLen) {
+		textDoesNotFitInAnyVersion();
+		return result;
+	}
+	int dataUsedBits = getTotalBits(seg, version);
+	for (int i = (int)qrcodegen_Ecc_MEDIUM; i <= (int)qrcodegen_Ecc_HIGH; i++) {
+		if (boostEcl && dataUsedBits <= getNumDataCodewords(version, i) * 8)
+			e = i;
+	}
+	
+	// Build the data bit string of the segment, the terminator and the pad bytes
+	uint8_t data[BufferLen] = {};
+	int bitLen = 0;
+	if (seg.numChars > 0) {
+		appendBits((unsigned int)seg.mode, 4, data, bitLen);
+		appendBits((unsigned int)seg.numChars, numCharCountBits(seg.mode, version), data, bitLen);
+		for (int i = 0; i < seg.numChars; ) {
+			if (seg.mode == qrcodegen_Mode_NUMERIC) {
+				int count = seg.numChars - i < 3 ? seg.numChars - i : 3;
+				unsigned int val = 0;
+				for (int j = 0; j < count; j++)
+					val = val * 10 + (unsigned int)(text[i + j] - '0');
+				appendBits(val, count * 3 + 1, data, bitLen);
+				i += count;
+			} else if (seg.mode == qrcodegen_Mode_ALPHANUMERIC) {
+				if (seg.numChars - i >= 2) {
+					appendBits((unsigned int)(getAlphanumericValue(text[i]) * 45 + getAlphanumericValue(text[i + 1])), 11, data, bitLen);
+					i += 2;
+				} else {
+					appendBits((unsigned int)getAlphanumericValue(text[i]), 6, data, bitLen);
+					i++;
+				}
+			} else {
+				appendBits((unsigned int)(uint8_t)text[i], 8, data, bitLen);
+				i++;
+			}
+		}
+	}
+	int dataCapacityBits = getNumDataCodewords(version, e) * 8;
+	appendBits(0, dataCapacityBits - bitLen < 4 ? dataCapacityBits - bitLen : 4, data, bitLen);
+	appendBits(0, (8 - bitLen % 8) % 8, data, bitLen);
+	for (unsigned int padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
+		appendBits(padByte, 8, data, bitLen);
+	
+	// Draw the codewords and the function patterns, then choose and apply the mask
+	uint8_t codewords[BufferLen] = {};
+	addEccAndInterleave(data, version, e, codewords);
+	uint8_t functionModules[BufferLen] = {};
+	functionModules[0] = (uint8_t)(version * 4 + 17);
+	fillFunctionModules(version, functionModules);
+	uint8_t *qrcode = result.qrcode;
+	for (size_t i = 0; i < BufferLen; i++)
+		qrcode[i] = functionModules[i];
+	drawCodewords(codewords, getNumRawDataModules(version) / 8, functionModules, qrcode);
+	drawLightFunctionModules(version, qrcode);
+	int chosen = (int)mask;
+	if (chosen < 0) {
+		long minPenalty = 0;
+		for (int i = 0; i < 8; i++) {
+			applyMask(functionModules, qrcode, i);
+			drawFormatBits(e, i, qrcode);
+			long penalty = getPenaltyScore(qrcode);
+			if (i == 0 || penalty < minPenalty) {
+				chosen = i;
+				minPenalty = penalty;
+			}
+			applyMask(functionModules, qrcode, i);
+		}
+	}
+	applyMask(functionModules, qrcode, chosen);
+	drawFormatBits(e, chosen, qrcode);
+	return result;
+}
+
+}
+
+
+/* 
+ * Encodes the given text at compile time like qrcodegen_encodeText() with versions 1 to 40.
+ */
+template <size_t N>
+constexpr StaticQrCode<constexpr_detail::getBufferLenForText(N - 1)> encodeConstexpr(const char (&text)[N],
+		enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask = qrcodegen_Mask_AUTO, bool boostEcl = true) {
+	return constexpr_detail::encodeText<constexpr_detail::getBufferLenForText(N - 1)>(text, ecl, mask, boostEcl);
+}
+
+
+#if defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+
+/* 
+ * A string literal as a template argument, for the C++20 form of encodeConstexpr().
+ */
+template <size_t N>
+struct StringLiteral {
+	char chars[N];
+	
+	constexpr StringLiteral(const char (&text)[N]) : chars() {
+		for (size_t i = 0; i < N; i++)
+			chars[i] = text[i];
+	}
+};
+
+
+/* 
+ * Encodes the given text at compile time like the function form of encodeConstexpr().
+ */
+template <StringLiteral Text>
+constexpr auto encodeConstexpr(enum qrcodegen_Ecc ecl, enum qrcodegen_Mask mask = qrcodegen_Mask_AUTO, bool boostEcl = true) {
+	return encodeConstexpr(Text.chars, ecl, mask, boostEcl);
+}
+
+#endif
+
+}
@@ -0,0 +1,321 @@
+// Checks every encoder of the library against the plain C functions on random texts and options: each QR Code
+// of Encoder, IncrementalEncoder, BatchEncoder, SequenceEncoder and encodeBatch() must equal the one that
+// qrcodegen_encodeText() makes, or with options.optimalSegments the one that qrcodegen_encodeSegmentsAdvanced()
+// makes from qrcodegen_makeSegmentsOptimally(), and must fail where it fails. encodeConstexpr() is checked the
+// same way on fixed texts. The qrcodegen_test_scalar target builds the same checks without the vector kernels.
+//
+// Usage: qrcodegen_test [rounds [seed]]
+
+#include "qrcodegen.h"
+#include "qrcodegen_constexpr.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::mt19937_64 rng;
+static long checks   = 0;
+static long failures = 0;
+
+static int random_int(int min, int max) {
+  return std::uniform_int_distribution<int>(min, max)(rng);
+}
+
+// Returns a random text that is mostly digits, alphanumeric characters, printable ASCII, UTF-8 with kanji,
+// or arbitrary bytes, so that every mode and the splits between them come up. A few are long enough for
+// the largest versions.
+static std::string random_text() {
+  static const char* const pieces[] = {"\xC3\xA9", "\xE6\xBC\xA2", "\xE5\xAD\x97", "\xE3\x83\x86", "\xF0\x9F\x98\x80"};
+  static const char alphanumeric[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+  int kind   = random_int(0, 4);
+  int length = random_int(0, 9) == 0 ? random_int(0, kind == 0 ? 7200 : 3000) : random_int(0, 120);
+  std::string text;
+  while ((int)text.size() < length) {
+    int mix = random_int(0, 9);  // Runs of another kind of character, for the optimal segments
+    if (kind == 0 || (mix == 0 && kind != 4)) {
+      text += (char)('0' + random_int(0, 9));
+    } else if (kind == 1 || (mix == 1 && kind != 4)) {
+      text += alphanumeric[random_int(0, 44)];
+    } else if (kind == 2 || (kind == 3 && mix < 5)) {
+      text += (char)random_int(' ', '~');
+    } else if (kind == 3) {
+      text += pieces[random_int(0, 4)];
+    } else {
+      text += (char)random_int(1, 255);
+    }
+  }
+  return text;
+}
+
+static qrcodegen::EncodeOptions random_options() {
+  static const qrcodegen_Mask masks[] = {qrcodegen_Mask_AUTO, qrcodegen_Mask_AUTO_PARALLEL, qrcodegen_Mask_AUTO_FAST,
+                                         qrcodegen_Mask_0, qrcodegen_Mask_3, qrcodegen_Mask_7};
+  qrcodegen::EncodeOptions options;
+  options.ecl = (qrcodegen_Ecc)random_int(0, 3);
+  if (random_int(0, 3) == 0) {
+    options.minVersion = random_int(qrcodegen_VERSION_MIN, qrcodegen_VERSION_MAX);
+    options.maxVersion = random_int(options.minVersion, qrcodegen_VERSION_MAX);
+  }
+  options.mask            = masks[random_int(0, 5)];
+  options.boostEcl        = random_int(0, 1) == 1;
+  options.optimalSegments = random_int(0, 1) == 1;
+  return options;
+}
+
+// Encodes the text with the C functions into qrcode, which has room for any version.
+static bool encode_reference(const std::string& text, const qrcodegen::EncodeOptions& options, uint8_t qrcode[]) {
+  std::vector<uint8_t> temp(qrcodegen_BUFFER_LEN_MAX);
+  if (!options.optimalSegments) {
+    return qrcodegen_encodeText(text.c_str(), temp.data(), qrcode, options.ecl, options.minVersion, options.maxVersion,
+                                options.mask, options.boostEcl);
+  }
+  std::vector<qrcodegen_Segment> segs(text.size() + 1);
+  std::vector<uint8_t> buffer(qrcodegen_BUFFER_LEN_MAX);
+  int count = qrcodegen_makeSegmentsOptimally(text.c_str(), options.ecl, options.minVersion, options.maxVersion, segs.data(),
+                                              segs.size(), buffer.data());
+  return count >= 0 && qrcodegen_encodeSegmentsAdvanced(segs.data(), (size_t)count, options.ecl, options.minVersion,
+                                                         options.maxVersion, options.mask, options.boostEcl, temp.data(), qrcode);
+}
+
+// Counts a check of a QR Code against the reference for the same text and options, and reports a difference.
+static void check(const char* encoder, const std::string& text, const qrcodegen::EncodeOptions& options, bool ok,
+                  const uint8_t qrcode[]) {
+  std::vector<uint8_t> expected(qrcodegen_BUFFER_LEN_MAX);
+  bool expected_ok = encode_reference(text, options, expected.data());
+  ++checks;
+  if (ok == expected_ok && (!ok || memcmp(qrcode, expected.data(), qrcodegen_BUFFER_LEN_FOR_VERSION((expected[0] - 17) / 4)) == 0)) {
+    return;
+  }
+  ++failures;
+  std::fprintf(stderr, "%s differs (%s, expected %s) for a text of %zu bytes, ecl %d, versions %d to %d, mask %d, boost %d, optimal %d\n",
+               encoder, ok ? "ok" : "failed", expected_ok ? "ok" : "failed", text.size(), (int)options.ecl, options.minVersion,
+               options.maxVersion, (int)options.mask, (int)options.boostEcl, (int)options.optimalSegments);
+}
+
+static void check_view(const char* encoder, const std::string& text, const qrcodegen::EncodeOptions& options,
+                       const qrcodegen::QrCodeView& qr) {
+  std::vector<uint8_t> qrcode(qrcodegen_BUFFER_LEN_MAX);
+  if (qr) qr.copyTo(qrcode.data());
+  check(encoder, text, options, (bool)qr, qrcode.data());
+}
+
+static void test_encoder(qrcodegen::Encoder& encoder) {
+  std::string text                 = random_text();
+  qrcodegen::EncodeOptions options = random_options();
+  check_view("Encoder", text, options, encoder.encode(text.c_str(), options));
+}
+
+// Re-encodes a text after each of a run of random edits, sometimes with new options.
+static void test_incremental_encoder(qrcodegen::IncrementalEncoder& encoder) {
+  std::string text                 = random_text();
+  qrcodegen::EncodeOptions options = random_options();
+  for (int i = 0; i < 20; ++i) {
+    size_t at = (size_t)random_int(0, (int)text.size());
+    char c    = (char)random_int(1, 127);
+    switch (random_int(0, 4)) {
+      case 0: text.insert(at, 1, c); break;
+      case 1: if (at < text.size()) text.erase(at, 1); break;
+      case 2: if (at < text.size()) text[at] = c; break;
+      case 3: text += (char)('0' + random_int(0, 9)); break;
+      default: if (random_int(0, 3) == 0) options = random_options(); break;
+    }
+    check_view("IncrementalEncoder", text, options, encoder.encode(text.c_str(), options));
+  }
+}
+
+// Encodes texts of the same kind and similar lengths, so that groups of them need the same version.
+static void test_batch_encoder(qrcodegen::BatchEncoder& encoder) {
+  qrcodegen::EncodeOptions options = random_options();
+  std::string base                 = random_text();
+  int count                        = random_int(1, 150);
+  std::vector<std::string> texts;
+  for (int i = 0; i < count; ++i) {
+    std::string text = base.substr(0, base.size() - (size_t)random_int(0, (int)base.size() < 8 ? (int)base.size() : 8));
+    for (int j = random_int(0, 3); j > 0 && !text.empty(); --j) text[(size_t)random_int(0, (int)text.size() - 1)] = (char)random_int('0', '9');
+    texts.push_back(text);
+  }
+  std::vector<const char*> text_ptrs;
+  std::vector<std::vector<uint8_t>> qrcodes(texts.size(), std::vector<uint8_t>(qrcodegen_BUFFER_LEN_FOR_VERSION(options.maxVersion)));
+  std::vector<uint8_t*> qrcode_ptrs;
+  for (size_t i = 0; i < texts.size(); ++i) {
+    text_ptrs.push_back(texts[i].c_str());
+    qrcode_ptrs.push_back(qrcodes[i].data());
+  }
+  size_t fitted = encoder.encode(text_ptrs.data(), texts.size(), qrcode_ptrs.data(), options);
+  size_t ok     = 0;
+  for (size_t i = 0; i < texts.size(); ++i) {
+    ok += qrcodes[i][0] != 0;
+    check("BatchEncoder", texts[i], options, qrcodes[i][0] != 0, qrcodes[i].data());
+  }
+  ++checks;
+  if (fitted != ok) {
+    ++failures;
+    std::fprintf(stderr, "BatchEncoder returns %zu but made %zu QR Codes\n", fitted, ok);
+  }
+}
+
+// Encodes jobs whose options come from a few random sets, so that some runs share them, on 0 to 4 threads
+// and then on 5 to 9.
+static void test_encode_batch() {
+  qrcodegen::EncodeOptions option_sets[3] = {random_options(), random_options(), random_options()};
+  int count                               = random_int(0, 300);
+  std::vector<std::string> texts;
+  for (int i = 0; i < count; ++i) texts.push_back(random_text());
+  std::vector<qrcodegen::EncodeJob> jobs;
+  std::vector<std::vector<uint8_t>> qrcodes;
+  std::vector<qrcodegen::EncodeResult> results;
+  for (int i = 0; i < count; ++i) {
+    jobs.push_back({texts[(size_t)i].c_str(), option_sets[random_int(0, 2)]});
+    qrcodes.emplace_back(qrcodegen_BUFFER_LEN_FOR_VERSION(jobs.back().options.maxVersion));
+  }
+  for (std::vector<uint8_t>& qrcode : qrcodes) results.push_back({qrcode.data(), false});
+  size_t fitted = qrcodegen::encodeBatch(jobs.data(), results.data(), results.size(), random_int(0, 4));
+  size_t ok     = 0;
+  for (size_t i = 0; i < results.size(); ++i) {
+    ok += results[i].ok;
+    check("encodeBatch", texts[i], jobs[i].options, results[i].ok, results[i].qrcode);
+  }
+  ++checks;
+  if (fitted != ok) {
+    ++failures;
+    std::fprintf(stderr, "encodeBatch returns %zu but made %zu QR Codes\n", fitted, ok);
+  }
+
+  // The same jobs on another number of threads, whose chunks and steals fall differently, make the same bytes
+  std::vector<std::vector<uint8_t>> first_qrcodes = qrcodes;
+  std::vector<qrcodegen::EncodeResult> first_results = results;
+  for (std::vector<uint8_t>& qrcode : qrcodes) std::fill(qrcode.begin(), qrcode.end(), 0xAA);
+  qrcodegen::encodeBatch(jobs.data(), results.data(), results.size(), random_int(5, 9));
+  for (size_t i = 0; i < results.size(); ++i) {
+    size_t length = first_results[i].ok ? qrcodegen_BUFFER_LEN_FOR_VERSION((first_qrcodes[i][0] - 17) / 4) : 0;
+    ++checks;
+    if (results[i].ok != first_results[i].ok || memcmp(qrcodes[i].data(), first_qrcodes[i].data(), length) != 0) {
+      ++failures;
+      std::fprintf(stderr, "encodeBatch makes another QR Code of job %zu on another number of threads\n", i);
+    }
+  }
+}
+
+// Runs a sequence from a random counter value, sometimes until it is exhausted.
+static void test_sequence_encoder(qrcodegen::SequenceEncoder& encoder) {
+  std::string prefix = random_text().substr(0, (size_t)random_int(0, 60));
+  std::string suffix = random_text().substr(0, (size_t)random_int(0, 20));
+  for (char& c : suffix) {
+    if (c == '#') c = '-';  // The counter is the last run of '#'
+  }
+  int width    = random_int(1, 6);
+  uint64_t max = 1;
+  for (int i = 0; i < width; ++i) max *= 10;
+  max--;
+  uint64_t first                   = random_int(0, 1) == 0 ? max - (uint64_t)random_int(0, (int)(max < 20 ? max : 20))
+                                                           : std::uniform_int_distribution<uint64_t>(0, max)(rng);
+  std::string pattern              = prefix + std::string((size_t)width, '#') + suffix;
+  qrcodegen::EncodeOptions options = random_options();
+  bool started                     = encoder.start(pattern.c_str(), first, options);
+  for (uint64_t counter = first; counter <= max + 1 && counter < first + 40; ++counter) {
+    char digits[24];
+    std::snprintf(digits, sizeof(digits), "%0*" PRIu64, width, counter);
+    std::string text = prefix + digits + suffix;
+    ++checks;
+    if (encoder.done() != (!started || counter > max) || (!encoder.done() && encoder.counter() != counter)) {
+      ++failures;
+      std::fprintf(stderr, "SequenceEncoder reports the counter %" PRIu64 " or the end wrongly\n", counter);
+    }
+    if (started && counter > max) {
+      ++checks;
+      if (encoder.next()) {
+        ++failures;
+        std::fprintf(stderr, "SequenceEncoder goes on past %" PRIu64 "\n", max);
+      }
+      return;
+    }
+    if (!started) {
+      std::vector<uint8_t> qrcode(qrcodegen_BUFFER_LEN_MAX);
+      check("SequenceEncoder::start", text, options, false, qrcode.data());
+      return;
+    }
+    check_view("SequenceEncoder", text, options, encoder.next());
+  }
+}
+
+// Returns the 64-bit FNV-1a hash of the bytes of the given QR Code in the public format.
+template <size_t BufferLen>
+static constexpr uint64_t hash_qr_code(const qrcodegen::StaticQrCode<BufferLen>& qr) {
+  uint64_t result = UINT64_C(0xCBF29CE484222325);
+  for (int i = 0; i < qrcodegen_BUFFER_LEN_FOR_VERSION(qr.version()); i++) result = (result ^ qr.qrcode[i]) * UINT64_C(0x100000001B3);
+  return result;
+}
+
+// Checks QR Codes made at compile time, in every mode and with each kind of mask choice, against the run-time
+// encoder. A few of them are also pinned when this file compiles, by static_asserts on the hashes of the bytes
+// that qrcodegen_encodeText() makes for them, so a change to the compile-time encoder fails to build.
+static void test_encode_constexpr() {
+  static constexpr auto wifi    = qrcodegen::encodeConstexpr("WIFI:T:WPA;S:mynetwork;P:mypass;;", qrcodegen_Ecc_MEDIUM);
+  static constexpr auto url     = qrcodegen::encodeConstexpr("https://www.nayuki.io/", qrcodegen_Ecc_HIGH, qrcodegen_Mask_AUTO_PARALLEL);
+  static constexpr auto digits  = qrcodegen::encodeConstexpr("314159265358979323846264338327950288419716939937510", qrcodegen_Ecc_LOW,
+                                                             qrcodegen_Mask_AUTO, false);
+  static constexpr auto letters = qrcodegen::encodeConstexpr("HELLO WORLD", qrcodegen_Ecc_QUARTILE, qrcodegen_Mask_3, false);
+  static constexpr auto empty   = qrcodegen::encodeConstexpr("", qrcodegen_Ecc_LOW);
+  static constexpr auto kanji   = qrcodegen::encodeConstexpr("\xE6\xBC\xA2\xE5\xAD\x97 QR", qrcodegen_Ecc_QUARTILE, qrcodegen_Mask_6);
+  static constexpr auto long_text =
+      qrcodegen::encodeConstexpr("The quick brown fox jumps over the lazy dog, 0123456789 times over and over again.", qrcodegen_Ecc_LOW);
+
+  static_assert(hash_qr_code(wifi) == UINT64_C(0xBFB5211AF6E77B59), "Compile-time encoder differs in byte mode");
+  static_assert(hash_qr_code(url) == UINT64_C(0x6D1DBF7A03994CF9), "Compile-time encoder differs in byte mode at high ECC");
+  static_assert(hash_qr_code(digits) == UINT64_C(0x11AA4E7BB5A8EC0A), "Compile-time encoder differs in numeric mode");
+  static_assert(hash_qr_code(letters) == UINT64_C(0xA747E8930D238A36), "Compile-time encoder differs in alphanumeric mode");
+  static_assert(hash_qr_code(empty) == UINT64_C(0x651E00C41FFB6EBB), "Compile-time encoder differs for the empty string");
+
+  qrcodegen::EncodeOptions options;
+  options.ecl = qrcodegen_Ecc_MEDIUM;
+  check("encodeConstexpr", "WIFI:T:WPA;S:mynetwork;P:mypass;;", options, true, wifi.qrcode);
+  options.ecl  = qrcodegen_Ecc_HIGH;
+  options.mask = qrcodegen_Mask_AUTO_PARALLEL;
+  check("encodeConstexpr", "https://www.nayuki.io/", options, true, url.qrcode);
+  options.ecl      = qrcodegen_Ecc_LOW;
+  options.mask     = qrcodegen_Mask_AUTO;
+  options.boostEcl = false;
+  check("encodeConstexpr", "314159265358979323846264338327950288419716939937510", options, true, digits.qrcode);
+  options.ecl  = qrcodegen_Ecc_QUARTILE;
+  options.mask = qrcodegen_Mask_3;
+  check("encodeConstexpr", "HELLO WORLD", options, true, letters.qrcode);
+  options.ecl      = qrcodegen_Ecc_LOW;
+  options.mask     = qrcodegen_Mask_AUTO;
+  options.boostEcl = true;
+  check("encodeConstexpr", "", options, true, empty.qrcode);
+  check("encodeConstexpr", "The quick brown fox jumps over the lazy dog, 0123456789 times over and over again.", options, true,
+        long_text.qrcode);
+  options.ecl  = qrcodegen_Ecc_QUARTILE;
+  options.mask = qrcodegen_Mask_6;
+  check("encodeConstexpr", "\xE6\xBC\xA2\xE5\xAD\x97 QR", options, true, kanji.qrcode);
+}
+
+int main(int argc, char** argv) {
+  int rounds         = argc > 1 ? std::atoi(argv[1]) : 50;
+  unsigned long seed = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+  if (rounds < 1) {
+    std::fprintf(stderr, "Usage: %s [rounds [seed]]\n", argv[0]);
+    return 1;
+  }
+  rng.seed(seed);
+
+  qrcodegen::Encoder encoder;
+  qrcodegen::IncrementalEncoder incremental_encoder;
+  qrcodegen::BatchEncoder batch_encoder;
+  qrcodegen::SequenceEncoder sequence_encoder;
+  test_encode_constexpr();
+  for (int round = 0; round < rounds; ++round) {
+    for (int i = 0; i < 20; ++i) test_encoder(encoder);
+    test_incremental_encoder(incremental_encoder);
+    test_batch_encoder(batch_encoder);
+    test_encode_batch();
+    test_sequence_encoder(sequence_encoder);
+  }
+  std::printf("%ld checks, %ld failures\n", checks, failures);
+  return failures == 0 ? 0 : 1;
+}